@@ -1,17 +1,119 @@
 
 #include "joforth.h"
 #include "joforth_ir.h"
-#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
 #include <stdio.h>
+#include <stdarg.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+// images are mapped copy-on-write, see joforth_load_image
+#define JOFORTH_IMAGE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(JOFORTH_JIT) && !(defined(JOFORTH_IMAGE_MMAP) && defined(__linux__) && defined(__x86_64__) && JOFORTH_CELL_BITS == 64)
+// native code is only generated for x86-64 Linux with 64 bit cells, everywhere else words are always interpreted
+#undef JOFORTH_JIT
+#endif
+#if defined(JOFORTH_JIT)
+// calls before a word is compiled to native code
+#define JOFORTH_JIT_THRESHOLD       100
+// slots in the table of words each VM counts the calls to, see _jit_ready
+#define JOFORTH_JIT_WORDS_INITIAL_SIZE  64
+// size of the executable region of each VM, nothing more is compiled once it's full
+#define JOFORTH_JIT_SIZE            0x40000
+#endif
+
+#if JOFORTH_CHECKS == JOFORTH_CHECKS_ALWAYS
+_Noreturn void _joforth_check_failed(const char* condition, const char* file, int line) {
+    fprintf(stderr, "joforth: %s(%d): check failed: %s\n", file, line, condition);
+    abort();
+}
+#endif
+
+// words are case insensitive, names are stored in lower case
+static _JO_ALWAYS_INLINE unsigned char _lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c | 0x20) : c;
+}
 
 // based on https://en.wikipedia.org/wiki/Pearson_hashing#C,_64-bit
-// initialised at start up
-static unsigned char T[256];
-joforth_word_key_t pearson_hash(const char* _x) {
+// T is a fixed permutation of 0..255, so that hashing is deterministic and there is no shared 
+// state to initialise; dictionary keys are the same in every VM and every process, and the 
+// dictionary table of an image is used as it is
+static const unsigned char T[256] = {
+    246,  63,  80,  52,   0, 192, 171, 249, 179,  51, 242, 106, 102,  96, 252, 156,
+    204,  58, 186, 119,  62, 250, 210, 170,  84,  61,  73, 200,  75, 134, 129,  54,
+    226, 148,  59,   2,  41, 220,   7,  11, 165, 118, 176, 122, 217, 191, 187,  50,
+    141, 123,  87,  31, 230, 205, 231, 201, 243,  21, 160,  49, 131, 235, 247, 185,
+    136, 104, 197, 234, 188, 253,  24,  72,  16, 140,   8,  98, 116, 143, 132, 154,
+     79,  57,  53,  28,  68,  44, 142, 251, 153, 227, 108, 113,  35, 222,  38, 128,
+    184,  78, 157, 100, 137, 207,  99,  17, 202,  32, 183, 161, 159,  33, 189, 190,
+     12, 155, 206,  30, 212, 103,  18, 196,  74,  22,  43, 177,  66, 198,  83, 223,
+     40,  82, 117, 163, 145,  14,  90, 194,  39,  42, 229, 241, 225, 114, 112, 232,
+    237, 133,  46, 195, 172,  23,  36,  29, 150, 125,  27, 175, 215,  71, 239,  47,
+    147, 216,  64,  93,  94, 208, 127,  89, 245, 224, 162, 228, 166,  81,  67, 209,
+     69,  25,  95, 167,   5, 233, 213, 151, 244,  85, 120,  86, 169, 109, 121,   3,
+     48,   9, 101, 107, 111, 193, 135, 126, 173, 168,  91,   1,  26, 203,  55, 164,
+     37, 221, 152,  60, 138,  45,  34, 254,  10, 180, 158,  65,  15, 178, 219, 199,
+     19, 236, 115, 218,  56,  77, 181,  88,   6, 105, 255, 248, 110,  13, 149,  76,
+    240, 182, 124, 144,   4,  97, 174,  92, 146, 139, 238, 130,  70,  20, 211, 214,
+};
+
+// all output goes through here, to the VM's own sink
+static void _write(joforth_t* joforth, const char* text, size_t length) {
+    if (joforth->_output._write) {
+        joforth->_output._write(joforth->_output._context, text, length);
+    }
+    else {
+        fwrite(text, 1, length, stdout);
+    }
+}
+
+static void _print(joforth_t* joforth, const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length < sizeof(buffer)) {
+        _write(joforth, buffer, (size_t)length);
+        return;
+    }
+    // too long for the buffer, for example a long string or doc comment
+    char* text = (char*)joforth->_allocator._alloc((size_t)length + 1);
+    if (text) {
+        va_start(args, format);
+        vsnprintf(text, (size_t)length + 1, format, args);
+        va_end(args);
+        _write(joforth, text, (size_t)length);
+        joforth->_allocator._free(text);
+    }
+}
+
+// prints a value in the current base, for "."
+static void _print_value(joforth_t* joforth, joforth_value_t value) {
+    switch (joforth->_base)
+    {
+    case 10:
+        _print(joforth, "%lld", (long long)value);
+        break;
+    case 16:
+        _print(joforth, "%llx", (unsigned long long)(joforth_uvalue_t)value);
+        break;
+    default:
+        _print(joforth, "NaN");
+        break;
+    }
+}
+
+static joforth_word_key_t _pearson_hash(const char* _x, size_t length) {
     size_t i;
     size_t j;
     unsigned char h;
@@ -19,16 +121,20 @@ joforth_word_key_t pearson_hash(const char* _x) {
     const unsigned char* x = (const unsigned char*)_x;
 
     for (j = 0; j < sizeof(retval); ++j) {
-        h = T[(x[0] + j) % 256];
+        h = T[(_lower(x[0]) + j) % 256];
         i = 1;
-        while (x[i]) {
-            h = T[h ^ x[i++]];
+        while (i < length) {
+            h = T[h ^ _lower(x[i++])];
         }
         retval = ((retval << 8) | h);
     }
     return retval;
 }
 
+joforth_word_key_t pearson_hash(const char* _x) {
+    return _pearson_hash(_x, strlen(_x));
+}
+
 // ================================================================
 
 static uint8_t* _alloc(joforth_t* joforth, size_t bytes) {
@@ -38,40 +144,149 @@ static uint8_t* _alloc(joforth_t* joforth, size_t bytes) {
     return joforth->_memory + mp;
 }
 
-#define JOFORTH_DICT_BUCKETS    257
-static _joforth_dict_entry_t* _add_entry(joforth_t* joforth, const char* word) {
-    joforth_word_key_t key = pearson_hash(word);
-    //TODO: check it's not already there
-    size_t index = key % JOFORTH_DICT_BUCKETS;
-    _joforth_dict_entry_t* i = joforth->_dict + index;
-    while (i->_next != 0) {
-        i = i->_next;
+#if defined(JOFORTH_THREADED_CODE)
+// the same, for threaded code which the engine reads in place; alignment is a power of 2
+static uint8_t* _alloc_aligned(joforth_t* joforth, size_t bytes, size_t alignment) {
+    joforth->_mp = (joforth->_mp + alignment - 1) & ~(alignment - 1);
+    return _alloc(joforth, bytes);
+}
+#endif
+
+// conversion between pointers into _memory and addresses, see joforth_word_address_t
+static _JO_ALWAYS_INLINE joforth_word_address_t _address_of(const joforth_t* joforth, const void* ptr) {
+    return (joforth_word_address_t)((const uint8_t*)ptr - joforth->_memory);
+}
+
+static _JO_ALWAYS_INLINE uint8_t* _ptr_at(const joforth_t* joforth, joforth_word_address_t address) {
+    return joforth->_memory + address;
+}
+
+static _JO_ALWAYS_INLINE _joforth_dict_entry_t* _entry_at(const joforth_t* joforth, joforth_word_address_t address) {
+    return (_joforth_dict_entry_t*)(joforth->_memory + address);
+}
+
+// 0 if address is 0, i.e. there is no string (the value stack is at address 0)
+static _JO_ALWAYS_INLINE const char* _string_at(const joforth_t* joforth, joforth_word_address_t address) {
+    return address ? (const char*)(joforth->_memory + address) : 0;
+}
+
+// =====================================================================================
+// the dictionary
+// 
+// a flat open addressing table with linear probing. Each slot holds the full hash key 
+// and the length of the name so that the name itself is only compared when those match.
+// The table is allocated using the VM allocator, not in _memory, so that it can grow.
+// =====================================================================================
+
+#define JOFORTH_DICT_INITIAL_SIZE   512
+
+static void _dict_grow(joforth_t* joforth, size_t size) {
+    assert((size & (size - 1)) == 0);
+    _joforth_dict_slot_t* dict = (_joforth_dict_slot_t*)joforth->_allocator._alloc(size * sizeof(_joforth_dict_slot_t));
+    memset(dict, 0, size * sizeof(_joforth_dict_slot_t));
+    // rehash everything we've got
+    for (size_t n = 0; n < joforth->_dict_size; ++n) {
+        const _joforth_dict_slot_t* slot = joforth->_dict + n;
+        if (slot->_length) {
+            size_t index = slot->_key & (size - 1);
+            while (dict[index]._length) {
+                index = (index + 1) & (size - 1);
+            }
+            dict[index] = *slot;
+        }
+    }
+    if (joforth->_dict) {
+        joforth->_allocator._free(joforth->_dict);
     }
+    joforth->_dict = dict;
+    joforth->_dict_size = size;
+}
 
-    i->_next = (_joforth_dict_entry_t*)_alloc(joforth, sizeof(_joforth_dict_entry_t));
-    memset(i->_next, 0, sizeof(_joforth_dict_entry_t));
-    i->_key = key;
-    const size_t len = strlen(word)+1;
-    char* word_copy = (char*)_alloc(joforth, len);
-    memcpy(word_copy, word, len);
-    i->_word = word_copy;
-    i->_doc = 0;
+// compares a stored (lower case) name with a word
+static bool _name_equals(const char* name, const char* word, size_t length) {
+    for (size_t n = 0; n < length; ++n) {
+        if ((unsigned char)name[n] != _lower((unsigned char)word[n])) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    return i;
+// the slot of word, or the free slot where it should go
+static _joforth_dict_slot_t* _dict_slot(const joforth_t* joforth, const char* word, size_t length, joforth_word_key_t key) {
+    const size_t mask = joforth->_dict_size - 1;
+    size_t index = key & mask;
+    _joforth_dict_slot_t* slot = joforth->_dict + index;
+    while (slot->_length) {
+        if (slot->_key == key && slot->_length == length && _name_equals(_string_at(joforth, _entry_at(joforth, slot->_entry)->_word), word, length)) {
+            break;
+        }
+        index = (index + 1) & mask;
+        slot = joforth->_dict + index;
+    }
+    return slot;
 }
 
-static _joforth_dict_entry_t* _find_word(joforth_t* joforth, joforth_word_key_t key) {
-    size_t index = key % JOFORTH_DICT_BUCKETS;
-    _joforth_dict_entry_t* i = joforth->_dict + index;
-    while (i != 0) {
-        if (i->_key == key) {
-            return i;
+// the entry of word in joforth or in the VMs it is an overlay of, which all share the same addresses
+static _joforth_dict_entry_t* _lookup(const joforth_t* joforth, const char* word, size_t length, joforth_word_key_t key) {
+    for (const joforth_t* layer = joforth; layer; layer = layer->_parent) {
+        const _joforth_dict_slot_t* slot = _dict_slot(layer, word, length, key);
+        if (slot->_length) {
+            return _entry_at(joforth, slot->_entry);
         }
-        i = i->_next;
     }
     return 0;
 }
 
+// adds a new entry for word, replacing any existing entry with the same name unless it's a keyword
+static _joforth_dict_entry_t* _add_entry(joforth_t* joforth, const char* word) {
+    const size_t len = strlen(word);
+    if (!len || len > JOFORTH_MAX_WORD_LENGTH) {
+        return 0;
+    }
+    // keep the load factor below 3/4
+    if (4 * (joforth->_dict_count + 1) > 3 * joforth->_dict_size) {
+        _dict_grow(joforth, 2 * joforth->_dict_size);
+    }
+
+    const joforth_word_key_t key = _pearson_hash(word, len);
+    const _joforth_dict_entry_t* existing = _lookup(joforth, word, len, key);
+    if (joforth->_frozen || (existing && existing->_type == kEntryType_Keyword)) {
+        // language keywords can't be redefined, and nothing can be added to a frozen VM
+        return 0;
+    }
+    _joforth_dict_slot_t* slot = _dict_slot(joforth, word, len, key);
+    if (!slot->_length) {
+        slot->_key = key;
+        slot->_length = (uint32_t)len;
+        ++joforth->_dict_count;
+    }
+
+    // anything compiled against the dictionary before this may be out of date now
+    ++joforth->_dict_generation;
+
+    _joforth_dict_entry_t* entry = (_joforth_dict_entry_t*)_alloc(joforth, sizeof(_joforth_dict_entry_t));
+    memset(entry, 0, sizeof(_joforth_dict_entry_t));
+    char* word_copy = (char*)_alloc(joforth, len + 1);
+    for (size_t n = 0; n < len; ++n) {
+        word_copy[n] = (char)_lower((unsigned char)word[n]);
+    }
+    word_copy[len] = 0;
+    entry->_word = _address_of(joforth, word_copy);
+    entry->_link = joforth->_latest;
+    joforth->_latest = _address_of(joforth, entry);
+    slot->_entry = joforth->_latest;
+
+    return entry;
+}
+
+static _joforth_dict_entry_t* _find_word(joforth_t* joforth, const char* word, size_t length) {
+    if (!length) {
+        return 0;
+    }
+    return _lookup(joforth, word, length, _pearson_hash(word, length));
+}
+
 // ============================================================================
 // native build in words
 
@@ -116,8 +331,13 @@ static void _mod(joforth_t* joforth) {
     joforth_push_value(joforth, val2 % val1);
 }
 
+static void _over(joforth_t* joforth) {
+    _JOFORTH_CHECK(joforth_stack_depth(joforth) >= 2);
+    joforth_push_value(joforth, joforth->_stack[joforth->_sp + 2]);
+}
+
 static void _swap(joforth_t* joforth) {
-    if (joforth->_sp < joforth->_stack_size - 1) {
+    if (joforth_stack_depth(joforth) >= 2) {
         joforth_value_t tos = joforth->_stack[joforth->_sp + 1];
         joforth_value_t nos = joforth->_stack[joforth->_sp + 2];
         joforth->_stack[joforth->_sp + 1] = nos;
@@ -129,7 +349,7 @@ static void _swap(joforth_t* joforth) {
 }
 
 static void _tuck(joforth_t* joforth) {
-    if (joforth->_sp < joforth->_stack_size - 2) {
+    if (joforth_stack_depth(joforth) >= 2) {
         joforth_value_t tos = joforth_pop_value(joforth);
         joforth_value_t nos = joforth_pop_value(joforth);
         joforth_push_value(joforth, tos);
@@ -146,7 +366,7 @@ static void _drop(joforth_t* joforth) {
 }
 
 static void _dot(joforth_t* joforth) {
-    printf("%lld", joforth_pop_value(joforth));
+    _print(joforth, "%lld", (long long)joforth_pop_value(joforth));
 }
 
 static void _bang(joforth_t* joforth) {
@@ -163,9 +383,45 @@ static void _at(joforth_t* joforth) {
     joforth_push_value(joforth, ptr[0]);
 }
 
+// built in words which the engine executes directly, without calling the handler
+static const struct {
+    const char*                 _id;
+    joforth_word_handler_t      _handler;
+    size_t                      _depth;
+    _joforth_ir_t               _ir;
+} _primitives[] = {
+    { ._id = "<", ._handler = _lt, ._depth = 2, ._ir = kIr_Lt },
+    { ._id = ">", ._handler = _gt, ._depth = 2, ._ir = kIr_Gt },
+    { ._id = "=", ._handler = _eq, ._depth = 2, ._ir = kIr_Eq },
+    { ._id = "dup", ._handler = _dup, ._depth = 1, ._ir = kIr_Dup },
+    { ._id = "*", ._handler = _mul, ._depth = 2, ._ir = kIr_Mul },
+    { ._id = "+", ._handler = _plus, ._depth = 2, ._ir = kIr_Plus },
+    { ._id = "-", ._handler = _minus, ._depth = 2, ._ir = kIr_Minus },
+    { ._id = "swap", ._handler = _swap, ._depth = 2, ._ir = kIr_Swap },
+    { ._id = "over", ._handler = _over, ._depth = 2, ._ir = kIr_Over },
+    { ._id = "tuck", ._handler = _tuck, ._depth = 2, ._ir = kIr_Tuck },
+    { ._id = "drop", ._handler = _drop, ._depth = 1, ._ir = kIr_Drop },
+    { ._id = "!", ._handler = _bang, ._depth = 2, ._ir = kIr_Bang },
+    { ._id = "@", ._handler = _at, ._depth = 1, ._ir = kIr_At },
+    { ._id = "mod", ._handler = _mod, ._depth = 2, ._ir = kIr_Mod },
+};
+#define JOFORTH_NUM_PRIMITIVES (sizeof(_primitives)/sizeof(_primitives[0]))
+
+static const char* _primitive_id(_joforth_ir_t ir) {
+    if (ir == kIr_SwapUnchecked || ir == kIr_TuckUnchecked) {
+        ir = ir == kIr_SwapUnchecked ? kIr_Swap : kIr_Tuck;
+    }
+    for (size_t n = 0; n < JOFORTH_NUM_PRIMITIVES; ++n) {
+        if (_primitives[n]._ir == ir) {
+            return _primitives[n]._id;
+        }
+    }
+    return 0;
+}
+
 // simply drop the entire stack
 static void _popa(joforth_t* joforth) {
-    joforth->_sp = joforth->_stack_size - 1;
+    joforth->_sp = _JOFORTH_STACK_SIZE(joforth) - 1;
 }
 
 static void _dec(joforth_t* joforth) {
@@ -178,7 +434,7 @@ static void _hex(joforth_t* joforth) {
 
 static void _create(joforth_t* joforth) {
     // the stack MUST contain the address of the name of a new word we'll create
-    char* ptr = (char*)joforth_pop_value(joforth);
+    const char* ptr = (const char*)_ptr_at(joforth, (joforth_word_address_t)joforth_pop_value(joforth));
     // here goes nothing...
     _joforth_dict_entry_t* entry = _add_entry(joforth, ptr);
     if (entry) {
@@ -217,146 +473,225 @@ static void _allot(joforth_t* joforth) {
 
 static void _see(joforth_t* joforth) {
     // the stack MUST contain the address of a word name
-    const char* id = (const char*)joforth_pop_value(joforth);
-    joforth_word_key_t key = pearson_hash(id);
-    _joforth_dict_entry_t* entry = _find_word(joforth, key);
+    const char* id = (const char*)_ptr_at(joforth, (joforth_word_address_t)joforth_pop_value(joforth));
+    _joforth_dict_entry_t* entry = _find_word(joforth, id, strlen(id));
     if (entry) {        
         switch (entry->_type)
         {
         case kEntryType_Native:
         case kEntryType_Prefix:
-            printf(" %s", entry->_word);            
+            _print(joforth, " %s", _string_at(joforth, entry->_word));            
             break;
         case kEntryType_Value:
-            printf(" value %lld", entry->_rep._value);
+            _print(joforth, " value %lld", (long long)entry->_rep._value);
             break;
         case kEntryType_Word:
         {
-            uint8_t* ir = entry->_rep._ir;
+            uint8_t* ir = _ptr_at(joforth, entry->_rep._ir);
             while (*ir != kIr_Null) {
-                switch (*ir++) {
-                case kIr_Begin:
-                    printf(" begin");
-                    break;
-                case kIr_Do:
-                    printf(" do");
-                    break;
+                const _joforth_ir_t op = (_joforth_ir_t)*ir++;
+                switch (op) {
                 case kIr_Dot:
                 case kIr_DotDot:
-                    printf(" .");
-                    break;
-                case kIr_Else:
-                    printf(" else");
+                    _print(joforth, " .");
                     break;
                 case kIr_DefineWord:
-                    printf(": %s", entry->_word);
+                    _print(joforth, ": %s", _string_at(joforth, entry->_word));
                     if(entry->_doc) {
-                        printf(" (%s)", entry->_doc);
+                        _print(joforth, " (%s)", _string_at(joforth, entry->_doc));
                     }
-                    ir += sizeof(void*);
                     break;
                 case kIr_EndDefineWord:
-                    printf(" ;");
-                    break;
-                case kIr_Endif:
-                    printf(" endif");
+                    _print(joforth, " ;");
                     break;
                 case kIr_False:
-                    printf(" false");
-                    break;
-                case kIr_If:
-                    printf(" if");
+                    _print(joforth, " false");
                     break;
                 case kIr_IfZeroOperator:
-                    printf(" ?");
+                    _print(joforth, " ?");
                     break;
                 case kIr_Invert:
-                    printf(" invert");
+                    _print(joforth, " invert");
                     break;
+                case kIr_Branch:
+                case kIr_BranchIfZero:
                 case kIr_Loop:
-                    printf(" loop");
-                    break;
+                {
+                    _joforth_ir_offset_t offset;
+                    _ir_consume_offset(ir, &offset);
+                    _print(joforth, " %s(%+d)", op == kIr_Branch ? "branch" : (op == kIr_Loop ? "loop" : "0branch"), offset);
+                }
+                break;
                 case kIr_Native:
+                case kIr_NativeUnary:
+                case kIr_NativeBinary:
+                case kIr_NativeArray:
+                case kIr_WordPtr:
+                case kIr_TailCall:
                 {
-                    _joforth_dict_entry_t* dict_entry = ((_joforth_dict_entry_t**)ir)[0];
-                    ir += sizeof(void*);
-                    printf(" %s", dict_entry->_word);                    
+                    _joforth_ir_address_t address;
+                    _ir_consume_address(ir, &address);
+                    _print(joforth, " %s", _string_at(joforth, _entry_at(joforth, address)->_word));
                 }
                 break;
                 case kIr_Recurse:
-                    printf(" recurse");
+                    _print(joforth, " recurse");
                     break;
-                case kIr_Repeat:
-                    printf(" repeat");
+                case kIr_Yield:
+                    _print(joforth, " yield");
                     break;
                 case kIr_True:
-                    printf(" true");
-                    break;
-                case kIr_Until:
-                    printf(" until");
-                    break;
-                case kIr_While:
-                    printf(" while");
+                    _print(joforth, " true");
                     break;
                 case kIr_Value:
+                case kIr_Value8:
+                case kIr_Value32:
+                    _print(joforth, " %lld", (long long)_ir_operand(op, ir));
+                    break;
+                case kIr_AddImm:
+                case kIr_LtImm:
+                case kIr_GtImm:
+                case kIr_EqImm:
                 {
-                    joforth_value_t value = *((joforth_value_t*)ir);
-                    ir += sizeof(joforth_value_t);
-                    printf(" %lld", value);
+                    // superinstructions with an immediate operand
+                    joforth_value_t value = _ir_operand(op, ir);
+                    _print(joforth, " %lld%s", (long long)value, op == kIr_AddImm ? "+" : (op == kIr_LtImm ? "<" : (op == kIr_GtImm ? ">" : "=")));
                 }
                 break;
-                case kIr_ValuePtr:
-                case kIr_WordPtr:
-                    ir += sizeof(void*);
+                case kIr_ZeroEq:
+                    _print(joforth, " 0=");
+                    break;
+                case kIr_DupMul:
+                    _print(joforth, " dup*");
                     break;
-                default:;
+                case kIr_Nip:
+                    _print(joforth, " nip");
+                    break;
+                case kIr_OverPlus:
+                    _print(joforth, " over+");
+                    break;
+                default:
+                {
+                    const char* id = _primitive_id(op);
+                    if (id) {
+                        _print(joforth, " %s", id);
+                    }
                 }
+                break;
+                }
+                ir += _ir_operand_size(op);
             }
         }
         break;
         default:;
         }
-        printf("\n: %s, takes %zu parameters\n", entry->_word, entry->_depth);
+        _print(joforth, "\n: %s, takes %u parameters\n", _string_at(joforth, entry->_word), entry->_depth);
     }
     else {
-        printf("\"%s\" is not in the dictionary\n", id);
+        _print(joforth, "\"%s\" is not in the dictionary\n", id);
     }
 }
 
 static void _cr(joforth_t* joforth) {
-    (void)joforth;
-    printf("\n");
+    _print(joforth, "\n");
 }
 
-// ================================================================
+// the other built in native words, and the prefix words
+typedef struct _joforth_builtin {
+    const char*                 _id;
+    joforth_word_handler_t      _handler;
+    size_t                      _depth;
+    // number of values left in place of the _depth arguments, -1 if it depends on the stack
+    int                         _results;
+} _joforth_builtin_t;
 
+static const _joforth_builtin_t _natives[] = {
+    { ._id = ".", ._handler = _dot, ._depth = 1, ._results = 0 },
+    { ._id = "dec", ._handler = _dec, ._depth = 0, ._results = 0 },
+    { ._id = "hex", ._handler = _hex, ._depth = 0, ._results = 0 },
+    { ._id = "popa", ._handler = _popa, ._depth = 0, ._results = -1 },
+    { ._id = "here", ._handler = _here, ._depth = 0, ._results = 1 },
+    { ._id = "allot", ._handler = _allot, ._depth = 1, ._results = 0 },
+    { ._id = "cells", ._handler = _cells, ._depth = 1, ._results = 1 },
+    { ._id = "cr", ._handler = _cr, ._depth = 0, ._results = 0 },
+};
+#define JOFORTH_NUM_NATIVES (sizeof(_natives)/sizeof(_natives[0]))
 
-void    joforth_initialise(joforth_t* joforth) {
+static const _joforth_builtin_t _prefixes[] = {
+    { ._id = "create", ._handler = _create, ._depth = 1 },
+    { ._id = "see", ._handler = _see, ._depth = 1 },
+};
+#define JOFORTH_NUM_PREFIXES (sizeof(_prefixes)/sizeof(_prefixes[0]))
 
-    static bool _t_initialised = false;
-    if (!_t_initialised) {
-        unsigned char source[256];
-        for (size_t i = 0; i < 256; ++i) {
-            source[i] = i;
+// the handler of a built in word, 0 if it isn't one
+static joforth_word_handler_t _builtin_handler(const char* id) {
+    for (size_t n = 0; n < JOFORTH_NUM_PRIMITIVES; ++n) {
+        if (strcmp(_primitives[n]._id, id) == 0) {
+            return _primitives[n]._handler;
         }
-        // fill T with a random permutation of 0..255
-        for (size_t i = 0; i < 256; ++i) {
-            size_t index = rand() % (256 - i);
-            T[i] = source[index];
-            source[index] = source[255 - i];
+    }
+    for (size_t n = 0; n < JOFORTH_NUM_NATIVES; ++n) {
+        if (strcmp(_natives[n]._id, id) == 0) {
+            return _natives[n]._handler;
+        }
+    }
+    for (size_t n = 0; n < JOFORTH_NUM_PREFIXES; ++n) {
+        if (strcmp(_prefixes[n]._id, id) == 0) {
+            return _prefixes[n]._handler;
         }
+    }
+    return 0;
+}
+
+// ================================================================
 
-        _t_initialised = true;
+static void _initialise_statement_cache(joforth_t* joforth) {
+    // joforth_eval statement cache, if enabled
+    joforth->_statement_cache = 0;
+    joforth->_statement_cache_time = 0;
+    if (joforth->_statement_cache_size) {
+        const size_t cache_bytes = joforth->_statement_cache_size * sizeof(_joforth_cached_statement_t);
+        joforth->_statement_cache = (_joforth_cached_statement_t*)joforth->_allocator._alloc(cache_bytes);
+        memset(joforth->_statement_cache, 0, cache_bytes);
     }
+}
+
+static void _free_memory(joforth_t* joforth) {
+#if defined(JOFORTH_IMAGE_MMAP)
+    if (joforth->_memory_mapped) {
+        munmap(joforth->_memory, joforth->_memory_mapped);
+        return;
+    }
+#endif
+    joforth->_allocator._free(joforth->_memory);
+}
+
+// false if the VM can't run anything; if it has failed, if there are natives which 
+// haven't been bound since it was loaded (see joforth_load_image), if it's frozen, or suspended
+static bool _is_runnable(const joforth_t* joforth) {
+    return _JO_SUCCEEDED(joforth->_status) && !joforth->_unbound_natives && !joforth->_frozen && !joforth->_suspended;
+}
+
+void    joforth_initialise(joforth_t* joforth) {
+
 
     // we allocate one block of memory which is used to carve out all subsequent allocations
     joforth->_memory_size = joforth->_memory_size > JOFORTH_DEFAULT_MEMORY_SIZE ? joforth->_memory_size : JOFORTH_DEFAULT_MEMORY_SIZE;
+    // everything in it must be addressable with a joforth_word_address_t
+    assert(joforth->_memory_size <= (size_t)(joforth_word_address_t)~0u);
     joforth->_memory = (uint8_t*)joforth->_allocator._alloc(joforth->_memory_size);
+    joforth->_memory_mapped = 0;
     joforth->_mp = 0;
 
     // value stack
+#if defined(JOFORTH_STACK_SIZE)
+    joforth->_stack_size = JOFORTH_STACK_SIZE;
+#else
     joforth->_stack_size = joforth->_stack_size > JOFORTH_DEFAULT_STACK_SIZE ? joforth->_stack_size : JOFORTH_DEFAULT_STACK_SIZE;
-    joforth->_stack = (joforth_value_t*)_alloc(joforth, joforth->_stack_size * sizeof(joforth_value_t));
+#endif
+    //NOTE: one extra guard slot below the bottom of the stack, so that the engine can always cache the top value
+    joforth->_stack = (joforth_value_t*)_alloc(joforth, (joforth->_stack_size + 1) * sizeof(joforth_value_t));
+    joforth->_stack[joforth->_stack_size] = 0;
     joforth->_sp = joforth->_stack_size - 1;
 
     // IR buffer    
@@ -364,16 +699,42 @@ void    joforth_initialise(joforth_t* joforth) {
     joforth->_ir_buffer = (uint8_t*)_alloc(joforth, JOFORTH_DEFAULT_IRBUFFER_SIZE);
     joforth->_ir_buffer_size = JOFORTH_DEFAULT_IRBUFFER_SIZE;
     joforth->_irw = 0;
+#if defined(JOFORTH_THREADED_CODE)
+    // translated IR buffer, the threaded code never uses more cells than the IR uses bytes
+    joforth->_code_buffer = (_joforth_cell_t*)_alloc(joforth, JOFORTH_DEFAULT_IRBUFFER_SIZE * sizeof(_joforth_cell_t));
+#endif
 
     // ir return stack
     //NOTE: this determines the nesting level
-#define JOFORTH_DEFAULT_IRSTACK_SIZE    256
-    joforth->_irstack = (uint8_t**)_alloc(joforth, JOFORTH_DEFAULT_IRSTACK_SIZE * sizeof(void*));
-    joforth->_irstack_size = JOFORTH_DEFAULT_IRSTACK_SIZE;
+    joforth->_irstack = (uint8_t**)_alloc(joforth, JOFORTH_IRSTACK_SIZE * sizeof(void*));
+    joforth->_irstack_size = JOFORTH_IRSTACK_SIZE;
     joforth->_irp = joforth->_irstack_size - 1;
 
-    joforth->_dict = (_joforth_dict_entry_t*)_alloc(joforth, JOFORTH_DICT_BUCKETS * sizeof(_joforth_dict_entry_t));
-    memset(joforth->_dict, 0, JOFORTH_DICT_BUCKETS * sizeof(_joforth_dict_entry_t));
+    joforth->_dict = 0;
+    joforth->_dict_size = 0;
+    joforth->_dict_count = 0;
+    _dict_grow(joforth, JOFORTH_DICT_INITIAL_SIZE);
+    joforth->_dict_generation = 0;
+
+    joforth->_latest = 0;
+    joforth->_unbound_natives = 0;
+    joforth->_parent = 0;
+    joforth->_frozen = 0;
+    joforth->_frozen_file = 0;
+
+    joforth->_fuel_left = 0;
+    joforth->_running = 0;
+    joforth->_suspended = false;
+    joforth->_resume_ip = 0;
+    joforth->_resume_irp = 0;
+    joforth->_jit = 0;
+    joforth->_jit_used = 0;
+    joforth->_jit_depth = 0;
+    joforth->_jit_words = 0;
+    joforth->_jit_words_size = 0;
+    joforth->_jit_words_count = 0;
+
+    _initialise_statement_cache(joforth);
 
     // start with decimal
     joforth->_base = 10;
@@ -382,153 +743,321 @@ void    joforth_initialise(joforth_t* joforth) {
     joforth->_status = _JO_STATUS_SUCCESS;
 
     // add built-in handlers
-    joforth_add_word(joforth, "<", _lt, 2);
-    joforth_add_word(joforth, ">", _gt, 2);
-    joforth_add_word(joforth, "=", _eq, 2);
-    joforth_add_word(joforth, "dup", _dup, 1);
-    joforth_add_word(joforth, "*", _mul, 2);
-    joforth_add_word(joforth, "+", _plus, 2);
-    joforth_add_word(joforth, "-", _minus, 2);
-    joforth_add_word(joforth, ".", _dot, 1);
-    joforth_add_word(joforth, "swap", _swap, 2);
-    joforth_add_word(joforth, "tuck", _tuck, 2);
-    joforth_add_word(joforth, "drop", _drop, 1);
-    joforth_add_word(joforth, "!", _bang, 2);
-    joforth_add_word(joforth, "@", _at, 1);
-    joforth_add_word(joforth, "dec", _dec, 0);
-    joforth_add_word(joforth, "hex", _hex, 0);
-    joforth_add_word(joforth, "popa", _popa, 0);
-    joforth_add_word(joforth, "here", _here, 0);
-    joforth_add_word(joforth, "allot", _allot, 1);
-    joforth_add_word(joforth, "cells", _cells, 1);
-    joforth_add_word(joforth, "cr", _cr, 0);
-    joforth_add_word(joforth, "mod", _mod, 2);
+    for (size_t n = 0; n < JOFORTH_NUM_PRIMITIVES; ++n) {
+        joforth_add_word(joforth, _primitives[n]._id, _primitives[n]._handler, _primitives[n]._depth);
+        _joforth_dict_entry_t* entry = _entry_at(joforth, joforth->_latest);
+        entry->_primitive = (uint8_t)_primitives[n]._ir;
+        entry->_flags = kEntryFlag_Builtin;
+    }
+    for (size_t n = 0; n < JOFORTH_NUM_NATIVES; ++n) {
+        joforth_add_word(joforth, _natives[n]._id, _natives[n]._handler, _natives[n]._depth);
+        _joforth_dict_entry_t* entry = _entry_at(joforth, joforth->_latest);
+        entry->_flags = kEntryFlag_Builtin;
+        if (_natives[n]._results >= 0) {
+            // so that words which use it can be verified
+            entry->_flags |= kEntryFlag_Verified;
+            entry->_results = (uint32_t)_natives[n]._results;
+        }
+    }
 
-    // add special words
-    _joforth_dict_entry_t* entry = _add_entry(joforth, "create");
-    entry->_type = kEntryType_Prefix;
-    entry->_rep._handler = _create;
-    entry->_depth = 1;
+    // language keywords, see joforth_eval
+    for (size_t n = 0; n < _joforth_keyword_lut_size; ++n) {
+        _joforth_dict_entry_t* keyword = _add_entry(joforth, _joforth_keyword_lut[n]._id);
+        keyword->_type = kEntryType_Keyword;
+        keyword->_rep._value = _joforth_keyword_lut[n]._ir;
+    }
 
-    entry = _add_entry(joforth, "see");
-    entry->_type = kEntryType_Prefix;
-    entry->_rep._handler = _see;
-    entry->_depth = 1;
+    // add special words
+    for (size_t n = 0; n < JOFORTH_NUM_PREFIXES; ++n) {
+        _joforth_dict_entry_t* entry = _add_entry(joforth, _prefixes[n]._id);
+        entry->_type = kEntryType_Prefix;
+        entry->_flags = kEntryFlag_Builtin;
+        entry->_rep._handler = _prefixes[n]._handler;
+        entry->_depth = (uint32_t)_prefixes[n]._depth;
+    }
 }
 
 void    joforth_destroy(joforth_t* joforth) {
     
-    joforth->_allocator._free(joforth->_memory);
+    if (joforth->_statement_cache) {
+        for (size_t n = 0; n < joforth->_statement_cache_size; ++n) {
+            if (joforth->_statement_cache[n]._used) {
+                joforth->_allocator._free(joforth->_statement_cache[n]._source);
+                joforth->_allocator._free(joforth->_statement_cache[n]._statement);
+            }
+        }
+        joforth->_allocator._free(joforth->_statement_cache);
+    }
+    joforth->_allocator._free(joforth->_dict);
+    _free_memory(joforth);
+#if defined(JOFORTH_JIT)
+    if (joforth->_jit) {
+        munmap(joforth->_jit, JOFORTH_JIT_SIZE);
+    }
+    if (joforth->_jit_words) {
+        joforth->_allocator._free(joforth->_jit_words);
+    }
+#endif
+    if (joforth->_frozen_file) {
+        fclose((FILE*)joforth->_frozen_file);
+    }
     memset(joforth, 0, sizeof(joforth_t));
 }
 
-void    joforth_add_word(joforth_t* joforth, const char* word, joforth_word_handler_t handler, size_t depth) {
+// binds every unbound native called word, returns false if there are none. 
+// natives are bound in place so that compiled words which refer to them are bound as well
+static bool _bind_native(joforth_t* joforth, const char* word, const _joforth_dict_entry_t* native) {
+    const size_t length = strlen(word);
+    bool bound = false;
+    for (joforth_word_address_t address = joforth->_latest; address; address = _entry_at(joforth, address)->_link) {
+        _joforth_dict_entry_t* entry = _entry_at(joforth, address);
+        const char* name = _string_at(joforth, entry->_word);
+        if (!(entry->_flags & kEntryFlag_Unbound) || name[length] || !_name_equals(name, word, length)) {
+            continue;
+        }
+        if (entry->_signature != native->_signature || entry->_depth != native->_depth) {
+            // the compiled code depends on both
+            joforth->_status = _JO_STATUS_INVALID_INPUT;
+            return true;
+        }
+        entry->_rep = native->_rep;
+        entry->_flags &= ~kEntryFlag_Unbound;
+        --joforth->_unbound_natives;
+        bound = true;
+    }
+    return bound;
+}
 
+// adds, or binds, a native word with the signature, depth and function of native
+static void _add_native(joforth_t* joforth, const char* word, const _joforth_dict_entry_t* native) {
+    if (joforth->_unbound_natives && _bind_native(joforth, word, native)) {
+        return;
+    }
     _joforth_dict_entry_t* i = _add_entry(joforth, word);
-    i->_depth = depth;
+    if (!i) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return;
+    }
+    i->_depth = native->_depth;
+    i->_results = native->_results;
     i->_type = kEntryType_Native;
-    i->_rep._handler = handler;
+    i->_signature = native->_signature;
+    i->_rep = native->_rep;
+}
+
+void    joforth_add_word(joforth_t* joforth, const char* word, joforth_word_handler_t handler, size_t depth) {
+    const _joforth_dict_entry_t native = { ._signature = kNativeSignature_Handler, ._depth = (uint32_t)depth, ._rep._handler = handler };
+    _add_native(joforth, word, &native);
+}
+
+// the arity of typed natives is checked once, here, rather than every time the word is called
+static bool _is_valid_typed_native(joforth_t* joforth, size_t depth) {
+    if (!depth || depth > _JOFORTH_STACK_SIZE(joforth)) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+    return true;
+}
+
+void    joforth_add_unary(joforth_t* joforth, const char* word, joforth_unary_fn_t fn) {
+    const _joforth_dict_entry_t native = { ._signature = kNativeSignature_Unary, ._depth = 1, ._results = 1, ._rep._unary = fn };
+    _add_native(joforth, word, &native);
+}
 
-    //printf("\nadded word \"%s\", key = 0x%x\n", i->_word, i->_key);
+void    joforth_add_binary(joforth_t* joforth, const char* word, joforth_binary_fn_t fn) {
+    const _joforth_dict_entry_t native = { ._signature = kNativeSignature_Binary, ._depth = 2, ._results = 1, ._rep._binary = fn };
+    _add_native(joforth, word, &native);
+}
+
+void    joforth_add_array(joforth_t* joforth, const char* word, joforth_array_fn_t fn, size_t count) {
+    if (_is_valid_typed_native(joforth, count)) {
+        const _joforth_dict_entry_t native = { ._signature = kNativeSignature_Array, ._depth = (uint32_t)count, ._results = (uint32_t)count, ._rep._array = fn };
+        _add_native(joforth, word, &native);
+    }
 }
 
 static _JO_ALWAYS_INLINE void _push_irstack(joforth_t* joforth, uint8_t* loc) {
-    assert(joforth->_irp);
+    _JOFORTH_CHECK(joforth->_irp);
     joforth->_irstack[joforth->_irp--] = loc;
 }
 
 static _JO_ALWAYS_INLINE uint8_t* _pop_irstack(joforth_t* joforth) {
-    assert(joforth->_irp < joforth->_irstack_size - 1);
+    _JOFORTH_CHECK(joforth->_irp < JOFORTH_IRSTACK_SIZE - 1);
     return joforth->_irstack[++joforth->_irp];
 }
 
 static _JO_ALWAYS_INLINE bool _irstack_is_empty(joforth_t* joforth) {
-    return joforth->_irp == joforth->_irstack_size - 1;
+    return joforth->_irp == JOFORTH_IRSTACK_SIZE - 1;
 }
 
-static joforth_value_t  _str_to_value(joforth_t* joforth, const char* str) {
-    joforth_value_t value = (joforth_value_t)strtoll(str, 0, joforth->_base);
-    if (errno) {
+// parses a number in the current base, or with an explicit 0x or $ (hex) or % (binary) prefix, 
+// after an optional sign. Sets _JO_STATUS_INVALID_INPUT if the token isn't a number or if it 
+// doesn't fit in a value. Hex and binary numbers can use all the bits of a value, i.e. 0xffffffffffffffff is -1 with 64 bit cells
+static joforth_value_t  _str_to_value(joforth_t* joforth, const char* token, size_t length) {
+    const char* str = token;
+    const char* end = token + length;
+
+    bool negative = false;
+    if (str < end && (*str == '-' || *str == '+')) {
+        negative = *str++ == '-';
+    }
+    unsigned base = (unsigned)joforth->_base;
+    if (end - str > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        str += 2;
+    }
+    else if (end - str > 1 && (str[0] == '$' || str[0] == '%')) {
+        base = str[0] == '$' ? 16 : 2;
+        ++str;
+    }
+    if (str == end) {
         joforth->_status = _JO_STATUS_INVALID_INPUT;
         return 0;
     }
-    if (!value) {
-        // is it 0, or is it wrong...?
-        // skip sign first
-
-        if (*str == '-' || *str == '+')
-            ++str;
 
-        switch (joforth->_base) {
-        case 10:
-        {
-            while (*str && *str >= '0' && *str <= '9') ++str;
-            if (*str && *str != ' ') {
-                // some non-decimal character found
-                joforth->_status = _JO_STATUS_INVALID_INPUT;
-                return 0;
-            }
-            // otherwise it's a valid 0
-            joforth->_status = _JO_STATUS_SUCCESS;
+    const joforth_uvalue_t limit = JOFORTH_UVALUE_MAX / base;
+    joforth_uvalue_t value = 0;
+    while (str < end) {
+        const unsigned char c = (unsigned char)*str++;
+        unsigned digit = base;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
         }
-        break;
-        case 16:
-        {
-            if (strlen(str) > 2 && str[1] == 'x')
-                str += 2;
-
-            while (*str && *str >= '0' && *str <= '9' && *str >= 'a' && *str <= 'f') ++str;
-            if (*str && *str != ' ') {
-                // some non-hex character found
-                joforth->_status = _JO_STATUS_INVALID_INPUT;
-                return 0;
-            }
-            // otherwise it's a valid 0
-            joforth->_status = _JO_STATUS_SUCCESS;
+        else if (_lower(c) >= 'a' && _lower(c) <= 'z') {
+            digit = _lower(c) - 'a' + 10u;
         }
-        break;
-        default: {
+        if (digit >= base || value > limit || value * base > JOFORTH_UVALUE_MAX - digit) {
+            // not a digit in this base, or overflow
             joforth->_status = _JO_STATUS_INVALID_INPUT;
+            return 0;
         }
+        value = value * base + digit;
+    }
+
+    if (base == 10) {
+        // decimal numbers must be in range of the signed value type
+        if (value > (negative ? (joforth_uvalue_t)JOFORTH_VALUE_MAX + 1 : (joforth_uvalue_t)JOFORTH_VALUE_MAX)) {
+            joforth->_status = _JO_STATUS_INVALID_INPUT;
+            return 0;
         }
     }
-    return value;
+    return (joforth_value_t)(negative ? 0 - value : value);
 }
 
-static size_t _count_words(const char* word) {
-    size_t words = 0;
-    do {
-        while (word[0] && word[0] == ' ') ++word;
-        if (word[0] && word[0] != ';') {
-
-            if (word[0] == '(') {
-                while (word[0] && word[0] != ')') ++word;
-                if (!word[0]) {
-                    return 0;
-                }                
-                ++word;
-                continue;
-            }
+// =====================================================================================
+// the tokenizer
+// 
+// tokens are returned as (pointer, length) views into the source. Token boundaries
+// are found 16 (SSE2) or 32 (AVX2) bytes at a time where available. The vector loads 
+// are aligned so they never cross into another page, which makes it safe to read past
+// the terminating 0 of the source.
+// =====================================================================================
 
-            while (word[0] && word[0] != ' ' && word[0] != ';') ++word;
-            if (word[0] == ' ')
-                ++words;
-        }
-    } while (word[0] && word[0] != ';');
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define _JO_SIMD_WIDTH      32
+#define _JO_SIMD_ALL        0xffffffffu
+// bit n set if block[n] is whitespace
+static _JO_ALWAYS_INLINE uint32_t _simd_whitespace(const char* block) {
+    const __m256i v = _mm256_load_si256((const __m256i*)block);
+    const __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    // \t, \n, \v, \f and \r are 9 to 13
+    const __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+    const __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(space, ctrl));
+}
+// bit n set if block[n] is whitespace, a quote or the terminator
+static _JO_ALWAYS_INLINE uint32_t _simd_delimiters(const char* block) {
+    const __m256i v = _mm256_load_si256((const __m256i*)block);
+    const __m256i other = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"')));
+    return _simd_whitespace(block) | (uint32_t)_mm256_movemask_epi8(other);
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define _JO_SIMD_WIDTH      16
+#define _JO_SIMD_ALL        0xffffu
+static _JO_ALWAYS_INLINE uint32_t _simd_whitespace(const char* block) {
+    const __m128i v = _mm_load_si128((const __m128i*)block);
+    const __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    // \t, \n, \v, \f and \r are 9 to 13
+    const __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(9));
+    const __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(space, ctrl));
+}
+static _JO_ALWAYS_INLINE uint32_t _simd_delimiters(const char* block) {
+    const __m128i v = _mm_load_si128((const __m128i*)block);
+    const __m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()), _mm_cmpeq_epi8(v, _mm_set1_epi8('\"')));
+    return _simd_whitespace(block) | (uint32_t)_mm_movemask_epi8(other);
+}
+#endif
+
+#if defined(_JO_SIMD_WIDTH)
+#if defined(_MSC_VER)
+#include <intrin.h>
+static _JO_ALWAYS_INLINE unsigned _first_bit(uint32_t mask) {
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+}
+#else
+#define _first_bit(mask)    ((unsigned)__builtin_ctz(mask))
+#endif
 
-    return words;
+// the vector loads deliberately read the whole aligned block around the source
+#if defined(__clang__) || defined(__GNUC__)
+#define _JO_NO_SANITIZE     __attribute__((no_sanitize_address))
+#else
+#define _JO_NO_SANITIZE
+#endif
+
+_JO_NO_SANITIZE static const char* _skip_whitespace(const char* p) {
+    const size_t misalignment = (uintptr_t)p & (_JO_SIMD_WIDTH - 1);
+    const char* block = p - misalignment;
+    // ignore anything before p
+    uint32_t mask = ~_simd_whitespace(block) & (_JO_SIMD_ALL << misalignment) & _JO_SIMD_ALL;
+    while (!mask) {
+        block += _JO_SIMD_WIDTH;
+        mask = ~_simd_whitespace(block) & _JO_SIMD_ALL;
+    }
+    return block + _first_bit(mask);
+}
+
+_JO_NO_SANITIZE static const char* _find_delimiter(const char* p) {
+    const size_t misalignment = (uintptr_t)p & (_JO_SIMD_WIDTH - 1);
+    const char* block = p - misalignment;
+    uint32_t mask = _simd_delimiters(block) & (_JO_SIMD_ALL << misalignment) & _JO_SIMD_ALL;
+    while (!mask) {
+        block += _JO_SIMD_WIDTH;
+        mask = _simd_delimiters(block);
+    }
+    return block + _first_bit(mask);
+}
+#else
+static _JO_ALWAYS_INLINE bool _is_whitespace(char c) {
+    return c == ' ' || (unsigned char)(c - 9) < 5;
+}
+
+static const char* _skip_whitespace(const char* p) {
+    while (_is_whitespace(*p)) ++p;
+    return p;
 }
 
+static const char* _find_delimiter(const char* p) {
+    while (*p && *p != '\"' && !_is_whitespace(*p)) ++p;
+    return p;
+}
+#endif
+
+// find the next token in word and return the position following it, or 0 if there are no more tokens
 static const char* _next_word(joforth_t* joforth, 
-        char* buffer, size_t buffer_size, 
-        const char* word, size_t* wp_,
+        const char* word, const char** token, size_t* length,
         const char** comment) {
 
     if ( comment) {
         *comment = 0;
     }
-    *wp_ = 0;
-    while (word[0] && word[0] == ' ') ++word;
+    *length = 0;
+    word = _skip_whitespace(word);
     if (!word[0]) {
         return 0;
     }
@@ -537,622 +1066,3851 @@ static const char* _next_word(joforth_t* joforth,
         if(comment) {
             *comment = word+1;
         }
-        while (word[0] && word[0] != ')') ++word;        
-        if (!word[0]) {
+        word = strchr(word, ')');
+        if (!word) {
             joforth->_status = _JO_STATUS_INVALID_INPUT;
             return 0;
         }        
-        ++word;
-        while (word[0] && word[0] == ' ') ++word;
+        word = _skip_whitespace(word + 1);
         if (!word[0]) {
             joforth->_status = _JO_STATUS_INVALID_INPUT;
             return 0;
         }
     }
-    size_t wp = 0;
+    // whitespace inside quotes is part of the token
+    const char* start = word;
     bool scan_string = false;
-    while (word[0]) {
+    for (;;) {
+        word = _find_delimiter(word);
         if (*word == '\"') {
             scan_string = !scan_string;
         }
-        if (!scan_string && *word == ' ') {
+        else if (!*word || !scan_string) {
             break;
         }
-        buffer[wp++] = (char)tolower(*word++);
-        if (wp == buffer_size) {
-            joforth->_status = _JO_STATUS_RESOURCE_EXHAUSTED;
-            return 0;
-        }
+        ++word;
     }
-    buffer[wp] = 0;
-    *wp_ = wp;
+    *token = start;
+    *length = (size_t)(word - start);
     return word;
 }
 
+// copies a token into the arena as a 0 terminated lower case name, returns its address
+static joforth_word_address_t _copy_name(joforth_t* joforth, const char* token, size_t length) {
+    char* name = (char*)_alloc(joforth, length + 1);
+    for (size_t n = 0; n < length; ++n) {
+        name[n] = (char)_lower((unsigned char)token[n]);
+    }
+    name[length] = 0;
+    return _address_of(joforth, name);
+}
+
 // evaluator mode
 typedef enum _joforth_eval_mode {
 
     kEvalMode_Compiling,
     kEvalMode_Interpreting,
-    kEvalMode_Skipping,
 
 } _joforth_eval_mode_t;
 
-bool    joforth_eval(joforth_t* joforth, const char* word) {
+#if defined(JOFORTH_JIT)
+static uint32_t _jit_compile(joforth_t* joforth, const _joforth_dict_entry_t* entry);
+static bool _jit_run(joforth_t* joforth, uint32_t code);
 
-    if (_JO_FAILED(joforth->_status))
-        return false;
+// the calls to each word are counted in a table of the VM's own, like the dictionary table. The entries 
+// themselves are never written to, they may be in a frozen parent or an image shared copy-on-write
+static void _jit_words_grow(joforth_t* joforth, size_t size) {
+    assert((size & (size - 1)) == 0);
+    _joforth_jit_word_t* words = (_joforth_jit_word_t*)joforth->_allocator._alloc(size * sizeof(_joforth_jit_word_t));
+    memset(words, 0, size * sizeof(_joforth_jit_word_t));
+    for (size_t n = 0; n < joforth->_jit_words_size; ++n) {
+        const _joforth_jit_word_t* word = joforth->_jit_words + n;
+        if (word->_entry) {
+            size_t index = (word->_entry >> 3) & (size - 1);
+            while (words[index]._entry) {
+                index = (index + 1) & (size - 1);
+            }
+            words[index] = *word;
+        }
+    }
+    if (joforth->_jit_words) {
+        joforth->_allocator._free(joforth->_jit_words);
+    }
+    joforth->_jit_words = words;
+    joforth->_jit_words_size = size;
+}
 
-    while (word[0] && word[0] == ' ') ++word;
-    if (word[0] == 0) {
-        joforth->_status = _JO_STATUS_INVALID_INPUT;
-        return false;
+// the slot of the word at address, or the free slot where it should go
+static _JO_ALWAYS_INLINE _joforth_jit_word_t* _jit_word_slot(const joforth_t* joforth, joforth_word_address_t address) {
+    const size_t mask = joforth->_jit_words_size - 1;
+    size_t index = (address >> 3) & mask;
+    while (joforth->_jit_words[index]._entry && joforth->_jit_words[index]._entry != address) {
+        index = (index + 1) & mask;
     }
+    return joforth->_jit_words + index;
+}
 
-    _joforth_eval_mode_t mode = (word[0] == ':') ? kEvalMode_Compiling : kEvalMode_Interpreting;
+// offset of the native code of the word at address, 0 if it hasn't been compiled
+static uint32_t _jit_code_of(const joforth_t* joforth, joforth_word_address_t address) {
+    return joforth->_jit_words_size ? _jit_word_slot(joforth, address)->_jit : 0;
+}
 
-    char buffer[JOFORTH_MAX_WORD_LENGTH];
-    size_t wp;
-    // reset!
-    joforth->_irw = 0;
+// the offset of entry's native code if a call to it should run it, otherwise 0. Until it's compiled 
+// calls are counted, unless the VM is metered; native code doesn't use fuel so it isn't used at all then
+static _JO_ALWAYS_INLINE uint32_t _jit_ready(joforth_t* joforth, const _joforth_dict_entry_t* entry) {
+    if (joforth->_fuel) {
+        return 0;
+    }
+    const joforth_word_address_t address = _address_of(joforth, entry);
+    _joforth_jit_word_t* word = joforth->_jit_words_size ? _jit_word_slot(joforth, address) : 0;
+    if (!word || !word->_entry) {
+        // keep the load factor below 3/4
+        if (4 * (joforth->_jit_words_count + 1) > 3 * joforth->_jit_words_size) {
+            _jit_words_grow(joforth, joforth->_jit_words_size ? 2 * joforth->_jit_words_size : JOFORTH_JIT_WORDS_INITIAL_SIZE);
+        }
+        word = _jit_word_slot(joforth, address);
+        word->_entry = address;
+        ++joforth->_jit_words_count;
+    }
+    if (!word->_jit) {
+        if (word->_calls == JOFORTH_JIT_THRESHOLD || ++word->_calls != JOFORTH_JIT_THRESHOLD) {
+            return 0;
+        }
+        // compiling doesn't add to the table, word stays where it is
+        word->_jit = _jit_compile(joforth, entry);
+    }
+    return word->_jit;
+}
+#endif
 
-    // comment (if any); we'll use it if we're compiling
-    const char* comment = 0;
+// =====================================================================================
+// the phase 2 execution engine
+// 
+// the same engine body is used for both the portable byte IR switch loop and, if 
+// JOFORTH_THREADED_CODE is defined, direct threaded code. The latter is a translation 
+// of the byte IR where each instruction is the address of its handler followed by 
+// its operands, each in a cell of its own, which removes the decode and switch 
+// overhead of each instruction.
+//
+// the top of the value stack and the stack pointer are cached in locals while the 
+// engine runs and only written back ("spilled") when native handlers are called
+// and when we return. The stack has a guard slot at the bottom so that an empty 
+// stack can be cached too.
+// =====================================================================================
 
-    if (mode == kEvalMode_Compiling) {
+#if defined(JOFORTH_THREADED_CODE)
+typedef _joforth_cell_t* _joforth_ip_t;
+#define _JO_ENGINE_BEGIN()          _JO_DISPATCH();
+#define _JO_ENGINE_END()
+#define _JO_DISPATCH()              goto *(ip++)->_label
+#define _JO_OP(ir)                  _label_##ir:
+#define _JO_OP_DEFAULT()            _label_default:
+// operands are widened to a full cell by the translator, see _translate
+#define _JO_OPERAND(operand)        (operand) = (ip++)->_value
+#define _JO_OPERAND_OP(ir)          (ir) = (_joforth_ir_t)(ip++)->_value
+// branch offsets are translated to cells
+#define _JO_OPERAND_OFFSET(offset)  (offset) = (_joforth_ir_offset_t)(ip++)->_value
+// the code of a word, past its kIr_DefineWord header
+#define _JO_CODE(memory, entry)     ((_joforth_cell_t*)((memory) + (entry)->_code) + 2)
+#else
+typedef uint8_t* _joforth_ip_t;
+#define _JO_ENGINE_BEGIN()          _dispatch: switch (*ip++) {
+#define _JO_ENGINE_END()            }
+#define _JO_DISPATCH()              goto _dispatch
+#define _JO_OP(ir)                  case ir:
+#define _JO_OP_DEFAULT()            default:
+#define _JO_OPERAND(operand)        ip = _ir_consume_operand(ip, &(operand), sizeof(operand))
+#define _JO_OPERAND_OP(ir)          ip = _ir_consume(ip, &(ir))
+#define _JO_OPERAND_OFFSET(offset)  ip = _ir_consume_offset(ip, &(offset))
+#define _JO_CODE(memory, entry)     ((memory) + (entry)->_rep._ir + 1 + sizeof(_joforth_ir_address_t))
+#endif
 
-        _ir_emit(joforth, kIr_DefineWord);
-        // skip ":"
-        word++;
-        // we expect the identifier to be next
-        word = _next_word(joforth, buffer, JOFORTH_MAX_WORD_LENGTH, word, &wp, 0);
-        if (!word || _JO_FAILED(joforth->_status)) {
-            return false;
-        }
-        uint8_t* memory = _alloc(joforth, wp + 1);
-        memcpy(memory, buffer, wp + 1);
-        _ir_emit_ptr(joforth, memory);        
-    }
+// cached stack access, see above
+#define _JO_DEPTH()                 (_JOFORTH_STACK_SIZE(joforth) - 1 - sp)
+#define _JO_NOS                     stack[sp + 2]
+#define _JO_PUSH(value)             _JOFORTH_CHECK(sp); stack[sp-- + 1] = tos; tos = (value)
+#define _JO_POP(value)              _JOFORTH_CHECK(_JO_DEPTH()); (value) = tos; tos = stack[++sp + 1]
+#define _JO_DROP()                  _JOFORTH_CHECK(_JO_DEPTH()); tos = stack[++sp + 1]
+#define _JO_SPILL()                 stack[sp + 1] = tos; joforth->_sp = sp; joforth->_fuel_left = fuel
+#define _JO_FILL()                  sp = joforth->_sp; tos = stack[sp + 1]; fuel = joforth->_fuel_left
+#define _JO_RETURN(result)          _JO_SPILL(); return (result)
+// the only stack check a verified word needs, before it's called (see _infer_effect)
+#define _JO_UNDERFLOWS(entry)       (((entry)->_flags & kEntryFlag_Verified) && _JO_DEPTH() < (entry)->_depth)
 
-    word = _next_word(joforth, buffer, JOFORTH_MAX_WORD_LENGTH, word, &wp, &comment);
-    if (!word || _JO_FAILED(joforth->_status)) {
-        return false;
+// calls and backward branches use fuel, which is cached with the stack; the VM is suspended when 
+// it runs out, with ip at the next instruction to execute (see joforth_resume)
+#define _JO_BURN_FUEL()             if (!--fuel) goto _suspend
+
+// executes code until the IR return stack is back at level irp, the level it was at when the code 
+// started. labels is only used by the threaded code translator to get at the handler addresses.
+static bool _execute(joforth_t* joforth, _joforth_ip_t ip, size_t irp, const void* const** labels) {
+
+#if defined(JOFORTH_THREADED_CODE)
+    static const void* const _labels[kIr_NumCodes] = {
+        [kIr_Null] = &&_label_kIr_Null,
+        [kIr_DefineWord] = &&_label_kIr_DefineWord,
+        [kIr_WordPtr] = &&_label_kIr_WordPtr,
+        [kIr_ValuePtr] = &&_label_kIr_ValuePtr,
+        [kIr_Value] = &&_label_kIr_Value,
+        [kIr_Native] = &&_label_kIr_Native,
+        [kIr_IfZeroOperator] = &&_label_kIr_IfZeroOperator,
+        [kIr_If] = &&_label_default,
+        [kIr_Else] = &&_label_default,
+        [kIr_Endif] = &&_label_default,
+        [kIr_Begin] = &&_label_default,
+        [kIr_Until] = &&_label_default,
+        [kIr_While] = &&_label_default,
+        [kIr_Repeat] = &&_label_default,
+        [kIr_Do] = &&_label_default,
+        [kIr_Loop] = &&_label_kIr_Loop,
+        [kIr_EndDefineWord] = &&_label_default,
+        [kIr_Recurse] = &&_label_kIr_Recurse,
+        [kIr_TailCall] = &&_label_kIr_TailCall,
+        [kIr_Dot] = &&_label_kIr_Dot,
+        [kIr_DotDot] = &&_label_kIr_DotDot,
+        [kIr_True] = &&_label_kIr_True,
+        [kIr_False] = &&_label_kIr_False,
+        [kIr_Invert] = &&_label_kIr_Invert,
+        [kIr_Branch] = &&_label_kIr_Branch,
+        [kIr_BranchIfZero] = &&_label_kIr_BranchIfZero,
+        [kIr_AddImm] = &&_label_kIr_AddImm,
+        [kIr_LtImm] = &&_label_kIr_LtImm,
+        [kIr_GtImm] = &&_label_kIr_GtImm,
+        [kIr_EqImm] = &&_label_kIr_EqImm,
+        [kIr_ZeroEq] = &&_label_kIr_ZeroEq,
+        [kIr_DupMul] = &&_label_kIr_DupMul,
+        [kIr_Nip] = &&_label_kIr_Nip,
+        [kIr_OverPlus] = &&_label_kIr_OverPlus,
+        [kIr_Plus] = &&_label_kIr_Plus,
+        [kIr_Minus] = &&_label_kIr_Minus,
+        [kIr_Mul] = &&_label_kIr_Mul,
+        [kIr_Mod] = &&_label_kIr_Mod,
+        [kIr_Lt] = &&_label_kIr_Lt,
+        [kIr_Gt] = &&_label_kIr_Gt,
+        [kIr_Eq] = &&_label_kIr_Eq,
+        [kIr_Dup] = &&_label_kIr_Dup,
+        [kIr_Drop] = &&_label_kIr_Drop,
+        [kIr_Swap] = &&_label_kIr_Swap,
+        [kIr_Over] = &&_label_kIr_Over,
+        [kIr_Tuck] = &&_label_kIr_Tuck,
+        [kIr_At] = &&_label_kIr_At,
+        [kIr_Bang] = &&_label_kIr_Bang,
+        [kIr_NativeUnary] = &&_label_kIr_NativeUnary,
+        [kIr_NativeBinary] = &&_label_kIr_NativeBinary,
+        [kIr_NativeArray] = &&_label_kIr_NativeArray,
+        [kIr_Value8] = &&_label_kIr_Value8,
+        [kIr_Value32] = &&_label_kIr_Value32,
+        [kIr_Yield] = &&_label_kIr_Yield,
+        [kIr_SwapUnchecked] = &&_label_kIr_SwapUnchecked,
+        [kIr_TuckUnchecked] = &&_label_kIr_TuckUnchecked,
+    };
+    if (labels) {
+        *labels = _labels;
+        return true;
     }
+#else
+    (void)labels;
+#endif
 
-    // =====================================================================================
-    // phase 1: convert the input text to a stream of IR codes    
-    // count words
-    // =====================================================================================
+    // base of all addresses
+    uint8_t* const memory = joforth->_memory;
+    joforth_value_t* const stack = joforth->_stack;
+    size_t sp;
+    joforth_value_t tos;
+    size_t fuel;
+    _JO_FILL();
 
-    size_t word_count = 0;
-    size_t target_word_count = 0;   //< used when we parse prefix words    
-    do {
+    _JO_ENGINE_BEGIN()
 
-        if (target_word_count && word_count >= target_word_count) {
-            // this word will be passed, as-is, on the stack to feed a previous 
-            // PREFIX word (see kWordType_Prefix)
-            char* the_word = (char*)_alloc(joforth, wp + 1);
-            memcpy(the_word, buffer, wp + 1);
-            _ir_emit(joforth, kIr_ValuePtr);
-            _ir_emit_ptr(joforth, the_word);
-            target_word_count = word_count > target_word_count ? target_word_count : 0;
+    _JO_OP(kIr_Null)
+    {
+        if (joforth->_irp == irp) {
+            // we're done
+            _JO_RETURN(true);
+        }
+        // return to caller
+        ip = (_joforth_ip_t)_pop_irstack(joforth);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_True)
+    {
+        _JO_PUSH(JOFORTH_TRUE);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_False)
+    {
+        _JO_PUSH(JOFORTH_FALSE);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Invert)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH());
+        // sends TRUE->FALSE and vice versa.
+        tos = ~tos;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Branch)
+    {
+        _joforth_ir_offset_t offset;
+        _JO_OPERAND_OFFSET(offset);
+        ip += offset;
+        if (offset < 0) {
+            _JO_BURN_FUEL();
+        }
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_BranchIfZero)
+    {
+        _joforth_ir_offset_t offset;
+        _JO_OPERAND_OFFSET(offset);
+        joforth_value_t value;
+        _JO_POP(value);
+        if (value == JOFORTH_FALSE) {
+            ip += offset;
+            if (offset < 0) {
+                _JO_BURN_FUEL();
+            }
+        }
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_IfZeroOperator)
+    {
+        //TODO: change to general ? operator handler
+
+        // like kIr_BranchIfZero but doesn't consume TOS
+        _joforth_ir_offset_t offset;
+        _JO_OPERAND_OFFSET(offset);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        if (tos == 0) {
+            ip += offset;
+        }
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Dot)
+    {
+        joforth_value_t value;
+        _JO_POP(value);
+        _print_value(joforth, value);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_DotDot)
+    {
+        joforth_value_t str;
+        _JO_POP(str);
+        _write(joforth, (const char*)(memory + str), strlen((const char*)(memory + str)));
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_ValuePtr)
+    {
+        // pushes the address of the string
+        _joforth_ir_address_t address;
+        _JO_OPERAND(address);
+        _JO_PUSH((joforth_value_t)address);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Value)
+    {
+        joforth_value_t value;
+        _JO_OPERAND(value);
+        _JO_PUSH(value);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Value8)
+    {
+        int8_t value;
+        _JO_OPERAND(value);
+        _JO_PUSH((joforth_value_t)value);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Value32)
+    {
+        int32_t value;
+        _JO_OPERAND(value);
+        _JO_PUSH((joforth_value_t)value);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Native)
+    {
+        _joforth_ir_address_t address;
+        _JO_OPERAND(address);
+        _joforth_dict_entry_t* handler_entry = (_joforth_dict_entry_t*)(memory + address);
+        _JO_SPILL();
+        handler_entry->_rep._handler(joforth);
+        _JO_FILL();
+        if (_JO_FAILED(joforth->_status)) {
+            return false;
+        }
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_NativeUnary)
+    {
+        _joforth_ir_address_t address;
+        _JO_OPERAND(address);
+        const _joforth_dict_entry_t* handler_entry = (const _joforth_dict_entry_t*)(memory + address);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = handler_entry->_rep._unary(tos);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_NativeBinary)
+    {
+        _joforth_ir_address_t address;
+        _JO_OPERAND(address);
+        const _joforth_dict_entry_t* handler_entry = (const _joforth_dict_entry_t*)(memory + address);
+        joforth_value_t value;
+        _JO_POP(value);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = handler_entry->_rep._binary(tos, value);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_NativeArray)
+    {
+        // the values are used in place, only the cached top needs to be written back
+        _joforth_ir_address_t address;
+        _JO_OPERAND(address);
+        const _joforth_dict_entry_t* handler_entry = (const _joforth_dict_entry_t*)(memory + address);
+        _JOFORTH_CHECK(_JO_DEPTH() >= handler_entry->_depth);
+        stack[sp + 1] = tos;
+        handler_entry->_rep._array(stack + sp + 1, handler_entry->_depth);
+        tos = stack[sp + 1];
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_DefineWord)
+    {
+        // calls go straight past this header so we only get here if the IR is executed from the start
+        _joforth_ir_address_t id;
+        _JO_OPERAND(id);
+        (void)id;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Recurse)
+    {
+        // invoke the word itself again
+        _joforth_ir_address_t self;
+        _JO_OPERAND(self);
+        const _joforth_dict_entry_t* entry = (const _joforth_dict_entry_t*)(memory + self);
+#if defined(JOFORTH_JIT)
+        const uint32_t native = _jit_ready(joforth, entry);
+        if (native) {
+            _JO_SPILL();
+            const bool ok = _jit_run(joforth, native);
+            _JO_FILL();
+            if (!ok) {
+                return false;
+            }
+            _JO_DISPATCH();
+        }
+#endif
+        _push_irstack(joforth, (uint8_t*)ip);
+        ip = _JO_CODE(memory, entry);
+        _JO_BURN_FUEL();
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_TailCall)
+    {
+        // a call in tail position doesn't need to return here, so we just switch to it
+        _joforth_ir_address_t address;
+        _JO_OPERAND(address);
+        const _joforth_dict_entry_t* entry = (const _joforth_dict_entry_t*)(memory + address);
+        if (_JO_UNDERFLOWS(entry)) {
+            joforth->_status = _JO_STATUS_INVALID_INPUT;
+            _JO_RETURN(false);
+        }
+#if defined(JOFORTH_JIT)
+        const uint32_t native = _jit_ready(joforth, entry);
+        if (native) {
+            _JO_SPILL();
+            const bool ok = _jit_run(joforth, native);
+            _JO_FILL();
+            if (!ok) {
+                return false;
+            }
+            // and return, as kIr_Null
+            if (joforth->_irp == irp) {
+                _JO_RETURN(true);
+            }
+            ip = (_joforth_ip_t)_pop_irstack(joforth);
+            _JO_DISPATCH();
+        }
+#endif
+        ip = _JO_CODE(memory, entry);
+        _JO_BURN_FUEL();
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_WordPtr)
+    {
+        // the current word, can be used for self reference 
+        _joforth_ir_address_t address;
+        _JO_OPERAND(address);
+        const _joforth_dict_entry_t* entry = (const _joforth_dict_entry_t*)(memory + address);
+
+        if (entry->_type == kEntryType_Prefix) {
+            // first check that we've got enough arguments following this instruction
+                    //TODO: can CREATE, VARIABLE, SEE etc. accept the result of another word...?
+                    // for now; only accept value and word ptrs 
+            assert(entry->_depth < 2);
+
+            //ZZZ: this doesn't check softly if we're at the end of the buffer
+            _joforth_ir_t next_ir;
+            _JO_OPERAND_OP(next_ir);
+            switch (next_ir) {
+            case kIr_WordPtr:
+            case kIr_ValuePtr:
+            {
+                //NOTE: we're not doing any type checking here, if it requires a WordPtr when a ValuePtr 
+                //      is passed then things WILL go wrong...
+                _joforth_ir_address_t argument;
+                _JO_OPERAND(argument);
+                _JO_PUSH((joforth_value_t)argument);
+                _JO_SPILL();
+                entry->_rep._handler(joforth);
+                _JO_FILL();
+                if (_JO_FAILED(joforth->_status)) {
+                    return false;
+                }
+            }
+            break;
+            default:
+                joforth->_status = _JO_STATUS_INVALID_INPUT;
+                _JO_RETURN(false);
+            }
         }
         else {
-            // first check for language keywords
-            bool is_language_keyword = false;
-            for (size_t n = 0; n < _joforth_keyword_lut_size; ++n) {
-                if (strcmp(buffer, _joforth_keyword_lut[n]._id) == 0) {
-                    is_language_keyword = true;
-                    _ir_emit(joforth, _joforth_keyword_lut[n]._ir);
-                    break;
+            if (_JO_UNDERFLOWS(entry)) {
+                joforth->_status = _JO_STATUS_INVALID_INPUT;
+                _JO_RETURN(false);
+            }
+#if defined(JOFORTH_JIT)
+            const uint32_t native = _jit_ready(joforth, entry);
+            if (native) {
+                _JO_SPILL();
+                const bool ok = _jit_run(joforth, native);
+                _JO_FILL();
+                if (!ok) {
+                    return false;
                 }
+                _JO_DISPATCH();
             }
+#endif
+            // switch to the entry's ir code and continue executing 
+            _push_irstack(joforth, (uint8_t*)ip);
+            ip = _JO_CODE(memory, entry);
+            _JO_BURN_FUEL();
+        }
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Yield)
+    {
+        // code run by a native can't be suspended on its own, it carries on
+        if (joforth->_running == 1) {
+            goto _suspend;
+        }
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Loop)
+    {
+        _joforth_ir_offset_t offset;
+        _JO_OPERAND_OFFSET(offset);
+        _JOFORTH_CHECK(_JO_DEPTH() > 1);
+        joforth_value_t end = tos;
+        joforth_value_t i = _JO_NOS;
+        assert(i<end);
+        ++i;
+        if(i<end) {
+            // leave i and end on the stack and go back to DO
+            _JO_NOS = i;
+            ip += offset;
+            _JO_BURN_FUEL();
+        }
+        else {
+            // we're done
+            _JO_DROP();
+            _JO_DROP();
+        }
+    }
+    _JO_DISPATCH();
 
-            if (!is_language_keyword) {
-                // then check for special symbols that we can interpret directly
-                if (buffer[0] == '.') {
-                    // . or .SomeString or ."SomeString"
-                    if (wp > 1) {
-                        // print a string foll
-                        size_t start = 1;
-                        size_t end = 2;
-                        if (buffer[start] == '\"') {
-                            start = 2;
-                            end = 3;
-                        }
-                        while (buffer[end] && buffer[end] != '\"') ++end;
-                        buffer[end] = 0;
-                        if (start < end) {
-                            // emit "dot" and put the allocated string on the value stack 
-                            uint8_t* memory = _alloc(joforth, end - start + 1);
-                            memcpy(memory, buffer + start, end - start + 1);
-                            _ir_emit(joforth, kIr_ValuePtr);
-                            _ir_emit_ptr(joforth, memory);
-                            _ir_emit(joforth, kIr_DotDot);
-                        }
-                    }
-                    else {
-                        // just a dot
-                        _ir_emit(joforth, kIr_Dot);
-                    }
-                }
-                else if (buffer[0] == '?') {
-                    //TODO: Forth uses this for other things as well, so this shoud 
-                    //      be changed to just a special prefix operator and then interpreted 
-                    //      during IR execution
+    // primitives; built in native words which are executed directly
+    _JO_OP(kIr_Plus)
+    {
+        joforth_value_t value;
+        _JO_POP(value);
+        tos += value;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Minus)
+    {
+        //NOTE: explicit reverse polish
+        joforth_value_t value;
+        _JO_POP(value);
+        tos -= value;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Mul)
+    {
+        joforth_value_t value;
+        _JO_POP(value);
+        tos *= value;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Mod)
+    {
+        joforth_value_t value;
+        _JO_POP(value);
+        tos %= value;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Lt)
+    {
+        //NOTE: NOS < TOS
+        joforth_value_t value;
+        _JO_POP(value);
+        tos = tos < value ? JOFORTH_TRUE : JOFORTH_FALSE;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Gt)
+    {
+        //NOTE: NOS > TOS
+        joforth_value_t value;
+        _JO_POP(value);
+        tos = tos > value ? JOFORTH_TRUE : JOFORTH_FALSE;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Eq)
+    {
+        joforth_value_t value;
+        _JO_POP(value);
+        tos = tos == value ? JOFORTH_TRUE : JOFORTH_FALSE;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Dup)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH());
+        _JO_PUSH(tos);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Drop)
+    {
+        _JO_DROP();
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Swap)
+    {
+        if (_JO_DEPTH() < 2) {
+            joforth->_status = _JO_STATUS_INVALID_INPUT;
+            _JO_RETURN(false);
+        }
+        joforth_value_t nos = _JO_NOS;
+        _JO_NOS = tos;
+        tos = nos;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Over)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH() > 1);
+        joforth_value_t nos = _JO_NOS;
+        _JO_PUSH(nos);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Tuck)
+    {
+        if (_JO_DEPTH() < 2) {
+            joforth->_status = _JO_STATUS_INVALID_INPUT;
+            _JO_RETURN(false);
+        }
+        // a b -- b a b
+        _JOFORTH_CHECK(sp);
+        stack[sp + 1] = _JO_NOS;
+        _JO_NOS = tos;
+        --sp;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_SwapUnchecked)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH() > 1);
+        joforth_value_t nos = _JO_NOS;
+        _JO_NOS = tos;
+        tos = nos;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_TuckUnchecked)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH() > 1 && sp);
+        stack[sp + 1] = _JO_NOS;
+        _JO_NOS = tos;
+        --sp;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_At)
+    {
+        // retrieve value at (relative) address
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = *(joforth_value_t*)(memory + tos);
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Bang)
+    {
+        // store value at (relative) address
+        joforth_value_t address;
+        joforth_value_t value;
+        _JO_POP(address);
+        _JO_POP(value);
+        *(joforth_value_t*)(memory + address) = value;
+    }
+    _JO_DISPATCH();
 
-                    // ? prefix (if zero)
-                    if (wp > 1) {
-                        // what follows will be executed if and only if tos!=0
-                        _ir_emit(joforth, kIr_IfZeroOperator);
-                        // a bit wonky but it works; "shift" the contents of buffer down to hide the leading ? 
-                        // so that we can continune as if nothing happened...
-                        size_t n = 1;
-                        while (n < wp) {
-                            buffer[n - 1] = buffer[n];
-                            n++;
-                        }
-                        wp--;
-                        buffer[wp] = 0;
-                        continue;
-                    }
-                    else {
-                        // just a ? isn't enough...
-                        joforth->_status = _JO_STATUS_INVALID_INPUT;
-                        return false;
-                    }
+    // superinstructions, see _optimise
+    _JO_OP(kIr_AddImm)
+    {
+        int32_t value;
+        _JO_OPERAND(value);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos += value;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_LtImm)
+    {
+        int32_t value;
+        _JO_OPERAND(value);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = tos < value ? JOFORTH_TRUE : JOFORTH_FALSE;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_GtImm)
+    {
+        int32_t value;
+        _JO_OPERAND(value);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = tos > value ? JOFORTH_TRUE : JOFORTH_FALSE;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_EqImm)
+    {
+        int32_t value;
+        _JO_OPERAND(value);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = tos == value ? JOFORTH_TRUE : JOFORTH_FALSE;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_ZeroEq)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = tos == 0 ? JOFORTH_TRUE : JOFORTH_FALSE;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_DupMul)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos *= tos;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_Nip)
+    {
+        joforth_value_t value;
+        _JO_POP(value);
+        _JOFORTH_CHECK(_JO_DEPTH());
+        tos = value;
+    }
+    _JO_DISPATCH();
+    _JO_OP(kIr_OverPlus)
+    {
+        _JOFORTH_CHECK(_JO_DEPTH() > 1);
+        tos += _JO_NOS;
+    }
+    _JO_DISPATCH();
+    _JO_OP_DEFAULT()
+    _JO_DISPATCH();
+
+    _JO_ENGINE_END()
+
+_suspend:
+    joforth->_resume_ip = (void*)ip;
+    joforth->_resume_irp = irp;
+    joforth->_suspended = true;
+    _JO_RETURN(false);
+}
+
+#if defined(JOFORTH_THREADED_CODE)
+// translate a kIr_Null terminated IR sequence to threaded code, returns the number of cells used.
+// if code is 0 nothing is written and only the size is calculated. 
+// operands are widened to a full cell, addresses are kept as they are so that the code is as
+// position independent as the IR.
+static size_t _translate(joforth_t* joforth, _joforth_cell_t* code, uint8_t* ir) {
+    const void* const* labels;
+    _execute(0, 0, 0, &labels);
+
+    // the threaded code location of each instruction, by IR location, to re-target branches
+    uint16_t cell_at[JOFORTH_DEFAULT_IRBUFFER_SIZE];
+    size_t cells = 0;
+    uint8_t* i = ir;
+    _joforth_ir_t op;
+    do {
+        op = (_joforth_ir_t)*i;
+        const size_t operand_size = _ir_operand_size(op);
+        assert((size_t)(i - ir) < JOFORTH_DEFAULT_IRBUFFER_SIZE);
+        cell_at[i - ir] = (uint16_t)cells;
+        cells += operand_size ? 2 : 1;
+        i += 1 + operand_size;
+    } while (op != kIr_Null);
+
+    if (!code) {
+        return cells;
+    }
+
+    // set when the next instruction is an argument to a prefix word
+    bool prefix_argument = false;
+    i = ir;
+    do {
+        op = (_joforth_ir_t)*i;
+        const size_t operand_size = _ir_operand_size(op);
+        _joforth_cell_t* cell = code + cell_at[i - ir];
+        if (prefix_argument) {
+            // consumed as a plain opcode by the prefix handler
+            cell->_value = op;
+        }
+        else {
+            cell->_label = labels[op];
+        }
+        prefix_argument = false;
+
+        if (_ir_is_branch(op)) {
+            _joforth_ir_offset_t offset;
+            _ir_consume_offset(i + 1, &offset);
+            const size_t target = (size_t)(i + 1 + operand_size + offset - ir);
+            cell[1]._value = (joforth_value_t)cell_at[target] - (joforth_value_t)(cell + 2 - code);
+        }
+        else if (operand_size) {
+            cell[1]._value = _ir_operand(op, i + 1);
+            if (op == kIr_WordPtr) {
+                const _joforth_dict_entry_t* entry = _entry_at(joforth, (joforth_word_address_t)cell[1]._value);
+                prefix_argument = entry->_type == kEntryType_Prefix;
+            }
+        }
+        i += 1 + operand_size;
+    } while (op != kIr_Null);
+
+    return cells;
+}
+#endif
+
+// runs code with a new fuel budget. Code run by natives (which call joforth_eval and friends 
+// themselves) is part of the code which called them, so it isn't metered on its own
+static bool _run(joforth_t* joforth, _joforth_ip_t ip) {
+    if (joforth->_running) {
+        const size_t fuel = joforth->_fuel_left;
+        joforth->_fuel_left = SIZE_MAX;
+        ++joforth->_running;
+        const bool result = _execute(joforth, ip, joforth->_irp, 0);
+        --joforth->_running;
+        joforth->_fuel_left = fuel;
+        return result;
+    }
+    joforth->_fuel_left = joforth->_fuel ? joforth->_fuel : SIZE_MAX;
+    joforth->_running = 1;
+    const bool result = _execute(joforth, ip, joforth->_irp, 0);
+    joforth->_running = 0;
+    return result;
+}
+
+#if defined(JOFORTH_JIT)
+// =====================================================================================
+// native code for hot words (JOFORTH_JIT builds, x86-64 Linux only)
+//
+// the engine counts the calls to each word (see _jit_ready) and once it has been called 
+// JOFORTH_JIT_THRESHOLD times its IR is translated to x86-64 code, a fixed template for each 
+// instruction, in an executable region owned by the VM. Calls to it from then on run the 
+// native code instead, the byte IR is still used for everything else and as the fallback; 
+// words with instructions the translator doesn't handle, or which can yield, stay interpreted.
+//
+// the native code caches the stack like the engine does, with the top value in rbx and r12 
+// pointing at its slot, and keeps r13 = _memory, r14 = joforth and r15 = _stack. Compiled words 
+// call each other directly, natives and words which haven't been compiled are called through 
+// small helpers with the stack spilled. All of it is entered through a trampoline at the start 
+// of the region, which saves the registers C expects to keep and is where failures unwind to.
+// The code only refers to itself relatively, so a clone can use a copy of it.
+// =====================================================================================
+
+_Static_assert(sizeof(jo_status_t) == sizeof(uint32_t), "_status is set with a 32 bit store");
+
+// writes code to the region, or only works out its size if _code is 0
+typedef struct _joforth_jit_emitter {
+    uint8_t*    _code;
+    // offset of the next instruction in the region
+    size_t      _at;
+} _joforth_jit_emitter_t;
+
+// where the code goes when it fails, see _jit_emit_trampoline
+typedef struct _joforth_jit_exits {
+    // sets _JO_STATUS_INVALID_INPUT and fails, the stack is spilled first
+    size_t      _invalid;
+    // the same with _JO_STATUS_RESOURCE_EXHAUSTED, for the stack and call depth checks
+    size_t      _exhausted;
+    // unwinds back to the trampoline which returns false, the stack has already been spilled
+    size_t      _fail;
+} _joforth_jit_exits_t;
+
+static void _jit_emit(_joforth_jit_emitter_t* jit, const void* bytes, size_t size) {
+    if (jit->_code) {
+        memcpy(jit->_code + jit->_at, bytes, size);
+    }
+    jit->_at += size;
+}
+
+// bytes is a string literal with the encoded instruction
+#define _JIT_EMIT(jit, bytes)       _jit_emit((jit), (bytes), sizeof(bytes) - 1)
+
+static void _jit_emit32(_joforth_jit_emitter_t* jit, uint32_t value) {
+    _jit_emit(jit, &value, sizeof(value));
+}
+
+static void _jit_emit64(_joforth_jit_emitter_t* jit, uint64_t value) {
+    _jit_emit(jit, &value, sizeof(value));
+}
+
+// the rel32 operand of a jump or call to an offset in the region
+static void _jit_emit_rel32(_joforth_jit_emitter_t* jit, size_t target) {
+    _jit_emit32(jit, (uint32_t)((int64_t)target - (int64_t)(jit->_at + sizeof(uint32_t))));
+}
+
+// write the cached top back to its slot and the stack pointer to the VM, like _JO_SPILL
+static void _jit_spill(_joforth_jit_emitter_t* jit) {
+    _JIT_EMIT(jit, "\x49\x89\x1c\x24");                 // mov [r12], rbx
+    _JIT_EMIT(jit, "\x4c\x89\xe0");                     // mov rax, r12
+    _JIT_EMIT(jit, "\x4c\x29\xf8");                     // sub rax, r15
+    _JIT_EMIT(jit, "\x48\xc1\xf8\x03");                 // sar rax, 3
+    _JIT_EMIT(jit, "\x48\xff\xc8");                     // dec rax
+    _JIT_EMIT(jit, "\x49\x89\x86");                     // mov [r14 + _sp], rax
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _sp));
+}
+
+// the reverse, like _JO_FILL
+static void _jit_fill(_joforth_jit_emitter_t* jit) {
+    _JIT_EMIT(jit, "\x4d\x8b\xae");                     // mov r13, [r14 + _memory]
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _memory));
+    _JIT_EMIT(jit, "\x4d\x8b\xbe");                     // mov r15, [r14 + _stack]
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _stack));
+    _JIT_EMIT(jit, "\x49\x8b\x86");                     // mov rax, [r14 + _sp]
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _sp));
+    _JIT_EMIT(jit, "\x4d\x8d\x64\xc7\x08");             // lea r12, [r15 + rax*8 + 8]
+    _JIT_EMIT(jit, "\x49\x8b\x1c\x24");                 // mov rbx, [r12]
+}
+
+static void _jit_push(_joforth_jit_emitter_t* jit) {
+    _JIT_EMIT(jit, "\x49\x89\x1c\x24");                 // mov [r12], rbx
+    _JIT_EMIT(jit, "\x49\x83\xec\x08");                 // sub r12, 8
+}
+
+static void _jit_drop(_joforth_jit_emitter_t* jit) {
+    _JIT_EMIT(jit, "\x49\x83\xc4\x08");                 // add r12, 8
+    _JIT_EMIT(jit, "\x49\x8b\x1c\x24");                 // mov rbx, [r12]
+}
+
+static void _jit_push_value(_joforth_jit_emitter_t* jit, joforth_value_t value) {
+    _jit_push(jit);
+    if (value == (int32_t)value) {
+        _JIT_EMIT(jit, "\x48\xc7\xc3");                 // mov rbx, imm32
+        _jit_emit32(jit, (uint32_t)value);
+    }
+    else {
+        _JIT_EMIT(jit, "\x48\xbb");                     // mov rbx, imm64
+        _jit_emit64(jit, (uint64_t)value);
+    }
+}
+
+// pops the top value into rax, the NOS of binary operators
+static void _jit_pop_nos(_joforth_jit_emitter_t* jit) {
+    _JIT_EMIT(jit, "\x49\x83\xc4\x08");                 // add r12, 8
+    _JIT_EMIT(jit, "\x49\x8b\x04\x24");                 // mov rax, [r12]
+}
+
+// sets the top to JOFORTH_TRUE or JOFORTH_FALSE from the flags of a compare, setcc is the setcc al instruction
+static void _jit_to_bool(_joforth_jit_emitter_t* jit, const char* setcc) {
+    _jit_emit(jit, setcc, 3);                           // setcc al
+    _JIT_EMIT(jit, "\x0f\xb6\xc0");                     // movzx eax, al
+    _JIT_EMIT(jit, "\x48\xf7\xd8");                     // neg rax
+    _JIT_EMIT(jit, "\x48\x89\xc3");                     // mov rbx, rax
+}
+
+// call a C function, the stack is aligned for it 
+static void _jit_call_c(_joforth_jit_emitter_t* jit, uintptr_t fn) {
+    _JIT_EMIT(jit, "\x48\xb8");                         // mov rax, fn
+    _jit_emit64(jit, (uint64_t)fn);
+    _JIT_EMIT(jit, "\xff\xd0");                         // call rax
+}
+
+// calls bool helper(joforth, rsi) with the stack spilled, and fails if it does
+static void _jit_call_helper(_joforth_jit_emitter_t* jit, uintptr_t helper, const _joforth_jit_exits_t* exits) {
+    _jit_spill(jit);
+    _JIT_EMIT(jit, "\x4c\x89\xf7");                     // mov rdi, r14
+    _jit_call_c(jit, helper);
+    _JIT_EMIT(jit, "\x84\xc0");                         // test al, al
+    _JIT_EMIT(jit, "\x0f\x84");                         // jz fail
+    _jit_emit_rel32(jit, exits->_fail);
+    _jit_fill(jit);
+}
+
+// fails, as the engine does, if there are fewer than depth values on the stack
+static void _jit_check_depth(_joforth_jit_emitter_t* jit, const _joforth_jit_exits_t* exits, uint32_t depth) {
+    _JIT_EMIT(jit, "\x49\x8b\x86");                     // mov rax, [r14 + _stack_size]
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _stack_size));
+    _JIT_EMIT(jit, "\x49\x8d\x04\xc7");                 // lea rax, [r15 + rax*8]
+    _JIT_EMIT(jit, "\x49\x8d\x94\x24");                 // lea rdx, [r12 + depth*8]
+    _jit_emit32(jit, depth * (uint32_t)sizeof(joforth_value_t));
+    _JIT_EMIT(jit, "\x48\x39\xc2");                     // cmp rdx, rax
+    _JIT_EMIT(jit, "\x0f\x87");                         // ja invalid
+    _jit_emit_rel32(jit, exits->_invalid);
+}
+
+// fails if there isn't room on the stack for room more values. Between checks the code only runs 
+// forward, so at most as many values as the word has instructions which push, see _jit_room
+static void _jit_check_room(_joforth_jit_emitter_t* jit, const _joforth_jit_exits_t* exits, uint32_t room) {
+#if JOFORTH_CHECKS != JOFORTH_CHECKS_NONE
+    // a push needs _sp > 0, i.e. r12 above the first slot
+    _JIT_EMIT(jit, "\x49\x8d\x87");                     // lea rax, [r15 + (room + 1)*8]
+    _jit_emit32(jit, (room + 1) * (uint32_t)sizeof(joforth_value_t));
+    _JIT_EMIT(jit, "\x49\x39\xc4");                     // cmp r12, rax
+    _JIT_EMIT(jit, "\x0f\x82");                         // jb exhausted
+    _jit_emit_rel32(jit, exits->_exhausted);
+#else
+    (void)jit; (void)exits; (void)room;
+#endif
+}
+
+// the entry of a word, which counts the native calls it's nested in and fails if there are more of them 
+// than the engine allows for interpreted calls. _jit_return undoes it
+static void _jit_enter(_joforth_jit_emitter_t* jit, const _joforth_jit_exits_t* exits) {
+    _JIT_EMIT(jit, "\x48\x83\xec\x08");                 // sub rsp, 8
+#if JOFORTH_CHECKS != JOFORTH_CHECKS_NONE
+    _JIT_EMIT(jit, "\x49\x81\xbe");                     // cmp qword [r14 + _jit_depth], JOFORTH_IRSTACK_SIZE
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _jit_depth));
+    _jit_emit32(jit, (uint32_t)JOFORTH_IRSTACK_SIZE);
+    _JIT_EMIT(jit, "\x0f\x83");                         // jae exhausted
+    _jit_emit_rel32(jit, exits->_exhausted);
+    _JIT_EMIT(jit, "\x49\xff\x86");                     // inc qword [r14 + _jit_depth]
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _jit_depth));
+#else
+    (void)exits;
+#endif
+}
+
+// leaving a word, before a return or a tail call to another one
+static void _jit_leave(_joforth_jit_emitter_t* jit) {
+#if JOFORTH_CHECKS != JOFORTH_CHECKS_NONE
+    _JIT_EMIT(jit, "\x49\xff\x8e");                     // dec qword [r14 + _jit_depth]
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _jit_depth));
+#endif
+    _JIT_EMIT(jit, "\x48\x83\xc4\x08");                 // add rsp, 8
+}
+
+// the return of a word, which starts with "sub rsp, 8" so that the stack stays aligned for C calls
+static void _jit_return(_joforth_jit_emitter_t* jit) {
+    _jit_leave(jit);
+    _JIT_EMIT(jit, "\xc3");                             // ret
+}
+
+// bool trampoline(joforth_t* joforth, void* code) runs the code of a word on the VM's stack
+static void _jit_emit_trampoline(_joforth_jit_emitter_t* jit, _joforth_jit_exits_t* exits) {
+    _JIT_EMIT(jit, "\x55\x53\x41\x54\x41\x55\x41\x56\x41\x57"); // push rbp, rbx, r12, r13, r14, r15
+    _JIT_EMIT(jit, "\x48\x83\xec\x08");                 // sub rsp, 8
+    _JIT_EMIT(jit, "\x48\x89\xe5");                     // mov rbp, rsp
+    _JIT_EMIT(jit, "\x49\x89\xfe");                     // mov r14, rdi
+    // the call depth is put back when it fails, the words it unwinds haven't returned
+    _JIT_EMIT(jit, "\x49\x8b\x86");                     // mov rax, [r14 + _jit_depth]
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _jit_depth));
+    _JIT_EMIT(jit, "\x48\x89\x45\x00");                 // mov [rbp], rax
+    _jit_fill(jit);
+    _JIT_EMIT(jit, "\xff\xd6");                         // call rsi
+    _jit_spill(jit);
+    _JIT_EMIT(jit, "\xb8\x01\x00\x00\x00");             // mov eax, 1
+    const size_t exit = jit->_at;
+    _JIT_EMIT(jit, "\x48\x8b\x55\x00");                 // mov rdx, [rbp]
+    _JIT_EMIT(jit, "\x49\x89\x96");                     // mov [r14 + _jit_depth], rdx
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _jit_depth));
+    _JIT_EMIT(jit, "\x48\x83\xc4\x08");                 // add rsp, 8
+    _JIT_EMIT(jit, "\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\x5d"); // pop r15, r14, r13, r12, rbx, rbp
+    _JIT_EMIT(jit, "\xc3");                             // ret
+
+    exits->_invalid = jit->_at;
+    _jit_spill(jit);
+    _JIT_EMIT(jit, "\x41\xc7\x86");                     // mov dword [r14 + _status], _JO_STATUS_INVALID_INPUT
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _status));
+    _jit_emit32(jit, (uint32_t)_JO_STATUS_INVALID_INPUT);
+    exits->_fail = jit->_at;
+    _JIT_EMIT(jit, "\x48\x89\xec");                     // mov rsp, rbp
+    _JIT_EMIT(jit, "\x31\xc0");                         // xor eax, eax
+    _JIT_EMIT(jit, "\xe9");                             // jmp exit
+    _jit_emit_rel32(jit, exit);
+
+    exits->_exhausted = jit->_at;
+    _jit_spill(jit);
+    _JIT_EMIT(jit, "\x41\xc7\x86");                     // mov dword [r14 + _status], _JO_STATUS_RESOURCE_EXHAUSTED
+    _jit_emit32(jit, (uint32_t)offsetof(joforth_t, _status));
+    _jit_emit32(jit, (uint32_t)_JO_STATUS_RESOURCE_EXHAUSTED);
+    _JIT_EMIT(jit, "\xe9");                             // jmp fail
+    _jit_emit_rel32(jit, exits->_fail);
+}
+
+// helpers called by the native code, see _jit_call_helper
+
+static bool _jit_native(joforth_t* joforth, joforth_value_t address) {
+    _entry_at(joforth, (joforth_word_address_t)address)->_rep._handler(joforth);
+    return _JO_SUCCEEDED(joforth->_status);
+}
+
+// calls a word which hasn't been compiled (yet), and counts the call like the engine
+static bool _jit_word(joforth_t* joforth, joforth_value_t address) {
+    const _joforth_dict_entry_t* entry = _entry_at(joforth, (joforth_word_address_t)address);
+    const uint32_t native = _jit_ready(joforth, entry);
+    if (native) {
+        return _jit_run(joforth, native);
+    }
+    return _execute(joforth, _JO_CODE(joforth->_memory, entry), joforth->_irp, 0);
+}
+
+static void _jit_dotdot(joforth_t* joforth, joforth_value_t str) {
+    const char* text = (const char*)(joforth->_memory + str);
+    _write(joforth, text, strlen(text));
+}
+
+// the number of instructions in ir which push a value, the most a word can push between room checks
+static uint32_t _jit_room(const uint8_t* ir) {
+    uint32_t room = 0;
+    _joforth_ir_t op;
+    do {
+        op = (_joforth_ir_t)*ir;
+        switch (op) {
+        case kIr_True:
+        case kIr_False:
+        case kIr_Value:
+        case kIr_Value8:
+        case kIr_Value32:
+        case kIr_ValuePtr:
+        case kIr_Dup:
+        case kIr_Over:
+        case kIr_Tuck:
+        case kIr_TuckUnchecked:
+            ++room;
+            break;
+        default:
+            break;
+        }
+        ir += 1 + _ir_operand_size(op);
+    } while (op != kIr_Null);
+    return room;
+}
+
+// translates the IR of entry, starting at jit->_at. code_at is the code location of each instruction 
+// by IR location, for branches; the first pass fills it in and the second uses it.
+// returns false if the word can't be compiled
+static bool _jit_translate(joforth_t* joforth, _joforth_jit_emitter_t* jit, const _joforth_dict_entry_t* entry, 
+                            uint32_t* code_at, const _joforth_jit_exits_t* exits) {
+    uint8_t* ir = _ptr_at(joforth, entry->_rep._ir);
+    const uint32_t room = _jit_room(ir);
+    const size_t start = jit->_at;
+    _jit_enter(jit, exits);
+    const size_t body = jit->_at;
+    _jit_check_room(jit, exits, room);
+    uint8_t* i = ir;
+    _joforth_ir_t op;
+    do {
+        if ((size_t)(i - ir) >= JOFORTH_DEFAULT_IRBUFFER_SIZE) {
+            return false;
+        }
+        op = (_joforth_ir_t)*i;
+        const size_t operand_size = _ir_operand_size(op);
+        code_at[i - ir] = (uint32_t)jit->_at;
+        const joforth_value_t operand = operand_size ? _ir_operand(op, i + 1) : 0;
+        // branch target, only valid in the second pass for forward branches
+        size_t target = 0;
+        if (_ir_is_branch(op)) {
+            _joforth_ir_offset_t offset;
+            _ir_consume_offset(i + 1, &offset);
+            const ptrdiff_t to = i + 1 + operand_size + offset - ir;
+            if (to < 0 || to >= JOFORTH_DEFAULT_IRBUFFER_SIZE) {
+                return false;
+            }
+            target = code_at[to];
+            if (offset < 0) {
+                // a loop, which may push more each time round
+                _jit_check_room(jit, exits, room);
+            }
+        }
+
+        switch (op) {
+        case kIr_Null:
+            _jit_return(jit);
+            break;
+        case kIr_DefineWord:
+        case kIr_EndDefineWord:
+            break;
+        case kIr_True:
+            _jit_push_value(jit, JOFORTH_TRUE);
+            break;
+        case kIr_False:
+            _jit_push_value(jit, JOFORTH_FALSE);
+            break;
+        case kIr_Value:
+        case kIr_Value8:
+        case kIr_Value32:
+            _jit_push_value(jit, operand);
+            break;
+        case kIr_ValuePtr:
+            _jit_push(jit);
+            _JIT_EMIT(jit, "\xbb");                     // mov ebx, address
+            _jit_emit32(jit, (uint32_t)operand);
+            break;
+        case kIr_Invert:
+            _JIT_EMIT(jit, "\x48\xf7\xd3");             // not rbx
+            break;
+        case kIr_Branch:
+            _JIT_EMIT(jit, "\xe9");                     // jmp target
+            _jit_emit_rel32(jit, target);
+            break;
+        case kIr_BranchIfZero:
+            _JIT_EMIT(jit, "\x48\x89\xd8");             // mov rax, rbx
+            _jit_drop(jit);
+            _JIT_EMIT(jit, "\x48\x85\xc0");             // test rax, rax
+            _JIT_EMIT(jit, "\x0f\x84");                 // jz target
+            _jit_emit_rel32(jit, target);
+            break;
+        case kIr_IfZeroOperator:
+            _JIT_EMIT(jit, "\x48\x85\xdb");             // test rbx, rbx
+            _JIT_EMIT(jit, "\x0f\x84");                 // jz target
+            _jit_emit_rel32(jit, target);
+            break;
+        case kIr_Loop:
+            // i end -- i+1 end, and back to DO while i+1 < end
+            _JIT_EMIT(jit, "\x49\x8b\x44\x24\x08");     // mov rax, [r12 + 8]
+            _JIT_EMIT(jit, "\x48\xff\xc0");             // inc rax
+            _JIT_EMIT(jit, "\x48\x39\xd8");             // cmp rax, rbx
+            _JIT_EMIT(jit, "\x7d\x0a");                 // jge done
+            _JIT_EMIT(jit, "\x49\x89\x44\x24\x08");     // mov [r12 + 8], rax
+            _JIT_EMIT(jit, "\xe9");                     // jmp target
+            _jit_emit_rel32(jit, target);
+            // done:
+            _JIT_EMIT(jit, "\x49\x83\xc4\x10");         // add r12, 16
+            _JIT_EMIT(jit, "\x49\x8b\x1c\x24");         // mov rbx, [r12]
+            break;
+        case kIr_Dot:
+        case kIr_DotDot:
+            _JIT_EMIT(jit, "\x48\x89\xde");             // mov rsi, rbx
+            _jit_drop(jit);
+            _JIT_EMIT(jit, "\x4c\x89\xf7");             // mov rdi, r14
+            _jit_call_c(jit, op == kIr_Dot ? (uintptr_t)_print_value : (uintptr_t)_jit_dotdot);
+            break;
+        case kIr_Native:
+            _JIT_EMIT(jit, "\xbe");                     // mov esi, address
+            _jit_emit32(jit, (uint32_t)operand);
+            _jit_call_helper(jit, (uintptr_t)_jit_native, exits);
+            _jit_check_room(jit, exits, room);
+            break;
+        case kIr_NativeUnary:
+            _JIT_EMIT(jit, "\x48\x89\xdf");             // mov rdi, rbx
+            _jit_call_c(jit, (uintptr_t)_entry_at(joforth, (joforth_word_address_t)operand)->_rep._unary);
+            _JIT_EMIT(jit, "\x48\x89\xc3");             // mov rbx, rax
+            break;
+        case kIr_NativeBinary:
+            _JIT_EMIT(jit, "\x48\x89\xde");             // mov rsi, rbx
+            _JIT_EMIT(jit, "\x49\x83\xc4\x08");         // add r12, 8
+            _JIT_EMIT(jit, "\x49\x8b\x3c\x24");         // mov rdi, [r12]
+            _jit_call_c(jit, (uintptr_t)_entry_at(joforth, (joforth_word_address_t)operand)->_rep._binary);
+            _JIT_EMIT(jit, "\x48\x89\xc3");             // mov rbx, rax
+            break;
+        case kIr_NativeArray:
+        {
+            const _joforth_dict_entry_t* native = _entry_at(joforth, (joforth_word_address_t)operand);
+            _JIT_EMIT(jit, "\x49\x89\x1c\x24");         // mov [r12], rbx
+            _JIT_EMIT(jit, "\x4c\x89\xe7");             // mov rdi, r12
+            _JIT_EMIT(jit, "\xbe");                     // mov esi, depth
+            _jit_emit32(jit, (uint32_t)native->_depth);
+            _jit_call_c(jit, (uintptr_t)native->_rep._array);
+            _JIT_EMIT(jit, "\x49\x8b\x1c\x24");         // mov rbx, [r12]
+        }
+        break;
+        case kIr_Recurse:
+        case kIr_WordPtr:
+        case kIr_TailCall:
+        {
+            const _joforth_dict_entry_t* callee = _entry_at(joforth, (joforth_word_address_t)operand);
+            if (callee->_type != kEntryType_Word) {
+                // prefix words take the next instruction as their argument
+                return false;
+            }
+            const bool tail = op == kIr_TailCall;
+            const uint32_t callee_code = _jit_code_of(joforth, (joforth_word_address_t)operand);
+            if (callee != entry && (callee->_flags & kEntryFlag_Verified) && !(entry->_flags & kEntryFlag_Verified)) {
+                // a verified word is only checked when it's called, which a verified caller has done for it
+                _jit_check_depth(jit, exits, callee->_depth);
+            }
+            if (callee == entry && tail) {
+                _JIT_EMIT(jit, "\xe9");                 // jmp body
+                _jit_emit_rel32(jit, body);
+            }
+            else if (callee == entry || callee_code) {
+                if (tail) {
+                    _jit_leave(jit);
+                    _JIT_EMIT(jit, "\xe9");             // jmp callee
+                }
+                else {
+                    _JIT_EMIT(jit, "\xe8");             // call callee
+                }
+                _jit_emit_rel32(jit, callee == entry ? start : callee_code);
+                if (!tail) {
+                    // the callee may have left more on the stack
+                    _jit_check_room(jit, exits, room);
+                }
+            }
+            else {
+                _JIT_EMIT(jit, "\xbe");                 // mov esi, address
+                _jit_emit32(jit, (uint32_t)operand);
+                _jit_call_helper(jit, (uintptr_t)_jit_word, exits);
+                if (tail) {
+                    _jit_return(jit);
                 }
                 else {
-                    joforth_word_key_t key = pearson_hash(buffer);
-                    _joforth_dict_entry_t* entry = _find_word(joforth, key);
+                    _jit_check_room(jit, exits, room);
+                }
+            }
+        }
+        break;
+
+        case kIr_Plus:
+            _JIT_EMIT(jit, "\x49\x83\xc4\x08");         // add r12, 8
+            _JIT_EMIT(jit, "\x49\x03\x1c\x24");         // add rbx, [r12]
+            break;
+        case kIr_Minus:
+            _jit_pop_nos(jit);
+            _JIT_EMIT(jit, "\x48\x29\xd8");             // sub rax, rbx
+            _JIT_EMIT(jit, "\x48\x89\xc3");             // mov rbx, rax
+            break;
+        case kIr_Mul:
+            _JIT_EMIT(jit, "\x49\x83\xc4\x08");         // add r12, 8
+            _JIT_EMIT(jit, "\x49\x0f\xaf\x1c\x24");     // imul rbx, [r12]
+            break;
+        case kIr_Mod:
+            _jit_pop_nos(jit);
+            _JIT_EMIT(jit, "\x48\x99");                 // cqo
+            _JIT_EMIT(jit, "\x48\xf7\xfb");             // idiv rbx
+            _JIT_EMIT(jit, "\x48\x89\xd3");             // mov rbx, rdx
+            break;
+        case kIr_Lt:
+        case kIr_Gt:
+        case kIr_Eq:
+            _jit_pop_nos(jit);
+            _JIT_EMIT(jit, "\x48\x39\xd8");             // cmp rax, rbx
+            _jit_to_bool(jit, op == kIr_Lt ? "\x0f\x9c\xc0" : (op == kIr_Gt ? "\x0f\x9f\xc0" : "\x0f\x94\xc0"));
+            break;
+        case kIr_Dup:
+            _jit_push(jit);
+            break;
+        case kIr_Drop:
+            _jit_drop(jit);
+            break;
+        case kIr_Swap:
+        case kIr_SwapUnchecked:
+            if (op == kIr_Swap) {
+                _jit_check_depth(jit, exits, 2);
+            }
+            _JIT_EMIT(jit, "\x49\x8b\x44\x24\x08");     // mov rax, [r12 + 8]
+            _JIT_EMIT(jit, "\x49\x89\x5c\x24\x08");     // mov [r12 + 8], rbx
+            _JIT_EMIT(jit, "\x48\x89\xc3");             // mov rbx, rax
+            break;
+        case kIr_Over:
+            _JIT_EMIT(jit, "\x49\x8b\x44\x24\x08");     // mov rax, [r12 + 8]
+            _jit_push(jit);
+            _JIT_EMIT(jit, "\x48\x89\xc3");             // mov rbx, rax
+            break;
+        case kIr_Tuck:
+        case kIr_TuckUnchecked:
+            // a b -- b a b
+            if (op == kIr_Tuck) {
+                _jit_check_depth(jit, exits, 2);
+            }
+            _JIT_EMIT(jit, "\x49\x8b\x44\x24\x08");     // mov rax, [r12 + 8]
+            _JIT_EMIT(jit, "\x49\x89\x04\x24");         // mov [r12], rax
+            _JIT_EMIT(jit, "\x49\x89\x5c\x24\x08");     // mov [r12 + 8], rbx
+            _JIT_EMIT(jit, "\x49\x83\xec\x08");         // sub r12, 8
+            break;
+        case kIr_At:
+            _JIT_EMIT(jit, "\x49\x8b\x5c\x1d\x00");     // mov rbx, [r13 + rbx]
+            break;
+        case kIr_Bang:
+            // value address --
+            _JIT_EMIT(jit, "\x49\x8b\x44\x24\x08");     // mov rax, [r12 + 8]
+            _JIT_EMIT(jit, "\x49\x89\x44\x1d\x00");     // mov [r13 + rbx], rax
+            _JIT_EMIT(jit, "\x49\x83\xc4\x10");         // add r12, 16
+            _JIT_EMIT(jit, "\x49\x8b\x1c\x24");         // mov rbx, [r12]
+            break;
+
+        case kIr_AddImm:
+            _JIT_EMIT(jit, "\x48\x81\xc3");             // add rbx, imm32
+            _jit_emit32(jit, (uint32_t)operand);
+            break;
+        case kIr_LtImm:
+        case kIr_GtImm:
+        case kIr_EqImm:
+            _JIT_EMIT(jit, "\x48\x81\xfb");             // cmp rbx, imm32
+            _jit_emit32(jit, (uint32_t)operand);
+            _jit_to_bool(jit, op == kIr_LtImm ? "\x0f\x9c\xc0" : (op == kIr_GtImm ? "\x0f\x9f\xc0" : "\x0f\x94\xc0"));
+            break;
+        case kIr_ZeroEq:
+            _JIT_EMIT(jit, "\x48\x85\xdb");             // test rbx, rbx
+            _jit_to_bool(jit, "\x0f\x94\xc0");
+            break;
+        case kIr_DupMul:
+            _JIT_EMIT(jit, "\x48\x0f\xaf\xdb");         // imul rbx, rbx
+            break;
+        case kIr_Nip:
+            _JIT_EMIT(jit, "\x49\x83\xc4\x08");         // add r12, 8
+            break;
+        case kIr_OverPlus:
+            _JIT_EMIT(jit, "\x49\x03\x5c\x24\x08");     // add rbx, [r12 + 8]
+            break;
+        default:
+            // including kIr_Yield; native code can't be suspended
+            return false;
+        }
+        i += 1 + operand_size;
+    } while (op != kIr_Null);
+    return true;
+}
+
+// true if entry, or a word it calls which hasn't been compiled, can yield. Native code can't be 
+// suspended, so a word which calls one that yields must stay interpreted as well. budget limits 
+// the number of words looked at, true if they run out
+static bool _jit_may_yield(joforth_t* joforth, const _joforth_dict_entry_t* entry, size_t* budget) {
+    if (!*budget) {
+        return true;
+    }
+    --*budget;
+    const uint8_t* i = _ptr_at(joforth, entry->_rep._ir);
+    _joforth_ir_t op;
+    do {
+        op = (_joforth_ir_t)*i;
+        const size_t operand_size = _ir_operand_size(op);
+        if (op == kIr_Yield) {
+            return true;
+        }
+        if (op == kIr_WordPtr || op == kIr_TailCall) {
+            const joforth_word_address_t address = (joforth_word_address_t)_ir_operand(op, i + 1);
+            const _joforth_dict_entry_t* callee = _entry_at(joforth, address);
+            if (callee != entry && callee->_type == kEntryType_Word && !_jit_code_of(joforth, address) && _jit_may_yield(joforth, callee, budget)) {
+                return true;
+            }
+        }
+        i += 1 + operand_size;
+    } while (op != kIr_Null);
+    return false;
+}
+
+// forgets all native code, for example when the arena is shared or saved, words are compiled again 
+// when they're hot. The table is kept, only emptied
+static void _jit_reset(joforth_t* joforth) {
+    if (joforth->_jit_words) {
+        memset(joforth->_jit_words, 0, joforth->_jit_words_size * sizeof(_joforth_jit_word_t));
+    }
+    joforth->_jit_words_count = 0;
+    if (joforth->_jit) {
+        munmap(joforth->_jit, JOFORTH_JIT_SIZE);
+    }
+    joforth->_jit = 0;
+    joforth->_jit_used = 0;
+}
+
+// maps the region, with the trampoline and the exits at the start
+static bool _jit_create(joforth_t* joforth) {
+    uint8_t* code = (uint8_t*)mmap(0, JOFORTH_JIT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return false;
+    }
+    _joforth_jit_emitter_t jit = { code, 0 };
+    _joforth_jit_exits_t exits;
+    _jit_emit_trampoline(&jit, &exits);
+    if (mprotect(code, JOFORTH_JIT_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, JOFORTH_JIT_SIZE);
+        return false;
+    }
+    joforth->_jit = code;
+    joforth->_jit_used = (jit._at + 15) & ~(size_t)15;
+    return true;
+}
+
+// compiles entry to native code after the code in the region, if it can be. Returns its offset, 
+// or 0 if it can't
+static uint32_t _jit_compile(joforth_t* joforth, const _joforth_dict_entry_t* entry) {
+    size_t budget = 64;
+    if (_jit_may_yield(joforth, entry, &budget) || (!joforth->_jit && !_jit_create(joforth))) {
+        return 0;
+    }
+    _joforth_jit_exits_t exits;
+    _joforth_jit_emitter_t jit = { 0, 0 };
+    _jit_emit_trampoline(&jit, &exits);
+
+    uint32_t code_at[JOFORTH_DEFAULT_IRBUFFER_SIZE];
+    memset(code_at, 0, sizeof(code_at));
+    jit._at = joforth->_jit_used;
+    if (!_jit_translate(joforth, &jit, entry, code_at, &exits) || jit._at > JOFORTH_JIT_SIZE 
+        || mprotect(joforth->_jit, JOFORTH_JIT_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        return 0;
+    }
+    jit._code = joforth->_jit;
+    jit._at = joforth->_jit_used;
+    _jit_translate(joforth, &jit, entry, code_at, &exits);
+    if (mprotect(joforth->_jit, JOFORTH_JIT_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        // we can't run any of it
+        _jit_reset(joforth);
+        return 0;
+    }
+    const uint32_t code = (uint32_t)joforth->_jit_used;
+    joforth->_jit_used = (jit._at + 15) & ~(size_t)15;
+    return code;
+}
+
+// runs the native code at offset code in the region
+static bool _jit_run(joforth_t* joforth, uint32_t code) {
+    bool (*trampoline)(joforth_t* joforth, void* code) = (bool (*)(joforth_t*, void*))(uintptr_t)joforth->_jit;
+    return trampoline(joforth, joforth->_jit + code);
+}
+
+// a clone gets its own copy of the code and of the table, all of which it can use as it is
+static void _jit_clone(joforth_t* dst, const joforth_t* src) {
+    dst->_jit = 0;
+    dst->_jit_depth = 0;
+    if (src->_jit_words) {
+        const size_t words_bytes = src->_jit_words_size * sizeof(_joforth_jit_word_t);
+        dst->_jit_words = (_joforth_jit_word_t*)dst->_allocator._alloc(words_bytes);
+        memcpy(dst->_jit_words, src->_jit_words, words_bytes);
+    }
+    if (src->_jit) {
+        uint8_t* code = (uint8_t*)mmap(0, JOFORTH_JIT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code != MAP_FAILED) {
+            memcpy(code, src->_jit, src->_jit_used);
+            if (mprotect(code, JOFORTH_JIT_SIZE, PROT_READ | PROT_EXEC) == 0) {
+                dst->_jit = code;
+                return;
+            }
+            munmap(code, JOFORTH_JIT_SIZE);
+        }
+        _jit_reset(dst);
+    }
+}
+#endif
+
+// =====================================================================================
+// compile time control flow
+//
+// IF/ELSE/ENDIF, BEGIN/UNTIL, BEGIN/WHILE/REPEAT and DO/LOOP are resolved to relative 
+// branches as the IR is generated, using a small stack of open structures.
+// =====================================================================================
+
+typedef struct _joforth_control_flow {
+    // the keyword which opened the structure
+    _joforth_ir_t   _ir;
+    // IR location of a forward branch offset to resolve, or the target of a backward branch
+    size_t          _at;
+} _joforth_control_flow_t;
+
+#define JOFORTH_MAX_CONTROL_FLOW_NESTING    32
+
+// emit a branch back to target
+static void _ir_emit_branch_to(joforth_t* joforth, _joforth_ir_t ir, size_t target) {
+    _ir_emit(joforth, ir);
+    ptrdiff_t offset = (ptrdiff_t)target - (ptrdiff_t)(joforth->_irw + sizeof(_joforth_ir_offset_t));
+    _ir_emit_offset(joforth, (_joforth_ir_offset_t)offset);
+}
+
+// emit a forward branch, returns the location of its offset which is resolved later
+static size_t _ir_emit_forward_branch(joforth_t* joforth, _joforth_ir_t ir) {
+    _ir_emit(joforth, ir);
+    size_t at = joforth->_irw;
+    _ir_emit_offset(joforth, 0);
+    return at;
+}
+
+// resolve a forward branch to the current IR location
+static void _ir_resolve_branch(joforth_t* joforth, size_t at) {
+    _joforth_ir_offset_t offset = (_joforth_ir_offset_t)(joforth->_irw - (at + sizeof(offset)));
+    memcpy(joforth->_ir_buffer + at, &offset, sizeof(offset));
+}
+
+// emit IR for a language keyword, returns false if it doesn't match an open control flow structure
+static bool _compile_keyword(joforth_t* joforth, _joforth_ir_t ir, _joforth_control_flow_t* cf, size_t* csp) {
+
+    _joforth_control_flow_t* top = *csp ? cf + *csp - 1 : 0;
+    switch (ir) {
+    case kIr_If:
+    case kIr_Begin:
+    case kIr_Do:
+    case kIr_While:
+    {
+        if (*csp == JOFORTH_MAX_CONTROL_FLOW_NESTING || (ir == kIr_While && (!top || top->_ir != kIr_Begin))) {
+            return false;
+        }
+        cf[*csp]._ir = ir;
+        if (ir == kIr_If || ir == kIr_While) {
+            cf[*csp]._at = _ir_emit_forward_branch(joforth, kIr_BranchIfZero);
+        }
+        else {
+            // backward branches go to the next instruction
+            cf[*csp]._at = joforth->_irw;
+        }
+        ++*csp;
+    }
+    break;
+    case kIr_Else:
+    {
+        if (!top || top->_ir != kIr_If) {
+            return false;
+        }
+        // the IF-true block skips the ELSE block, and IF-false goes to it
+        size_t at = _ir_emit_forward_branch(joforth, kIr_Branch);
+        _ir_resolve_branch(joforth, top->_at);
+        top->_ir = kIr_Else;
+        top->_at = at;
+    }
+    break;
+    case kIr_Endif:
+    {
+        if (!top || (top->_ir != kIr_If && top->_ir != kIr_Else)) {
+            return false;
+        }
+        _ir_resolve_branch(joforth, top->_at);
+        --*csp;
+    }
+    break;
+    case kIr_Until:
+    {
+        if (!top || top->_ir != kIr_Begin) {
+            return false;
+        }
+        _ir_emit_branch_to(joforth, kIr_BranchIfZero, top->_at);
+        --*csp;
+    }
+    break;
+    case kIr_Repeat:
+    {
+        if (!top || top->_ir != kIr_While) {
+            return false;
+        }
+        // the WHILE is always preceeded by its BEGIN
+        _ir_emit_branch_to(joforth, kIr_Branch, top[-1]._at);
+        _ir_resolve_branch(joforth, top->_at);
+        *csp -= 2;
+    }
+    break;
+    case kIr_Loop:
+    {
+        if (!top || top->_ir != kIr_Do) {
+            return false;
+        }
+        _ir_emit_branch_to(joforth, kIr_Loop, top->_at);
+        --*csp;
+    }
+    break;
+    case kIr_EndDefineWord:
+    {
+        // everything has to be closed by the end of a word
+        if (*csp) {
+            return false;
+        }
+        _ir_emit(joforth, ir);
+    }
+    break;
+    case kIr_Recurse:
+    {
+        // the entry of the word itself is filled in when it's compiled, see _resolve_recurse
+        _ir_emit(joforth, ir);
+        _ir_emit_address(joforth, 0);
+    }
+    break;
+    default:
+        _ir_emit(joforth, ir);
+        break;
+    }
+    return true;
+}
+
+// =====================================================================================
+// optimisation of compiled words
+//
+// the IR is decoded into a list of instructions, common sequences are fused into 
+// superinstructions, constant expressions are folded and calls in tail position are 
+// turned into jumps. The result is encoded back with branch offsets recalculated.
+// =====================================================================================
+
+#define JOFORTH_MAX_OPTIMISED_INSTRUCTIONS  256
+
+typedef struct _joforth_instruction {
+    _joforth_ir_t       _ir;
+    union {
+        // immediate value or address
+        joforth_value_t _value;
+        // index of the target instruction of a branch
+        size_t          _target;
+    } _operand;
+    // branch targets can't be fused with the instruction before them
+    bool                _is_target;
+    // removed by fusion
+    bool                _is_dead;
+} _joforth_instruction_t;
+
+// decode a kIr_Null terminated IR sequence, returns the number of instructions or 0 if there are too many.
+// literals are all decoded as kIr_Value, _encode picks the most compact form for them again
+static size_t _decode(uint8_t* ir, _joforth_instruction_t* insns, size_t max_insns) {
+    // instruction index by IR location
+    uint16_t index_at[JOFORTH_DEFAULT_IRBUFFER_SIZE];
+    size_t count = 0;
+    uint8_t* i = ir;
+    _joforth_ir_t op;
+    do {
+        if (count == max_insns) {
+            return 0;
+        }
+        op = (_joforth_ir_t)*i;
+        const size_t operand_size = _ir_operand_size(op);
+        index_at[i - ir] = (uint16_t)count;
+        _joforth_instruction_t* insn = insns + count++;
+        memset(insn, 0, sizeof(_joforth_instruction_t));
+        insn->_ir = op;
+        if (_ir_is_branch(op)) {
+            _joforth_ir_offset_t offset;
+            _ir_consume_offset(i + 1, &offset);
+            // resolved to an index below, when we've seen the target
+            insn->_operand._target = (size_t)(i + 1 + operand_size + offset - ir);
+        }
+        else if (operand_size) {
+            insn->_operand._value = _ir_operand(op, i + 1);
+            if (op == kIr_Value8 || op == kIr_Value32) {
+                insn->_ir = kIr_Value;
+            }
+        }
+        i += 1 + operand_size;
+    } while (op != kIr_Null);
+
+    for (size_t n = 0; n < count; ++n) {
+        if (_ir_is_branch(insns[n]._ir)) {
+            insns[n]._operand._target = index_at[insns[n]._operand._target];
+            insns[insns[n]._operand._target]._is_target = true;
+        }
+    }
+    return count;
+}
+
+// encode instructions into the IR buffer, skipping dead ones
+static void _encode(joforth_t* joforth, _joforth_instruction_t* insns, size_t count) {
+    // IR location of each instruction
+    uint16_t location[JOFORTH_MAX_OPTIMISED_INSTRUCTIONS];
+    size_t irw = 0;
+    for (size_t n = 0; n < count; ++n) {
+        if (insns[n]._ir == kIr_Value) {
+            insns[n]._ir = _ir_literal(insns[n]._operand._value);
+        }
+        location[n] = (uint16_t)irw;
+        if (!insns[n]._is_dead) {
+            irw += 1 + _ir_operand_size(insns[n]._ir);
+        }
+    }
+    joforth->_irw = 0;
+    for (size_t n = 0; n < count; ++n) {
+        const _joforth_instruction_t* insn = insns + n;
+        if (insn->_is_dead) {
+            continue;
+        }
+        if (_ir_is_branch(insn->_ir)) {
+            _ir_emit_branch_to(joforth, insn->_ir, location[insn->_operand._target]);
+        }
+        else {
+            _ir_emit(joforth, insn->_ir);
+            _ir_emit_operand(joforth, insn->_ir, insn->_operand._value);
+        }
+    }
+}
+
+// the next live instruction after n, if it can be fused with what's before it
+static _joforth_instruction_t* _next_fusable(_joforth_instruction_t* insns, size_t count, size_t n) {
+    while (++n < count && insns[n]._is_dead);
+    if (n == count || insns[n]._is_target) {
+        return 0;
+    }
+    return insns + n;
+}
+
+// fold a binary operator on two constants, returns false if it can't be folded
+static bool _fold(_joforth_ir_t op, joforth_value_t nos, joforth_value_t tos, joforth_value_t* result) {
+    switch (op) {
+    // wrap around, as the machine does when the word runs, rather than overflow
+    case kIr_Plus:
+        *result = (joforth_value_t)((joforth_uvalue_t)nos + (joforth_uvalue_t)tos);
+        break;
+    case kIr_Minus:
+        *result = (joforth_value_t)((joforth_uvalue_t)nos - (joforth_uvalue_t)tos);
+        break;
+    case kIr_Mul:
+        *result = (joforth_value_t)((joforth_uvalue_t)nos * (joforth_uvalue_t)tos);
+        break;
+    case kIr_Mod:
+        if (!tos || (nos == JOFORTH_VALUE_MIN && tos == -1)) {
+            // leave it to fail (or not) at run time
+            return false;
+        }
+        *result = nos % tos;
+        break;
+    case kIr_Lt:
+        *result = nos < tos ? JOFORTH_TRUE : JOFORTH_FALSE;
+        break;
+    case kIr_Gt:
+        *result = nos > tos ? JOFORTH_TRUE : JOFORTH_FALSE;
+        break;
+    case kIr_Eq:
+        *result = nos == tos ? JOFORTH_TRUE : JOFORTH_FALSE;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// true if instruction n is followed by the end of the word, directly or via branches
+static bool _is_tail_position(const _joforth_instruction_t* insns, size_t count, size_t n) {
+    // limit the number of branches we follow, in case of an endless loop
+    for (size_t hops = 0; hops < 8; ++hops) {
+        while (++n < count && insns[n]._is_dead);
+        if (n == count) {
+            return false;
+        }
+        if (insns[n]._ir == kIr_EndDefineWord) {
+            return true;
+        }
+        if (insns[n]._ir != kIr_Branch) {
+            return false;
+        }
+        // continue from the branch target
+        n = insns[n]._operand._target - 1;
+    }
+    return false;
+}
+
+// turn calls in tail position into jumps, so that they don't use the IR return stack
+static void _eliminate_tail_calls(joforth_t* joforth, _joforth_instruction_t* insns, size_t count) {
+    for (size_t n = 0; n < count; ++n) {
+        _joforth_instruction_t* insn = insns + n;
+        if (insn->_is_dead || !_is_tail_position(insns, count, n)) {
+            continue;
+        }
+        if (insn->_ir == kIr_Recurse) {
+            // jump back to the first instruction after the kIr_DefineWord header
+            insn->_ir = kIr_Branch;
+            insn->_operand._target = 1;
+            insns[1]._is_target = true;
+        }
+        else if (insn->_ir == kIr_WordPtr && _entry_at(joforth, (joforth_word_address_t)insn->_operand._value)->_type == kEntryType_Word) {
+            insn->_ir = kIr_TailCall;
+        }
+    }
+}
+
+// fill in the operand of any recurse in the IR buffer
+static void _resolve_recurse(joforth_t* joforth, _joforth_dict_entry_t* self) {
+    const _joforth_ir_address_t address = _address_of(joforth, self);
+    uint8_t* ir = joforth->_ir_buffer;
+    while (*ir != kIr_Null) {
+        if (*ir == kIr_Recurse) {
+            memcpy(ir + 1, &address, sizeof(address));
+        }
+        ir += 1 + _ir_operand_size((_joforth_ir_t)*ir);
+    }
+}
+
+// optimise the word in the IR buffer, unless it's too big
+static void _optimise(joforth_t* joforth) {
+
+    _joforth_instruction_t insns[JOFORTH_MAX_OPTIMISED_INSTRUCTIONS];
+    const size_t count = _decode(joforth->_ir_buffer, insns, JOFORTH_MAX_OPTIMISED_INSTRUCTIONS);
+    if (!count) {
+        return;
+    }
+
+    bool changed = !(joforth->_options & JOFORTH_OPTION_NO_PEEPHOLE);
+    while (changed) {
+        changed = false;
+        for (size_t n = 0; n < count; ++n) {
+            _joforth_instruction_t* a = insns + n;
+            if (a->_is_dead) {
+                continue;
+            }
+            _joforth_instruction_t* b = _next_fusable(insns, count, n);
+            if (!b) {
+                continue;
+            }
+            _joforth_instruction_t* c = _next_fusable(insns, count, (size_t)(b - insns));
+            const _joforth_ir_t b_op = b->_ir;
+
+            if (a->_ir == kIr_Value && b_op == kIr_Value && c 
+                && _fold(c->_ir, a->_operand._value, b->_operand._value, &a->_operand._value)) {
+                // constant folding; "2 3 +" -> "5"
+                b->_is_dead = c->_is_dead = true;
+            }
+            // immediate operands are 32 bit, so only smaller values can be fused
+            else if (a->_ir == kIr_Value && (b_op == kIr_Plus || b_op == kIr_Minus) 
+                && _ir_fits_int32(a->_operand._value) && a->_operand._value != INT32_MIN) {
+                // "1 +", "1 -"
+                a->_ir = kIr_AddImm;
+                a->_operand._value = b_op == kIr_Plus ? a->_operand._value : -a->_operand._value;
+                b->_is_dead = true;
+            }
+            else if (a->_ir == kIr_Value && b_op == kIr_Eq && _ir_fits_int32(a->_operand._value)) {
+                // "0 =", "3 ="
+                a->_ir = a->_operand._value ? kIr_EqImm : kIr_ZeroEq;
+                b->_is_dead = true;
+            }
+            else if (a->_ir == kIr_Value && (b_op == kIr_Lt || b_op == kIr_Gt) && _ir_fits_int32(a->_operand._value)) {
+                a->_ir = b_op == kIr_Lt ? kIr_LtImm : kIr_GtImm;
+                b->_is_dead = true;
+            }
+            else if (a->_ir == kIr_AddImm && b->_ir == kIr_AddImm 
+                && _ir_fits_int32((joforth_value_t)((joforth_uvalue_t)a->_operand._value + (joforth_uvalue_t)b->_operand._value))) {
+                // "1 + 1 +", which wraps around like the two adds would, as in _fold
+                a->_operand._value = (joforth_value_t)((joforth_uvalue_t)a->_operand._value + (joforth_uvalue_t)b->_operand._value);
+                b->_is_dead = true;
+            }
+            else if (a->_ir == kIr_Dup && b_op == kIr_Mul) {
+                a->_ir = kIr_DupMul;
+                b->_is_dead = true;
+            }
+            else if (a->_ir == kIr_Swap && b_op == kIr_Drop) {
+                a->_ir = kIr_Nip;
+                b->_is_dead = true;
+            }
+            else if (a->_ir == kIr_Over && b_op == kIr_Plus) {
+                a->_ir = kIr_OverPlus;
+                b->_is_dead = true;
+            }
+            else {
+                continue;
+            }
+            changed = true;
+        }
+    }
+
+    _eliminate_tail_calls(joforth, insns, count);
+    _encode(joforth, insns, count);
+}
+
+// =====================================================================================
+// stack effects
+//
+// the effect of IR on the stack is inferred by following every path through it, keeping
+// track of the depth relative to where it started. If every path agrees on the depth at each 
+// instruction and at the end, and the effect of every word it calls is known, then its effect 
+// is known: it needs _in values and leaves _out in their place. Such IR can't underflow as long 
+// as there are _in values on the stack when it starts, so it's checked once instead of at every 
+// instruction; colon words are checked when they're called and sentences before they run.
+// =====================================================================================
+
+typedef struct _joforth_effect {
+    size_t  _in;
+    size_t  _out;
+} _joforth_effect_t;
+
+// the effect declared by a stack comment like "a b -- c", false if the comment isn't one
+static bool _declared_effect(const char* comment, size_t length, _joforth_effect_t* effect) {
+    size_t count[2] = { 0, 0 };
+    size_t side = 0;
+    size_t n = 0;
+    for (;;) {
+        while (n < length && (comment[n] == ' ' || (unsigned char)(comment[n] - 9) < 5)) ++n;
+        if (n == length) {
+            break;
+        }
+        const size_t start = n;
+        while (n < length && comment[n] != ' ' && (unsigned char)(comment[n] - 9) >= 5) ++n;
+        if (n - start == 2 && comment[start] == '-' && comment[start + 1] == '-') {
+            if (side) {
+                return false;
+            }
+            side = 1;
+        }
+        else {
+            ++count[side];
+        }
+    }
+    effect->_in = count[0];
+    effect->_out = count[1];
+    return side == 1;
+}
+
+// true if an inferred effect agrees with the declared one. A comment can name inputs the word 
+// leaves where they are, like "a -- a b", so only the net effect has to be the same
+static bool _is_declared_effect(const _joforth_effect_t* effect, const _joforth_effect_t* declared) {
+    return declared->_in >= effect->_in && declared->_in - declared->_out == effect->_in - effect->_out;
+}
+
+// the effect of calling entry, false if it isn't known
+static bool _call_effect(const _joforth_dict_entry_t* entry, _joforth_effect_t* effect) {
+    if (entry->_type != kEntryType_Word && entry->_type != kEntryType_Native) {
+        // prefix words take the next instruction as their argument
+        return false;
+    }
+    if (entry->_type == kEntryType_Native && entry->_signature != kNativeSignature_Handler) {
+        // typed natives always have an effect which matches their signature
+        effect->_in = entry->_depth;
+        effect->_out = entry->_results;
+        return true;
+    }
+    if (!(entry->_flags & kEntryFlag_Verified)) {
+        return false;
+    }
+    effect->_in = entry->_depth;
+    effect->_out = entry->_results;
+    return true;
+}
+
+// the number of values an instruction which doesn't branch or call pops, and pushes; false if it isn't one
+static bool _ir_effect(_joforth_ir_t op, int32_t* pops, int32_t* pushes) {
+    switch (op) {
+    case kIr_DefineWord:
+    case kIr_Yield:
+        *pops = 0;
+        *pushes = 0;
+        return true;
+    case kIr_True:
+    case kIr_False:
+    case kIr_Value:
+    case kIr_Value8:
+    case kIr_Value32:
+    case kIr_ValuePtr:
+        *pops = 0;
+        *pushes = 1;
+        return true;
+    case kIr_Dot:
+    case kIr_DotDot:
+    case kIr_Drop:
+        *pops = 1;
+        *pushes = 0;
+        return true;
+    case kIr_Invert:
+    case kIr_At:
+    case kIr_AddImm:
+    case kIr_LtImm:
+    case kIr_GtImm:
+    case kIr_EqImm:
+    case kIr_ZeroEq:
+    case kIr_DupMul:
+        *pops = 1;
+        *pushes = 1;
+        return true;
+    case kIr_Dup:
+        *pops = 1;
+        *pushes = 2;
+        return true;
+    case kIr_Plus:
+    case kIr_Minus:
+    case kIr_Mul:
+    case kIr_Mod:
+    case kIr_Lt:
+    case kIr_Gt:
+    case kIr_Eq:
+    case kIr_Nip:
+        *pops = 2;
+        *pushes = 1;
+        return true;
+    case kIr_Swap:
+    case kIr_SwapUnchecked:
+    case kIr_OverPlus:
+        *pops = 2;
+        *pushes = 2;
+        return true;
+    case kIr_Over:
+    case kIr_Tuck:
+    case kIr_TuckUnchecked:
+        *pops = 2;
+        *pushes = 3;
+        return true;
+    case kIr_Bang:
+        *pops = 2;
+        *pushes = 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the depth at an IR location which hasn't been reached (yet)
+#define JOFORTH_UNKNOWN_DEPTH   INT32_MIN
+
+// infers the effect of the kIr_Null terminated IR, returns false if it isn't known. recurse is
+// the effect assumed for kIr_Recurse, i.e. the declared effect of the word, 0 if there is none
+static bool _infer_effect(joforth_t* joforth, const uint8_t* ir, const _joforth_effect_t* recurse, _joforth_effect_t* effect) {
+
+    // the depth at each IR location, relative to the start
+    int32_t depth_at[JOFORTH_DEFAULT_IRBUFFER_SIZE];
+    size_t size = 0;
+    while (ir[size] != kIr_Null) {
+        size += 1 + _ir_operand_size((_joforth_ir_t)ir[size]);
+        if (size >= JOFORTH_DEFAULT_IRBUFFER_SIZE) {
+            return false;
+        }
+    }
+    for (size_t n = 0; n <= size; ++n) {
+        depth_at[n] = JOFORTH_UNKNOWN_DEPTH;
+    }
+    // branch targets which haven't been followed yet
+    uint16_t pending[JOFORTH_DEFAULT_IRBUFFER_SIZE];
+    size_t num_pending = 0;
+    int32_t lowest = 0;
+    int32_t end = JOFORTH_UNKNOWN_DEPTH;
+
+    depth_at[0] = 0;
+    pending[num_pending++] = 0;
+    while (num_pending) {
+        size_t at = pending[--num_pending];
+        for (;;) {
+            const _joforth_ir_t op = (_joforth_ir_t)ir[at];
+            const size_t next = at + 1 + _ir_operand_size(op);
+            int32_t depth = depth_at[at];
+            int32_t pops = 0;
+            int32_t pushes = 0;
+            bool falls_through = true;
+            bool returns = false;
+            if (_ir_is_branch(op)) {
+                // BranchIfZero pops the condition, IfZeroOperator and Loop (when it goes back) leave the stack as it is
+                pops = op == kIr_Loop ? 2 : (op == kIr_Branch ? 0 : 1);
+                pushes = op == kIr_BranchIfZero || op == kIr_Branch ? 0 : pops;
+                falls_through = op != kIr_Branch;
+                const int32_t taken = depth - pops + pushes;
+                const ptrdiff_t target = (ptrdiff_t)next + (ptrdiff_t)_ir_operand(op, ir + at + 1);
+                if (target < 0 || (size_t)target > size) {
+                    return false;
+                }
+                if (depth_at[target] == JOFORTH_UNKNOWN_DEPTH) {
+                    depth_at[target] = taken;
+                    pending[num_pending++] = (uint16_t)target;
+                }
+                else if (depth_at[target] != taken) {
+                    return false;
+                }
+                if (op == kIr_Loop) {
+                    // and drops both when it's done
+                    pushes = 0;
+                }
+            }
+            else {
+                switch (op) {
+                case kIr_Null:
+                case kIr_EndDefineWord:
+                    // the end of a sentence, or of a word (anything after its ";" isn't part of it)
+                    falls_through = false;
+                    returns = true;
+                    break;
+                case kIr_Recurse:
+                    if (!recurse) {
+                        return false;
+                    }
+                    pops = (int32_t)recurse->_in;
+                    pushes = (int32_t)recurse->_out;
+                    break;
+                case kIr_WordPtr:
+                case kIr_TailCall:
+                case kIr_Native:
+                case kIr_NativeUnary:
+                case kIr_NativeBinary:
+                case kIr_NativeArray:
+                {
+                    _joforth_effect_t callee;
+                    if (!_call_effect(_entry_at(joforth, (joforth_word_address_t)_ir_operand(op, ir + at + 1)), &callee)) {
+                        return false;
+                    }
+                    pops = (int32_t)callee._in;
+                    pushes = (int32_t)callee._out;
+                    falls_through = op != kIr_TailCall;
+                    returns = op == kIr_TailCall;
+                }
+                break;
+                default:
+                    if (!_ir_effect(op, &pops, &pushes)) {
+                        return false;
+                    }
+                }
+            }
+            lowest = depth - pops < lowest ? depth - pops : lowest;
+            depth += pushes - pops;
+            if (returns) {
+                if (end != JOFORTH_UNKNOWN_DEPTH && end != depth) {
+                    return false;
+                }
+                end = depth;
+            }
+            if (!falls_through) {
+                break;
+            }
+            if (depth_at[next] != JOFORTH_UNKNOWN_DEPTH) {
+                // been here already, on another path
+                if (depth_at[next] != depth) {
+                    return false;
+                }
+                break;
+            }
+            depth_at[next] = depth;
+            at = next;
+        }
+    }
+    if (end == JOFORTH_UNKNOWN_DEPTH) {
+        return false;
+    }
+    effect->_in = (size_t)-lowest;
+    effect->_out = (size_t)(end - lowest);
+    return true;
+}
+
+// switch swap and tuck in IR between the forms which check the stack and those which don't
+static void _ir_set_checks(uint8_t* ir, size_t size, bool checked) {
+    for (size_t n = 0; n < size; n += 1 + _ir_operand_size((_joforth_ir_t)ir[n])) {
+        if (ir[n] == kIr_Swap || ir[n] == kIr_SwapUnchecked) {
+            ir[n] = checked ? kIr_Swap : kIr_SwapUnchecked;
+        }
+        else if (ir[n] == kIr_Tuck || ir[n] == kIr_TuckUnchecked) {
+            ir[n] = checked ? kIr_Tuck : kIr_TuckUnchecked;
+        }
+    }
+}
+
+// the check IR whose effect is known needs before it runs, fails if there are fewer than in values on the stack
+static bool _is_deep_enough(joforth_t* joforth, size_t in) {
+    if (joforth_stack_depth(joforth) < in) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+    return true;
+}
+
+// =====================================================================================
+// inlining
+// =====================================================================================
+
+// the largest body, in bytes of IR, which is automatically inlined
+#define JOFORTH_INLINE_THRESHOLD    32
+
+// returns the body of a word, without the DefineWord header and ";", if it should be inlined
+static const uint8_t* _inline_body(joforth_t* joforth, _joforth_dict_entry_t* entry, size_t* size) {
+    const bool forced = (entry->_flags & kEntryFlag_Inline) != 0;
+    if ((entry->_flags & kEntryFlag_NoInline) || (!forced && (joforth->_options & JOFORTH_OPTION_NO_INLINE))) {
+        return 0;
+    }
+    const uint8_t* body = _ptr_at(joforth, entry->_rep._ir) + 1 + sizeof(_joforth_ir_address_t);
+    const uint8_t* ir = body;
+    while (*ir != kIr_EndDefineWord) {
+        if (*ir == kIr_Recurse) {
+            // recurse would refer to the caller
+            return 0;
+        }
+        ir += 1 + _ir_operand_size((_joforth_ir_t)*ir);
+    }
+    *size = (size_t)(ir - body);
+    if ((!forced && *size > JOFORTH_INLINE_THRESHOLD) || joforth->_irw + *size >= joforth->_ir_buffer_size - 1) {
+        return 0;
+    }
+    return body;
+}
+
+// copy the body of an inlined word into the IR buffer
+static void _ir_emit_inline(joforth_t* joforth, const uint8_t* body, size_t size) {
+    // copy the body as-is, branch offsets are relative so they still work
+    uint8_t* ir = joforth->_ir_buffer + joforth->_irw;
+    memcpy(ir, body, size);
+    joforth->_irw += size;
+    // the caller may not be verified, in which case the body has to check the stack itself
+    _ir_set_checks(ir, size, true);
+    // but tail calls are not in tail position anymore
+    const uint8_t* end = ir + size;
+    while (ir < end) {
+        if (*ir == kIr_TailCall) {
+            *ir = kIr_WordPtr;
+        }
+        ir += 1 + _ir_operand_size((_joforth_ir_t)*ir);
+    }
+}
+
+// =====================================================================================
+// phase 1: convert the input text to a stream of IR codes in the IR buffer
+// for words being compiled this also returns the comment, if any, and the kEntryFlag_xxx 
+// flags for the new entry
+// =====================================================================================
+static bool _parse(joforth_t* joforth, const char* word, _joforth_eval_mode_t* mode_, const char** comment_, uint32_t* entry_flags_) {
+
+    word = _skip_whitespace(word);
+    if (word[0] == 0) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    _joforth_eval_mode_t mode = (word[0] == ':') ? kEvalMode_Compiling : kEvalMode_Interpreting;
+
+    // the current token, a view into the input
+    const char* token = 0;
+    size_t length;
+    // reset!
+    joforth->_irw = 0;
+
+    // comment (if any); we'll use it if we're compiling
+    const char* comment = 0;
+
+    if (mode == kEvalMode_Compiling) {
+
+        _ir_emit(joforth, kIr_DefineWord);
+        // skip ":"
+        word++;
+        // we expect the identifier to be next
+        word = _next_word(joforth, word, &token, &length, 0);
+        if (!word || _JO_FAILED(joforth->_status)) {
+            return false;
+        }
+        _ir_emit_address(joforth, _copy_name(joforth, token, length));
+    }
+
+    word = _next_word(joforth, word, &token, &length, &comment);
+    if (!word || _JO_FAILED(joforth->_status)) {
+        return false;
+    }
+
+    // =====================================================================================
+    // phase 1: convert the input text to a stream of IR codes    
+    // count words
+    // =====================================================================================
+
+    size_t word_count = 0;
+    size_t target_word_count = 0;   //< used when we parse prefix words    
+    // open control flow structures
+    _joforth_control_flow_t control_flow[JOFORTH_MAX_CONTROL_FLOW_NESTING];
+    size_t csp = 0;
+    // location of the offset of a ? operator which skips the next word
+    size_t if_zero_at = 0;
+    // kEntryFlag_xxx for the word being compiled
+    uint32_t entry_flags = 0;
+    do {
+
+        if (target_word_count && word_count >= target_word_count) {
+            // this word will be passed, as-is, on the stack to feed a previous 
+            // PREFIX word (see kWordType_Prefix)
+            _ir_emit(joforth, kIr_ValuePtr);
+            _ir_emit_address(joforth, _copy_name(joforth, token, length));
+            target_word_count = word_count > target_word_count ? target_word_count : 0;
+        }
+        else {
+            // language keywords live in the dictionary as well, so one lookup covers both
+            _joforth_dict_entry_t* entry = _find_word(joforth, token, length);
+            const bool is_language_keyword = entry && entry->_type == kEntryType_Keyword;
+            if (is_language_keyword) {
+                const _joforth_ir_t ir = (_joforth_ir_t)entry->_rep._value;
+                if (ir == kIr_Recurse && mode != kEvalMode_Compiling) {
+                    // nothing to recurse into
+                    joforth->_status = _JO_STATUS_INVALID_INPUT;
+                    return false;
+                }
+                if (ir == kIr_Inline || ir == kIr_NoInline) {
+                    // inline control for the word being compiled
+                    if (mode != kEvalMode_Compiling) {
+                        joforth->_status = _JO_STATUS_INVALID_INPUT;
+                        return false;
+                    }
+                    entry_flags = ir == kIr_Inline ? kEntryFlag_Inline : kEntryFlag_NoInline;
+                }
+                else if (!_compile_keyword(joforth, ir, control_flow, &csp)) {
+                    // unbalanced control flow
+                    joforth->_status = _JO_STATUS_INVALID_INPUT;
+                    return false;
+                }
+            }
+            if (!is_language_keyword) {
+                // then check for special symbols that we can interpret directly
+                if (token[0] == '.') {
+                    // . or .SomeString or ."SomeString"
+                    if (length > 1) {
+                        // print a string foll
+                        size_t start = 1;
+                        size_t end = 2;
+                        if (token[start] == '\"') {
+                            start = 2;
+                            end = 3;
+                        }
+                        while (end < length && token[end] != '\"') ++end;
+                        if (start < end) {
+                            // emit "dot" and put the allocated string on the value stack 
+                            uint8_t* memory = _alloc(joforth, end - start + 1);
+                            memcpy(memory, token + start, end - start);
+                            memory[end - start] = 0;
+                            _ir_emit(joforth, kIr_ValuePtr);
+                            _ir_emit_address(joforth, _address_of(joforth, memory));
+                            _ir_emit(joforth, kIr_DotDot);
+                        }
+                    }
+                    else {
+                        // just a dot
+                        _ir_emit(joforth, kIr_Dot);
+                    }
+                }
+                else if (token[0] == '?') {
+                    //TODO: Forth uses this for other things as well, so this shoud 
+                    //      be changed to just a special prefix operator and then interpreted 
+                    //      during IR execution
+
+                    // ? prefix (if zero)
+                    if (length > 1) {
+                        // what follows will be executed if and only if tos!=0
+                        if_zero_at = _ir_emit_forward_branch(joforth, kIr_IfZeroOperator);
+                        // drop the leading ? from the token so that we can continune as if nothing happened...
+                        ++token;
+                        --length;
+                        continue;
+                    }
+                    else {
+                        // just a ? isn't enough...
+                        joforth->_status = _JO_STATUS_INVALID_INPUT;
+                        return false;
+                    }
+                }
+                else {
+                    // the stack depth is checked once the whole sentence is compiled, see _infer_effect
+                    if (entry) {
+
+                        switch (entry->_type) {
+                        case kEntryType_Prefix:
+                        {
+                            assert(entry->_depth < 2);
+                            _ir_emit(joforth, kIr_WordPtr);
+                            _ir_emit_address(joforth, _address_of(joforth, entry));
+                            // this word + param count
+                            target_word_count = word_count + entry->_depth;
+                        }
+                        break;
+                        case kEntryType_Native:
+                            if (entry->_primitive) {
+                                _ir_emit(joforth, (_joforth_ir_t)entry->_primitive);
+                            }
+                            else {
+                                static const _joforth_ir_t _native_ir[] = {
+                                    [kNativeSignature_Handler] = kIr_Native,
+                                    [kNativeSignature_Unary] = kIr_NativeUnary,
+                                    [kNativeSignature_Binary] = kIr_NativeBinary,
+                                    [kNativeSignature_Array] = kIr_NativeArray,
+                                };
+                                _ir_emit(joforth, _native_ir[entry->_signature]);
+                                _ir_emit_address(joforth, _address_of(joforth, entry));
+                            }
+                            break;
+                        case kEntryType_Word:
+                        {
+                            size_t body_size;
+                            const uint8_t* body = _inline_body(joforth, entry, &body_size);
+                            if (body) {
+                                _ir_emit_inline(joforth, body, body_size);
+                            }
+                            else {
+                                _ir_emit(joforth, kIr_WordPtr);
+                                _ir_emit_address(joforth, _address_of(joforth, entry));
+                            }
+                        }
+                        break;
+                        case kEntryType_Value:
+                            _ir_emit_literal(joforth, entry->_rep._value);
+                            break;
+                        default:;
+                        }
+                    }
+                    else {
+                        joforth_value_t value = _str_to_value(joforth, token, length);
+                        if (_JO_FAILED(joforth->_status)) {
+                            _ir_emit(joforth, kIr_ValuePtr);
+                            _ir_emit_address(joforth, _copy_name(joforth, token, length));
+                            joforth->_status = _JO_STATUS_SUCCESS;
+                        }
+                        else {
+                            _ir_emit_literal(joforth, value);
+                        }
+                    }
+                }
+            }
+        }
+        if (if_zero_at) {
+            // skip to here
+            _ir_resolve_branch(joforth, if_zero_at);
+            if_zero_at = 0;
+        }
+        ++word_count;
+        word = _next_word(joforth, word, &token, &length, 0);
+
+    } while (length);
+
+    if (csp) {
+        // unbalanced control flow
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    // terminate the ir buffer properly
+    _ir_emit(joforth, kIr_Null);
+
+    *mode_ = mode;
+    *comment_ = comment;
+    *entry_flags_ = entry_flags;
+    return true;
+}
+
+// phase 2 for a word definition; adds the word in the IR buffer to the dictionary
+static bool _define_word(joforth_t* joforth, const char* comment, uint32_t entry_flags) {
+
+    uint8_t* irbuffer = joforth->_ir_buffer;
+
+    // for self reference, i.e. "recurse"
+    _joforth_dict_entry_t* self = 0;
+    _joforth_ir_t ir;
+    irbuffer = _ir_consume(irbuffer, &ir);
+    assert(ir == kIr_DefineWord);
+    _joforth_ir_address_t id_address;
+    irbuffer = _ir_consume_address(irbuffer, &id_address);
+    const char* id = _string_at(joforth, id_address);
+    self = _find_word(joforth, id, strlen(id));
+    if (self) {
+        // already exists
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+    // the effect the comment declares, if it is a stack comment
+    size_t comment_length = 0;
+    _joforth_effect_t declared;
+    bool is_declared = false;
+    if (comment) {
+        while (comment[comment_length] != ')') ++comment_length;
+        is_declared = _declared_effect(comment, comment_length, &declared);
+    }
+    _optimise(joforth);
+    // the word ends at its ";", anything after it is ignored
+    size_t size = 0;
+    while (size < joforth->_irw && joforth->_ir_buffer[size] != kIr_EndDefineWord && joforth->_ir_buffer[size] != kIr_Null) {
+        size += 1 + _ir_operand_size((_joforth_ir_t)joforth->_ir_buffer[size]);
+    }
+    if (size >= joforth->_irw || joforth->_ir_buffer[size] != kIr_EndDefineWord) {
+        // no ";"
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+    ++size;
+    joforth->_ir_buffer[size] = kIr_Null;
+    joforth->_irw = size + 1;
+    // a word whose effect we know must do what it says, which also catches callers with too few arguments
+    _joforth_effect_t effect;
+    const bool is_verified = _infer_effect(joforth, joforth->_ir_buffer, is_declared ? &declared : 0, &effect);
+    if (is_verified && is_declared && !_is_declared_effect(&effect, &declared)) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    self = _add_entry(joforth, id);
+    self->_flags = entry_flags;
+    if (comment) {
+        char* doc_copy = (char*)_alloc(joforth, comment_length + 1);
+        memcpy(doc_copy, comment, comment_length);
+        doc_copy[comment_length] = 0;
+        self->_doc = _address_of(joforth, doc_copy);
+    }
+    if (is_verified) {
+        self->_flags |= kEntryFlag_Verified;
+        self->_depth = (uint32_t)effect._in;
+        self->_results = (uint32_t)effect._out;
+        _ir_set_checks(joforth->_ir_buffer, joforth->_irw, false);
+    }
+    else if (is_declared) {
+        // unchecked, it's up to the word
+        self->_depth = (uint32_t)declared._in;
+        self->_results = (uint32_t)declared._out;
+    }
+    _resolve_recurse(joforth, self);
+    // the word is already compiled at this point so we just need to store the IR for it and we're done
+    self->_type = kEntryType_Word;
+    uint8_t* code_ir = _alloc(joforth, joforth->_irw);
+    memcpy(code_ir, joforth->_ir_buffer, joforth->_irw);
+    self->_rep._ir = _address_of(joforth, code_ir);
+#if defined(JOFORTH_THREADED_CODE)
+    // pre-translate to threaded code once, the IR is kept around for "see"
+    _joforth_cell_t* code = (_joforth_cell_t*)_alloc_aligned(joforth, _translate(joforth, 0, code_ir) * sizeof(_joforth_cell_t), _Alignof(_joforth_cell_t));
+    _translate(joforth, code, code_ir);
+    self->_code = _address_of(joforth, code);
+#endif
+    return true;
+}
+
+// =====================================================================================
+// prepared statements
+// =====================================================================================
+
+struct _joforth_statement {
+    // the dictionary generation and base it was compiled with, see _lookup_statement
+    size_t                  _generation;
+    int                     _base;
+    // the stack depth it needs if its effect is known, see _infer_effect, otherwise SIZE_MAX
+    size_t                  _in;
+    // IR, terminated with kIr_Null
+    uint8_t*                _ir;
+#if defined(JOFORTH_THREADED_CODE)
+    _joforth_cell_t*        _code;
+#endif
+};
+
+// copies the interpreted sentence in the IR buffer into a new statement
+static joforth_statement_t* _new_statement(joforth_t* joforth) {
+    size_t size = sizeof(joforth_statement_t) + joforth->_irw;
+#if defined(JOFORTH_THREADED_CODE)
+    // the cells go first so that they're aligned
+    const size_t cells = _translate(joforth, 0, joforth->_ir_buffer);
+    size += cells * sizeof(_joforth_cell_t);
+#endif
+    joforth_statement_t* statement = (joforth_statement_t*)joforth->_allocator._alloc(size);
+    statement->_generation = joforth->_dict_generation;
+    statement->_base = joforth->_base;
+    _joforth_effect_t effect;
+    statement->_in = SIZE_MAX;
+    if (_infer_effect(joforth, joforth->_ir_buffer, 0, &effect)) {
+        statement->_in = effect._in;
+        _ir_set_checks(joforth->_ir_buffer, joforth->_irw, false);
+    }
+    uint8_t* data = (uint8_t*)(statement + 1);
+#if defined(JOFORTH_THREADED_CODE)
+    statement->_code = (_joforth_cell_t*)data;
+    _translate(joforth, statement->_code, joforth->_ir_buffer);
+    data += cells * sizeof(_joforth_cell_t);
+#endif
+    statement->_ir = data;
+    memcpy(statement->_ir, joforth->_ir_buffer, joforth->_irw);
+    return statement;
+}
+
+static bool _exec_statement(joforth_t* joforth, const joforth_statement_t* statement) {
+    if (statement->_in != SIZE_MAX && !_is_deep_enough(joforth, statement->_in)) {
+        return false;
+    }
+#if defined(JOFORTH_THREADED_CODE)
+    return _run(joforth, statement->_code);
+#else
+    return _run(joforth, statement->_ir);
+#endif
+}
+
+joforth_statement_t* joforth_compile(joforth_t* joforth, const char* sentence) {
+
+    if (!_is_runnable(joforth))
+        return 0;
+
+    _joforth_eval_mode_t mode;
+    const char* comment;
+    uint32_t entry_flags;
+    if (!_parse(joforth, sentence, &mode, &comment, &entry_flags)) {
+        return 0;
+    }
+    if (mode == kEvalMode_Compiling) {
+        // only sentences which are executed can be prepared, use joforth_eval for definitions
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return 0;
+    }
+    return _new_statement(joforth);
+}
+
+bool    joforth_exec(joforth_t* joforth, const joforth_statement_t* statement) {
+
+    if (!_is_runnable(joforth))
+        return false;
+
+    return _exec_statement(joforth, statement);
+}
+
+void    joforth_free_statement(joforth_t* joforth, joforth_statement_t* statement) {
+    if (statement) {
+        joforth->_allocator._free(statement);
+    }
+}
+
+// =====================================================================================
+// calling words directly from the host
+// =====================================================================================
+
+joforth_word_t joforth_find(joforth_t* joforth, const char* name) {
+    _joforth_dict_entry_t* entry = _find_word(joforth, name, strlen(name));
+    if (entry && (entry->_type == kEntryType_Prefix || entry->_type == kEntryType_Keyword)) {
+        // these only make sense in a sentence
+        return 0;
+    }
+    return entry;
+}
+
+bool    joforth_call(joforth_t* joforth, joforth_word_t word, 
+            const joforth_value_t* args, size_t nargs, 
+            joforth_value_t* results, size_t nresults) {
+
+    if (!_is_runnable(joforth))
+        return false;
+
+    if (nargs > joforth->_sp) {
+        joforth->_status = _JO_STATUS_RESOURCE_EXHAUSTED;
+        return false;
+    }
+    // args[0] is pushed first, i.e. args[nargs-1] ends up on top
+    for (size_t n = 0; n < nargs; ++n) {
+        joforth->_stack[joforth->_sp - n] = args[n];
+    }
+    joforth->_sp -= nargs;
+
+    switch (word->_type) {
+    case kEntryType_Word:
+        if ((word->_flags & kEntryFlag_Verified) && !_is_deep_enough(joforth, word->_depth)) {
+            // nothing ran, so take the arguments back off
+            joforth->_sp += nargs;
+            return false;
+        }
+        if (!_run(joforth, _JO_CODE(joforth->_memory, word))) {
+            return false;
+        }
+        break;
+    case kEntryType_Native:
+        switch (word->_signature) {
+        case kNativeSignature_Unary:
+            joforth_push_value(joforth, word->_rep._unary(joforth_pop_value(joforth)));
+            break;
+        case kNativeSignature_Binary:
+        {
+            joforth_value_t b = joforth_pop_value(joforth);
+            joforth_value_t a = joforth_pop_value(joforth);
+            joforth_push_value(joforth, word->_rep._binary(a, b));
+        }
+        break;
+        case kNativeSignature_Array:
+            _JOFORTH_CHECK(joforth_stack_depth(joforth) >= word->_depth);
+            word->_rep._array(joforth->_stack + joforth->_sp + 1, word->_depth);
+            break;
+        default:
+            word->_rep._handler(joforth);
+            if (_JO_FAILED(joforth->_status)) {
+                return false;
+            }
+        }
+        break;
+    case kEntryType_Value:
+        joforth_push_value(joforth, word->_rep._value);
+        break;
+    default:
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    // results[nresults-1] is the top of the stack
+    const size_t depth = joforth_stack_depth(joforth);
+    if (nresults > depth) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+    for (size_t n = 0; n < nresults; ++n) {
+        results[nresults - 1 - n] = joforth->_stack[joforth->_sp + 1 + n];
+    }
+    joforth->_sp += nresults;
+    return true;
+}
+
+bool    joforth_resume(joforth_t* joforth) {
+
+    if (!joforth->_suspended || _JO_FAILED(joforth->_status)) {
+        return false;
+    }
+    joforth->_suspended = false;
+    joforth->_fuel_left = joforth->_fuel ? joforth->_fuel : SIZE_MAX;
+    joforth->_running = 1;
+    const bool result = _execute(joforth, (_joforth_ip_t)joforth->_resume_ip, joforth->_resume_irp, 0);
+    joforth->_running = 0;
+    return result;
+}
+
+void    joforth_cancel(joforth_t* joforth) {
+    if (joforth->_suspended) {
+        // drop the calls it was in the middle of
+        joforth->_irp = joforth->_resume_irp;
+        joforth->_suspended = false;
+        joforth->_resume_ip = 0;
+    }
+}
+
+// =====================================================================================
+// the joforth_eval statement cache
+//
+// a small LRU cache of statements keyed by the source text. Statements are compiled 
+// against the dictionary and the base at the time so they're recompiled if either 
+// has changed since.
+// =====================================================================================
+
+static void _free_cached_statement(joforth_t* joforth, _joforth_cached_statement_t* cached) {
+    joforth->_allocator._free(cached->_source);
+    joforth_free_statement(joforth, cached->_statement);
+    memset(cached, 0, sizeof(_joforth_cached_statement_t));
+}
+
+// returns the statement for sentence from the cache, compiling (and caching) it if needed.
+// definitions aren't cached; they're parsed and returned as for _parse with a 0 statement
+static joforth_statement_t* _lookup_statement(joforth_t* joforth, const char* sentence, 
+        _joforth_eval_mode_t* mode, const char** comment, uint32_t* entry_flags) {
+
+    *mode = kEvalMode_Interpreting;
+    _joforth_cached_statement_t* cache = joforth->_statement_cache;
+    const size_t length = strlen(sentence);
+    const joforth_word_key_t key = _pearson_hash(sentence, length);
+    const size_t now = ++joforth->_statement_cache_time;
+
+    _joforth_cached_statement_t* lru = cache;
+    for (size_t n = 0; n < joforth->_statement_cache_size; ++n) {
+        _joforth_cached_statement_t* cached = cache + n;
+        if (cached->_used && cached->_key == key && strcmp(cached->_source, sentence) == 0) {
+            if (cached->_statement->_generation != joforth->_dict_generation || cached->_statement->_base != joforth->_base) {
+                // stale
+                _free_cached_statement(joforth, cached);
+                lru = cached;
+                break;
+            }
+            cached->_used = now;
+            return cached->_statement;
+        }
+        if (cached->_used < lru->_used) {
+            lru = cached;
+        }
+    }
+
+    if (!_parse(joforth, sentence, mode, comment, entry_flags)) {
+        *mode = kEvalMode_Interpreting;
+        return 0;
+    }
+    if (*mode == kEvalMode_Compiling) {
+        // definitions are only run once, the caller takes it from here
+        return 0;
+    }
+
+    if (lru->_used) {
+        _free_cached_statement(joforth, lru);
+    }
+    lru->_key = key;
+    lru->_used = now;
+    lru->_source = (char*)joforth->_allocator._alloc(length + 1);
+    memcpy(lru->_source, sentence, length + 1);
+    lru->_statement = _new_statement(joforth);
+    return lru->_statement;
+}
+
+bool    joforth_eval(joforth_t* joforth, const char* word) {
+
+    if (!_is_runnable(joforth))
+        return false;
+
+    _joforth_eval_mode_t mode;
+    const char* comment;
+    uint32_t entry_flags;
+
+    if (joforth->_statement_cache) {
+        const joforth_statement_t* statement = _lookup_statement(joforth, word, &mode, &comment, &entry_flags);
+        if (statement) {
+            return _exec_statement(joforth, statement);
+        }
+        if (mode != kEvalMode_Compiling) {
+            return false;
+        }
+        // a definition, which has been parsed already
+        return _define_word(joforth, comment, entry_flags);
+    }
+
+    if (!_parse(joforth, word, &mode, &comment, &entry_flags)) {
+        return false;
+    }
+
+    // =====================================================================================
+    // phase 2: interpret or compile
+    // =====================================================================================
+
+    if (mode == kEvalMode_Compiling) {
+        return _define_word(joforth, comment, entry_flags);
+    }
+
+    // a sentence whose effect is known is rejected before any of it runs if the stack isn't deep enough
+    _joforth_effect_t effect;
+    if (_infer_effect(joforth, joforth->_ir_buffer, 0, &effect)) {
+        if (!_is_deep_enough(joforth, effect._in)) {
+            return false;
+        }
+        _ir_set_checks(joforth->_ir_buffer, joforth->_irw, false);
+    }
+
+#if defined(JOFORTH_THREADED_CODE)
+    assert(_translate(joforth, 0, joforth->_ir_buffer) <= joforth->_ir_buffer_size);
+    _translate(joforth, joforth->_code_buffer, joforth->_ir_buffer);
+    return _run(joforth, joforth->_code_buffer);
+#else
+    return _run(joforth, joforth->_ir_buffer);
+#endif
+}
+
+// =====================================================================================
+// cloning
+// =====================================================================================
+
+// points the buffers of dst, which has a copy of the arena of src, at its own copy
+static void _rebase_buffers(joforth_t* dst, const joforth_t* src) {
+    dst->_stack = (joforth_value_t*)(dst->_memory + ((uint8_t*)src->_stack - src->_memory));
+    dst->_ir_buffer = dst->_memory + (src->_ir_buffer - src->_memory);
+#if defined(JOFORTH_THREADED_CODE)
+    dst->_code_buffer = (_joforth_cell_t*)(dst->_memory + ((uint8_t*)src->_code_buffer - src->_memory));
+#endif
+    dst->_irstack = (uint8_t**)(dst->_memory + ((uint8_t*)src->_irstack - src->_memory));
+    dst->_irp = dst->_irstack_size - 1;
+}
+
+bool    joforth_clone(joforth_t* dst, const joforth_t* src) {
+
+    if (_JO_FAILED(src->_status) || src->_frozen || src->_suspended) {
+        // a frozen VM is shared with joforth_attach instead, and a suspended one refers to itself
+        dst->_status = _JO_FAILED(src->_status) ? src->_status : _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    // everything in the arena is relative to it, and the clone is in the same process so that 
+    // natives and threaded code are bound already. All we need is a copy of the used part
+    *dst = *src;
+    dst->_memory = (uint8_t*)dst->_allocator._alloc(dst->_memory_size);
+    dst->_memory_mapped = 0;
+    memcpy(dst->_memory, src->_memory, src->_mp);
+    _rebase_buffers(dst, src);
+
+    // and the dictionary table (an overlay shares its parent's, like dst does)
+    const size_t dict_bytes = src->_dict_size * sizeof(_joforth_dict_slot_t);
+    dst->_dict = (_joforth_dict_slot_t*)dst->_allocator._alloc(dict_bytes);
+    memcpy(dst->_dict, src->_dict, dict_bytes);
+#if defined(JOFORTH_JIT)
+    _jit_clone(dst, src);
+#endif
+
+    // the clone starts with an empty statement cache of its own
+    _initialise_statement_cache(dst);
+    return true;
+}
+
+// =====================================================================================
+// VM images
+//
+// an image is a header followed by the used part of the arena and the dictionary table. 
+// Everything in the arena refers to everything else by address so it can be loaded 
+// anywhere, only native function pointers and threaded code handlers have to be bound 
+// to the process which loads it. The arena is aligned in the file so that it can be 
+// mapped rather than read.
+// =====================================================================================
+
+#define JOFORTH_IMAGE_VERSION       3
+// alignment of the arena in an image file, it's mapped if this is a multiple of the page size
+#define JOFORTH_IMAGE_ALIGNMENT     0x1000
+
+typedef struct _joforth_image_header {
+    char        _magic[8];
+    uint32_t    _version;
+    // the build configuration, an image can only be loaded by a compatible build
+    uint32_t    _value_size;
+    uint32_t    _entry_size;
+    uint32_t    _threaded;
+    // address of the threaded code handlers in the process which saved the image, 0 if not threaded
+    uint64_t    _labels;
+    // file offsets
+    uint64_t    _arena_offset;
+    uint64_t    _dict_offset;
+    // VM state
+    uint64_t    _memory_size;
+    uint64_t    _mp;
+    uint64_t    _dict_size;
+    uint64_t    _dict_count;
+    uint64_t    _dict_generation;
+    uint64_t    _stack_size;
+    uint64_t    _sp;
+    uint64_t    _ir_buffer_size;
+    uint64_t    _irstack_size;
+    joforth_word_address_t _stack;
+    joforth_word_address_t _ir_buffer;
+    joforth_word_address_t _code_buffer;
+    joforth_word_address_t _irstack;
+    joforth_word_address_t _latest;
+    uint32_t    _options;
+    int32_t     _base;
+} _joforth_image_header_t;
+
+static const char _image_magic[8] = "joForth";
+
+static _JO_ALWAYS_INLINE size_t _image_align(size_t size) {
+    return (size + JOFORTH_IMAGE_ALIGNMENT - 1) & ~(size_t)(JOFORTH_IMAGE_ALIGNMENT - 1);
+}
+
+static uint64_t _engine_labels(void) {
+#if defined(JOFORTH_THREADED_CODE)
+    const void* const* labels;
+    _execute(0, 0, 0, &labels);
+    return (uint64_t)(uintptr_t)labels[kIr_Null];
+#else
+    return 0;
+#endif
+}
+
+static bool _write_padding(FILE* file, size_t bytes) {
+    static const uint8_t zeros[JOFORTH_IMAGE_ALIGNMENT];
+    assert(bytes < JOFORTH_IMAGE_ALIGNMENT);
+    return fwrite(zeros, 1, bytes, file) == bytes;
+}
+
+// adds the words of layer to the table of flat, after those of its parents so that it shadows them
+static void _flatten_layer(joforth_t* flat, const joforth_t* layer) {
+    if (layer->_parent) {
+        _flatten_layer(flat, layer->_parent);
+    }
+    for (size_t n = 0; n < layer->_dict_size; ++n) {
+        const _joforth_dict_slot_t* slot = layer->_dict + n;
+        if (slot->_length) {
+            _joforth_dict_slot_t* flat_slot = _dict_slot(flat, _string_at(flat, _entry_at(flat, slot->_entry)->_word), slot->_length, slot->_key);
+            flat->_dict_count += !flat_slot->_length;
+            *flat_slot = *slot;
+        }
+    }
+}
+
+// the dictionary of an overlay and all of its parents in one table, flat shares the arena of joforth
+static void _flatten_dict(const joforth_t* joforth, joforth_t* flat) {
+    *flat = *joforth;
+    flat->_parent = 0;
+    flat->_dict = 0;
+    flat->_dict_size = 0;
+    flat->_dict_count = 0;
+    size_t count = 0;
+    for (const joforth_t* layer = joforth; layer; layer = layer->_parent) {
+        count += layer->_dict_count;
+    }
+    size_t size = JOFORTH_DICT_INITIAL_SIZE;
+    while (4 * count > 3 * size) {
+        size *= 2;
+    }
+    _dict_grow(flat, size);
+    _flatten_layer(flat, joforth);
+}
+
+bool    joforth_save_image(joforth_t* joforth, const char* path) {
+
+    if (_JO_FAILED(joforth->_status))
+        return false;
+    if (joforth->_suspended) {
+        // where it would resume isn't in the arena
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    // an overlay is saved with everything it has from its parents, as a VM of its own
+    joforth_t flat;
+    if (joforth->_parent) {
+        _flatten_dict(joforth, &flat);
+    }
+    const joforth_t* dict = joforth->_parent ? &flat : joforth;
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    _joforth_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header._magic, _image_magic, sizeof(header._magic));
+    header._version = JOFORTH_IMAGE_VERSION;
+    header._value_size = sizeof(joforth_value_t);
+    header._entry_size = sizeof(_joforth_dict_entry_t);
+#if defined(JOFORTH_THREADED_CODE)
+    header._threaded = 1;
+#endif
+    header._labels = _engine_labels();
+    const size_t arena_size = _image_align(joforth->_mp);
+    header._arena_offset = _image_align(sizeof(header));
+    header._dict_offset = header._arena_offset + arena_size;
+    header._memory_size = joforth->_memory_size;
+    header._mp = joforth->_mp;
+    header._dict_size = dict->_dict_size;
+    header._dict_count = dict->_dict_count;
+    header._dict_generation = joforth->_dict_generation;
+    header._stack_size = joforth->_stack_size;
+    header._sp = joforth->_sp;
+    header._ir_buffer_size = joforth->_ir_buffer_size;
+    header._irstack_size = joforth->_irstack_size;
+    header._stack = _address_of(joforth, joforth->_stack);
+    header._ir_buffer = _address_of(joforth, joforth->_ir_buffer);
+#if defined(JOFORTH_THREADED_CODE)
+    header._code_buffer = _address_of(joforth, joforth->_code_buffer);
+#endif
+    header._irstack = _address_of(joforth, joforth->_irstack);
+    header._latest = joforth->_latest;
+    header._options = joforth->_options;
+    header._base = joforth->_base;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && _write_padding(file, (size_t)header._arena_offset - sizeof(header))
+        && fwrite(joforth->_memory, 1, joforth->_mp, file) == joforth->_mp
+        && _write_padding(file, arena_size - joforth->_mp)
+        && fwrite(dict->_dict, sizeof(_joforth_dict_slot_t), dict->_dict_size, file) == dict->_dict_size;
+    ok = fclose(file) == 0 && ok;
+    if (joforth->_parent) {
+        joforth->_allocator._free(flat._dict);
+    }
+    if (!ok) {
+        joforth->_status = _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+    return ok;
+}
+
+static bool _is_valid_image(const _joforth_image_header_t* header) {
+    bool threaded = false;
+#if defined(JOFORTH_THREADED_CODE)
+    threaded = true;
+#endif
+    return memcmp(header->_magic, _image_magic, sizeof(_image_magic)) == 0
+        && header->_version == JOFORTH_IMAGE_VERSION
+        && header->_value_size == sizeof(joforth_value_t)
+#if defined(JOFORTH_STACK_SIZE)
+        && header->_stack_size == JOFORTH_STACK_SIZE
+#endif
+        && header->_irstack_size == JOFORTH_IRSTACK_SIZE
+        && header->_entry_size == sizeof(_joforth_dict_entry_t)
+        && (header->_threaded != 0) == threaded
+        && header->_mp <= header->_memory_size
+        && header->_memory_size <= (joforth_word_address_t)~0u
+        && header->_dict_size && (header->_dict_size & (header->_dict_size - 1)) == 0
+        && header->_arena_offset % JOFORTH_IMAGE_ALIGNMENT == 0
+        && header->_dict_offset == header->_arena_offset + _image_align((size_t)header->_mp);
+}
+
+// maps, or reads, the arena of an image
+static bool _load_arena(joforth_t* joforth, FILE* file, const _joforth_image_header_t* header) {
+    joforth->_memory = 0;
+    joforth->_memory_mapped = 0;
+#if defined(JOFORTH_IMAGE_MMAP)
+    const size_t arena_size = _image_align((size_t)header->_mp);
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size > 0 && header->_arena_offset % (uint64_t)page_size == 0 && arena_size <= joforth->_memory_size) {
+        // reserve the whole arena, and map the used part of it copy-on-write from the file
+        uint8_t* memory = (uint8_t*)mmap(0, joforth->_memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory != MAP_FAILED) {
+            if (!arena_size || mmap(memory, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), (off_t)header->_arena_offset) != MAP_FAILED) {
+                joforth->_memory = memory;
+                joforth->_memory_mapped = joforth->_memory_size;
+                return true;
+            }
+            munmap(memory, joforth->_memory_size);
+        }
+    }
+#endif
+    joforth->_memory = (uint8_t*)joforth->_allocator._alloc(joforth->_memory_size);
+    return fseek(file, (long)header->_arena_offset, SEEK_SET) == 0 
+        && fread(joforth->_memory, 1, (size_t)header->_mp, file) == header->_mp;
+}
+
+// binds the natives of a loaded VM, and its threaded code if needed, to this process
+static void _bind_loaded_entries(joforth_t* joforth, bool translate) {
+    (void)translate;
+    joforth->_unbound_natives = 0;
+    for (joforth_word_address_t address = joforth->_latest; address; address = _entry_at(joforth, address)->_link) {
+        _joforth_dict_entry_t* entry = _entry_at(joforth, address);
+        switch (entry->_type) {
+        case kEntryType_Native:
+        case kEntryType_Prefix:
+            if (entry->_flags & kEntryFlag_Builtin) {
+                entry->_rep._handler = _builtin_handler(_string_at(joforth, entry->_word));
+                assert(entry->_rep._handler);
+            }
+            else {
+                // until the host adds it again
+                memset(&entry->_rep, 0, sizeof(entry->_rep));
+                entry->_flags |= kEntryFlag_Unbound;
+                ++joforth->_unbound_natives;
+            }
+            break;
+        case kEntryType_Word:
+#if defined(JOFORTH_THREADED_CODE)
+            if (translate) {
+                _translate(joforth, (_joforth_cell_t*)_ptr_at(joforth, entry->_code), _ptr_at(joforth, entry->_rep._ir));
+            }
+#endif
+            break;
+        default:;
+        }
+    }
+}
+
+bool    joforth_load_image(joforth_t* joforth, const char* path) {
+
+    joforth->_status = _JO_STATUS_INVALID_INPUT;
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    _joforth_image_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || !_is_valid_image(&header)) {
+        fclose(file);
+        return false;
+    }
+
+    joforth->_memory_size = (size_t)header._memory_size;
+    bool ok = _load_arena(joforth, file, &header);
+    joforth->_dict_size = (size_t)header._dict_size;
+    joforth->_dict = (_joforth_dict_slot_t*)joforth->_allocator._alloc(joforth->_dict_size * sizeof(_joforth_dict_slot_t));
+    ok = ok && fseek(file, (long)header._dict_offset, SEEK_SET) == 0
+        && fread(joforth->_dict, sizeof(_joforth_dict_slot_t), joforth->_dict_size, file) == joforth->_dict_size;
+    fclose(file);
+    if (!ok) {
+        joforth->_allocator._free(joforth->_dict);
+        _free_memory(joforth);
+        joforth->_dict = 0;
+        joforth->_memory = 0;
+        return false;
+    }
+
+    joforth->_mp = (size_t)header._mp;
+    joforth->_dict_count = (size_t)header._dict_count;
+    joforth->_dict_generation = (size_t)header._dict_generation;
+    joforth->_latest = header._latest;
+    joforth->_parent = 0;
+    joforth->_frozen = 0;
+    joforth->_frozen_file = 0;
+    joforth->_running = 0;
+    joforth->_suspended = false;
+    joforth->_jit = 0;
+    joforth->_jit_used = 0;
+    joforth->_jit_depth = 0;
+    joforth->_jit_words = 0;
+    joforth->_jit_words_size = 0;
+    joforth->_jit_words_count = 0;
+    joforth->_stack_size = (size_t)header._stack_size;
+    joforth->_stack = (joforth_value_t*)_ptr_at(joforth, header._stack);
+    joforth->_sp = (size_t)header._sp;
+    joforth->_ir_buffer = _ptr_at(joforth, header._ir_buffer);
+    joforth->_ir_buffer_size = (size_t)header._ir_buffer_size;
+    joforth->_irw = 0;
+#if defined(JOFORTH_THREADED_CODE)
+    joforth->_code_buffer = (_joforth_cell_t*)_ptr_at(joforth, header._code_buffer);
+#endif
+    joforth->_irstack = (uint8_t**)_ptr_at(joforth, header._irstack);
+    joforth->_irstack_size = (size_t)header._irstack_size;
+    joforth->_irp = joforth->_irstack_size - 1;
+    joforth->_options = header._options;
+    joforth->_base = header._base;
+
+    _initialise_statement_cache(joforth);
+    _bind_loaded_entries(joforth, header._labels != _engine_labels());
+
+    joforth->_status = _JO_STATUS_SUCCESS;
+    return true;
+}
+
+// =====================================================================================
+// overlays
+//
+// a frozen VM is the parent of any number of overlays, which start with a copy-on-write 
+// mapping of its arena, followed by a private part for their own definitions and data.
+// Everything in the frozen part keeps its address so the parent's IR, threaded code and 
+// dictionary table are valid in the overlays as they are; an overlay's own table only
+// has the words it defines, and is searched before the parent's (see _lookup).
+// =====================================================================================
+
+// overlays start with a small table, they usually only define a few words
+#define JOFORTH_OVERLAY_DICT_INITIAL_SIZE   16
+
+// the frozen part of the arena is a whole number of pages so that it can be mapped on its own
+static size_t _frozen_size(size_t size) {
+    size_t alignment = JOFORTH_IMAGE_ALIGNMENT;
+#if defined(JOFORTH_IMAGE_MMAP)
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size > 0 && (size_t)page_size > alignment) {
+        alignment = (size_t)page_size;
+    }
+#endif
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+bool    joforth_freeze(joforth_t* joforth) {
+
+    if (!_is_runnable(joforth)) {
+        if (_JO_SUCCEEDED(joforth->_status)) {
+            joforth->_status = _JO_STATUS_INVALID_INPUT;
+        }
+        return false;
+    }
+    const size_t frozen = _frozen_size(joforth->_mp);
+    if (frozen > joforth->_memory_size) {
+        joforth->_status = _JO_STATUS_RESOURCE_EXHAUSTED;
+        return false;
+    }
+    memset(joforth->_memory + joforth->_mp, 0, frozen - joforth->_mp);
+#if defined(JOFORTH_JIT)
+    // every overlay compiles the words it uses itself
+    _jit_reset(joforth);
+#endif
+
+#if defined(JOFORTH_IMAGE_MMAP)
+    // move the arena to a temporary file, so that its pages can be shared by every overlay, 
+    // and map it read only here. If that fails the overlays get a copy instead.
+    FILE* file = tmpfile();
+    if (file) {
+        uint8_t* memory = MAP_FAILED;
+        if (fwrite(joforth->_memory, 1, frozen, file) == frozen && fflush(file) == 0) {
+            memory = (uint8_t*)mmap(0, frozen, PROT_READ, MAP_SHARED, fileno(file), 0);
+        }
+        if (memory != MAP_FAILED) {
+            joforth_t mapped = *joforth;
+            mapped._memory = memory;
+            _rebase_buffers(&mapped, joforth);
+            _free_memory(joforth);
+            *joforth = mapped;
+            joforth->_memory_mapped = frozen;
+            joforth->_frozen_file = file;
+        }
+        else {
+            fclose(file);
+        }
+    }
+#endif
 
-                    //TODO: check for required stack depth at this point
+    joforth->_mp = frozen;
+    joforth->_frozen = frozen;
+    return true;
+}
 
-                    if (entry) {
+bool    joforth_attach(joforth_t* joforth, const joforth_t* parent) {
 
-                        switch (entry->_type) {
-                        case kEntryType_Prefix:
-                        {
-                            assert(entry->_depth < 2);
-                            _ir_emit(joforth, kIr_WordPtr);
-                            _ir_emit_ptr(joforth, entry);
-                            // this word + param count
-                            target_word_count = word_count + entry->_depth;
-                        }
-                        break;
-                        case kEntryType_Native:
-                            _ir_emit(joforth, kIr_Native);
-                            _ir_emit_ptr(joforth, entry);
-                            break;
-                        case kEntryType_Word:
-                            _ir_emit(joforth, kIr_WordPtr);
-                            _ir_emit_ptr(joforth, entry);
-                            break;
-                        case kEntryType_Value:
-                            _ir_emit(joforth, kIr_Value);
-                            _ir_emit_value(joforth, entry->_rep._value);
-                            break;
-                        default:;
-                        }
-                    }
-                    else {
-                        joforth_value_t value = _str_to_value(joforth, buffer);
-                        if (_JO_FAILED(joforth->_status)) {
-                            uint8_t* memory = _alloc(joforth, wp + 1);
-                            memcpy(memory, buffer, wp + 1);
-                            _ir_emit(joforth, kIr_ValuePtr);
-                            _ir_emit_ptr(joforth, memory);
-                            joforth->_status = _JO_STATUS_SUCCESS;
-                        }
-                        else {
-                            _ir_emit(joforth, kIr_Value);
-                            _ir_emit_value(joforth, value);
-                        }
-                    }
-                }
+    if (!parent->_frozen) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+
+    *joforth = *parent;
+    joforth->_parent = parent;
+    joforth->_frozen = 0;
+    joforth->_frozen_file = 0;
+    // the overlay counts and compiles the parent's words it uses itself
+    joforth->_jit = 0;
+    joforth->_jit_used = 0;
+    joforth->_jit_words = 0;
+    joforth->_jit_words_size = 0;
+    joforth->_jit_words_count = 0;
+    joforth->_memory = 0;
+    joforth->_memory_mapped = 0;
+#if defined(JOFORTH_IMAGE_MMAP)
+    if (parent->_frozen_file) {
+        // reserve the whole arena, and map the frozen part of it copy-on-write
+        uint8_t* memory = (uint8_t*)mmap(0, joforth->_memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory != MAP_FAILED) {
+            if (mmap(memory, parent->_frozen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno((FILE*)parent->_frozen_file), 0) != MAP_FAILED) {
+                joforth->_memory = memory;
+                joforth->_memory_mapped = joforth->_memory_size;
+            }
+            else {
+                munmap(memory, joforth->_memory_size);
             }
         }
-        ++word_count;
-        word = _next_word(joforth, buffer, JOFORTH_MAX_WORD_LENGTH, word, &wp, 0);
+    }
+#endif
+    if (!joforth->_memory) {
+        joforth->_memory = (uint8_t*)joforth->_allocator._alloc(joforth->_memory_size);
+        memcpy(joforth->_memory, parent->_memory, parent->_frozen);
+    }
+    _rebase_buffers(joforth, parent);
+    joforth->_sp = _JOFORTH_STACK_SIZE(joforth) - 1;
+    joforth->_irw = 0;
 
-    } while (wp);
+    // only the words defined by the overlay go in its own table
+    joforth->_dict = 0;
+    joforth->_dict_size = 0;
+    joforth->_dict_count = 0;
+    _dict_grow(joforth, JOFORTH_OVERLAY_DICT_INITIAL_SIZE);
 
-    // terminate the ir buffer properly
-    _ir_emit(joforth, kIr_Null);
+    _initialise_statement_cache(joforth);
+    joforth->_status = _JO_STATUS_SUCCESS;
+    return true;
+}
 
-    // =====================================================================================
-    // phase 2: interpret or compile
-    // =====================================================================================
+// =====================================================================================
+// modules
+//
+// a module holds words compiled ahead of time, see joforthc, which can be linked into 
+// any VM. It's a header followed by these sections:
+//  words:          _joforth_module_word_t for each word, in the order they were defined
+//  imports:        _joforth_module_import_t for each word it uses which isn't in the module
+//  relocations:    _joforth_module_relocation_t for each address in the IR
+//  strings:        0 terminated names and string literals, starting with an empty string
+//  IR:             the IR of all the words, with 0 in place of every address
+// =====================================================================================
 
-    size_t irr = 0;
-    uint8_t* irbuffer = joforth->_ir_buffer;
-    
-    // for self reference, i.e. "recurse"
-    _joforth_dict_entry_t* self = 0;
+#define JOFORTH_MODULE_VERSION      2
 
-    // are we interpreting or compiling? if the latter we need a bit of setup
-    if (mode == kEvalMode_Compiling) {
-        _joforth_ir_t ir;
-        irbuffer = _ir_consume(irbuffer, &ir);
-        assert(ir == kIr_DefineWord);
-        const char* id;
-        irbuffer = _ir_consume_ptr(irbuffer, (void**)&id);
-        joforth_word_key_t key = pearson_hash(id);
-        self = _find_word(joforth, key);
-        if (self) {
-            // already exists
-            joforth->_status = _JO_STATUS_INVALID_INPUT;
-            return false;
+typedef struct _joforth_module_header {
+    char        _magic[8];
+    uint32_t    _version;
+    uint32_t    _value_size;
+    // the IR must have been generated by a build with the same instruction set
+    uint32_t    _ir_codes;
+    // number of words, imports and relocations
+    uint32_t    _words;
+    uint32_t    _imports;
+    uint32_t    _relocations;
+    // size of the strings and IR sections, in bytes
+    uint32_t    _strings_size;
+    uint32_t    _ir_size;
+} _joforth_module_header_t;
+
+typedef struct _joforth_module_word {
+    // offsets in the strings section, _doc is 0 if there is none
+    uint32_t    _name;
+    uint32_t    _doc;
+    // location and size of its IR in the IR section
+    uint32_t    _ir;
+    uint32_t    _ir_size;
+    uint32_t    _flags;
+    uint32_t    _depth;
+} _joforth_module_word_t;
+
+typedef struct _joforth_module_import {
+    uint32_t    _name;
+    // the IR depends on what kind of word it is, so it must be the same when the module is loaded
+    uint8_t     _type;
+    uint8_t     _signature;
+    uint16_t    _reserved;
+} _joforth_module_import_t;
+
+// _joforth_module_relocation_t::_kind
+enum {
+    // _index is a word in the module
+    kModuleRelocation_Word,
+    // _index is a word in the module, the address of its name
+    kModuleRelocation_Name,
+    // _index is an import
+    kModuleRelocation_Import,
+    // _index is the offset of a string literal in the strings section
+    kModuleRelocation_String,
+};
+
+typedef struct _joforth_module_relocation {
+    // location of the address in the IR section
+    uint32_t    _at;
+    uint32_t    _kind;
+    uint32_t    _index;
+} _joforth_module_relocation_t;
+
+static const char _module_magic[8] = "joFmod";
+
+// a growable buffer, used to build the sections of a module
+typedef struct _joforth_buffer {
+    uint8_t*    _data;
+    size_t      _size;
+    size_t      _capacity;
+} _joforth_buffer_t;
+
+// appends bytes to buffer, returns the offset they were stored at
+static size_t _buffer_append(joforth_t* joforth, _joforth_buffer_t* buffer, const void* data, size_t bytes) {
+    if (buffer->_size + bytes > buffer->_capacity) {
+        size_t capacity = buffer->_capacity ? 2 * buffer->_capacity : 256;
+        while (capacity < buffer->_size + bytes) {
+            capacity *= 2;
         }
-        self = _add_entry(joforth, id);
-        //ZZZ: perhaps read this from a comment string?
-        self->_depth = 0;
-        if(comment) {
-            size_t comment_length = 0;
-            while(comment[comment_length++]!=')') ;
-            char* doc_copy = (char*)_alloc(joforth, comment_length);
-            memcpy(doc_copy, comment, comment_length);
-            doc_copy[comment_length-1] = 0;
-            self->_doc = (const char*)doc_copy;
-
-            // read the depth from the comment string
-            // we exepct the comment is reliable, i.e. 
-            // if the word takes two parameters then there are 
-            // two distinct names listed before the '--'
-            size_t whitespace_edge = 0;
-            // skip any leading whitespace
-            while(*doc_copy==' ') ++doc_copy;
-            while( *doc_copy!='-' && *doc_copy!=')' ) {
-                if ( *doc_copy==' ' ) {
-                    ++whitespace_edge;
-                    // skip another whitespace
-                    while(*doc_copy==' ') ++doc_copy;
-                }
-                ++doc_copy;
-            }
-            self->_depth = whitespace_edge;
+        uint8_t* grown = (uint8_t*)joforth->_allocator._alloc(capacity);
+        if (buffer->_data) {
+            memcpy(grown, buffer->_data, buffer->_size);
+            joforth->_allocator._free(buffer->_data);
         }
-        // the word is already compiled at this point so we just need to store the IR for it and we're done
-        self->_type = kEntryType_Word;
-        self->_rep._ir = (uint8_t*)_alloc(joforth, joforth->_irw);
-        memcpy(self->_rep._ir, joforth->_ir_buffer, joforth->_irw);
+        buffer->_data = grown;
+        buffer->_capacity = capacity;
+    }
+    const size_t at = buffer->_size;
+    memcpy(buffer->_data + at, data, bytes);
+    buffer->_size += bytes;
+    return at;
+}
 
-        return true;
+static void _buffer_free(joforth_t* joforth, _joforth_buffer_t* buffer) {
+    if (buffer->_data) {
+        joforth->_allocator._free(buffer->_data);
     }
+    memset(buffer, 0, sizeof(_joforth_buffer_t));
+}
 
-    //NOTE: has to be the same depth as the irstack, just in case we hit something really deeply nested
-    _joforth_eval_mode_t mode_stack[JOFORTH_DEFAULT_IRSTACK_SIZE];
-    size_t msp = JOFORTH_DEFAULT_IRSTACK_SIZE-1;
-    // used to skip the next instruction (handling the ? prefix operator)
-    bool skip_one = false;
-    
-    // incremented by one for each IF, decremented by one for ENDIF
-    size_t if_nest_level = 0;
-    // set to if_nest_level, if != we have an IF-ENDIF inbetween an IF-ELSE....
-    size_t else_nest_level = 0;
+static uint32_t _module_string(joforth_t* joforth, _joforth_buffer_t* strings, const char* string) {
+    return (uint32_t)_buffer_append(joforth, strings, string, strlen(string) + 1);
+}
 
-    // keep going until the irstack is empty
-    while (true) {
+// index of the word at address in words, or count if it isn't one of them
+static size_t _module_word_index(const joforth_word_address_t* words, size_t count, joforth_word_address_t address) {
+    size_t n = 0;
+    while (n < count && words[n] != address) ++n;
+    return n;
+}
 
-        // interpret the contents of an IR buffer
-        while (*irbuffer != kIr_Null) {
+bool    joforth_save_module(joforth_t* joforth, const char* path, joforth_word_address_t since) {
 
-            _joforth_ir_t ir;
-            irbuffer = _ir_consume(irbuffer, &ir);
+    if (_JO_FAILED(joforth->_status))
+        return false;
 
-            switch (ir) {
-            case kIr_True:
-            {
-                if (mode != kEvalMode_Skipping) {
-                    joforth_push_value(joforth, JOFORTH_TRUE);
-                }
-            }
-            break;
-            case kIr_False:
-            {
-                if (mode != kEvalMode_Skipping) {
-                    joforth_push_value(joforth, JOFORTH_FALSE);
-                }
-            }
-            break;
-            case kIr_Invert:
-            {
-                if (mode != kEvalMode_Skipping) {
-                    assert(joforth->_sp < joforth->_stack_size - 1);
-                    // sends TRUE->FALSE and vice versa.
-                    joforth->_stack[joforth->_sp + 1] = ~joforth->_stack[joforth->_sp + 1];
-                }
-            }
-            break;
-            case kIr_If:
-            {
-                ++if_nest_level;
-
-                if( mode != kEvalMode_Skipping ) {
-                    // decide what to do based on TOS
-                    joforth_value_t tos = joforth_pop_value(joforth);
-                    if (tos == JOFORTH_FALSE) {
-                        // skip until ELSE
-                        mode = kEvalMode_Skipping;
-                        // ENDIF will keep interpreting
-                        mode_stack[msp--] = kEvalMode_Interpreting;
-                        // ELSE will switch to interpreting
-                        mode_stack[msp--] = kEvalMode_Interpreting;                        
-                    }
-                    else {
-                        // ENDIF will switch back to interpreting
-                        mode_stack[msp--] = kEvalMode_Interpreting;
-                        // ELSE will switch to skipping
-                        mode_stack[msp--] = kEvalMode_Skipping;                        
-                    }
-                } 
-                else {
-                    // this IF is being skipped; ENDIF and ELSE will keep skipping
-                    mode_stack[msp--] = kEvalMode_Skipping;
-                    mode_stack[msp--] = kEvalMode_Skipping;                    
-                }
-            }
-            break;
-            case kIr_IfZeroOperator:
-            {
-                //TODO: change to general ? operator handler
-
-                if (mode != kEvalMode_Skipping) {
-                    joforth_value_t tos = joforth_top_value(joforth);
-                    skip_one = tos == 0;
-                    if (skip_one) {
-                        // skip the next instruction
-                        mode_stack[msp--] = mode;
-                        mode = kEvalMode_Skipping;
-                        continue;
-                    }
-                }
-            }
-            break;
-            case kIr_Else:
-            {
-                else_nest_level = if_nest_level;
+    // the words defined after since, in the order they were defined
+    size_t count = 0;
+    for (joforth_word_address_t address = joforth->_latest; address != since; address = _entry_at(joforth, address)->_link) {
+        if (!address || _entry_at(joforth, address)->_type != kEntryType_Word) {
+            // only colon words can be saved
+            joforth->_status = _JO_STATUS_INVALID_INPUT;
+            return false;
+        }
+        ++count;
+    }
+    joforth_word_address_t* words = (joforth_word_address_t*)joforth->_allocator._alloc((count + 1) * sizeof(joforth_word_address_t));
+    size_t n = count;
+    for (joforth_word_address_t address = joforth->_latest; address != since; address = _entry_at(joforth, address)->_link) {
+        words[--n] = address;
+    }
 
-                // switch to the mode selected by the last IF and continue
-                mode = mode_stack[++msp];
-            }
-            break;
-            case kIr_Endif:
-            {   
-                if ( else_nest_level < if_nest_level ) {
-                    // we're inside an if-endif so we need to pop 
-                    // the stack as many times as ELSE didn't pop
-                    for( size_t level = (if_nest_level-else_nest_level); level>0; --level) {
-                        ++msp;
-                    }
-                } else {
-                    --else_nest_level;
-                }
-                // switch back to the active mode of the leading IF
-                mode = mode_stack[++msp];
-                --if_nest_level;
-            }
-            break;
-            case kIr_Begin:
-            {
-                if (mode != kEvalMode_Skipping) {
-                    // push the next instruction. 
-                    // until will return here and keep pushing the same location until we're done
-                    _push_irstack(joforth, irbuffer);
-                }
-            }
-            break;
-            case kIr_Until:
-            {
-                if (mode != kEvalMode_Skipping) {
-                    uint8_t* loop_location = _pop_irstack(joforth);
-                    joforth_value_t tos = joforth_pop_value(joforth);
-                    if (!tos) {
-                        // go back to begin
-                        irbuffer = loop_location;
-                        // and push for the next round
-                        _push_irstack(joforth, irbuffer);
-                    }
-                    // else we're done
-                }
-            }
-            break;
-            case kIr_Dot:
-            {
-                if (mode != kEvalMode_Skipping) {
-                    joforth_value_t value = joforth_pop_value(joforth);
-                    switch (joforth->_base)
-                    {
-                    case 10:
-                        printf("%lld", value);
-                        break;
-                    case 16:
-                        printf("%llx", value);
-                        break;
-                    default:
-                        printf("NaN");
-                        break;
-                    }
-                }
-            }
-            break;
-            case kIr_DotDot:
-            {
-                if (mode != kEvalMode_Skipping) {
-                    const char* str = (const char*)joforth_pop_value(joforth);
-                    printf("%s",str);
-                }
-            }
-            break;
-            case kIr_ValuePtr:
-            {
-                joforth_value_t value;
-                irbuffer = _ir_consume_ptr(irbuffer, (void**)&value);
-                if (mode != kEvalMode_Skipping) {
-                    joforth_push_value(joforth, value);
-                }
-            }
-            break;
-            case kIr_Value:
-            {
-                joforth_value_t value;
-                irbuffer = _ir_consume_ptr(irbuffer, (void**)&value);
-                if (mode != kEvalMode_Skipping) {
-                    joforth_push_value(joforth, value);
-                }
-            }
-            break;
-            case kIr_Native:
-            {
-                _joforth_dict_entry_t* handler_entry;
-                irbuffer = _ir_consume_ptr(irbuffer, (void**)&handler_entry);
-                if (mode != kEvalMode_Skipping) {
-                    handler_entry->_rep._handler(joforth);
-                    if (_JO_FAILED(joforth->_status)) {
-                        return false;
-                    }
-                }
-            }
-            break;
-            case kIr_DefineWord:
-            {
-                const char* id;
-                irbuffer = _ir_consume_ptr(irbuffer, (void**)&id);
-                //NOTE: here we assume there can only be one, i.e. there is never more than one ":" define statement in a sentence
-                if (!self) {
-                    // when interpreting we need "self"
-                    joforth_word_key_t key = pearson_hash(id);
-                    self = _find_word(joforth, key);
-                    if (_JO_FAILED(joforth->_status)) {
-                        return false;
-                    }
-                }
+    _joforth_buffer_t word_section = { 0 };
+    _joforth_buffer_t imports = { 0 };
+    _joforth_buffer_t relocations = { 0 };
+    _joforth_buffer_t strings = { 0 };
+    _joforth_buffer_t ir_section = { 0 };
+    // imported entries, by import index
+    _joforth_buffer_t imported = { 0 };
+    _buffer_append(joforth, &strings, "", 1);
+
+    for (n = 0; n < count; ++n) {
+        const _joforth_dict_entry_t* entry = _entry_at(joforth, words[n]);
+        const uint8_t* ir = _ptr_at(joforth, entry->_rep._ir);
+        size_t ir_size = 0;
+        while (ir[ir_size] != kIr_Null) {
+            ir_size += 1 + _ir_operand_size((_joforth_ir_t)ir[ir_size]);
+        }
+        ++ir_size;
+
+        _joforth_module_word_t word;
+        word._name = _module_string(joforth, &strings, _string_at(joforth, entry->_word));
+        word._doc = entry->_doc ? _module_string(joforth, &strings, _string_at(joforth, entry->_doc)) : 0;
+        word._ir = (uint32_t)ir_section._size;
+        word._ir_size = (uint32_t)ir_size;
+        word._flags = entry->_flags & (kEntryFlag_Inline | kEntryFlag_NoInline);
+        word._depth = (uint32_t)entry->_depth;
+        _buffer_append(joforth, &word_section, &word, sizeof(word));
+
+        // copy the IR, replacing addresses with relocations
+        const size_t base = _buffer_append(joforth, &ir_section, ir, ir_size);
+        for (size_t i = 0; i < ir_size; i += 1 + _ir_operand_size((_joforth_ir_t)ir[i])) {
+            const _joforth_ir_t op = (_joforth_ir_t)ir[i];
+            if (!_ir_is_address(op)) {
+                continue;
             }
-            break;
-            case kIr_Recurse:
-            {
-                // simply invoke self again
-                if (mode != kEvalMode_Skipping) {
-                    _push_irstack(joforth, irbuffer);
-                    irbuffer = self->_rep._ir;
-                }
+            _joforth_ir_address_t address;
+            _ir_consume_address((uint8_t*)ir + i + 1, &address);
+            memset(ir_section._data + base + i + 1, 0, sizeof(address));
+
+            _joforth_module_relocation_t relocation = { ._at = (uint32_t)(base + i + 1) };
+            if (op == kIr_DefineWord) {
+                relocation._kind = kModuleRelocation_Name;
+                relocation._index = (uint32_t)n;
             }
-            break;
-            case kIr_WordPtr:
-            {
-                // the current word, can be used for self reference 
-                _joforth_dict_entry_t* entry = 0;
-                irbuffer = _ir_consume_ptr(irbuffer, (void**)&entry);
-
-                if (entry->_type == kEntryType_Prefix) {
-                    // first check that we've got enough arguments following this instruction
-                            //TODO: can CREATE, VARIABLE, SEE etc. accept the result of another word...?
-                            // for now; only accept value and word ptrs 
-                    assert(entry->_depth < 2);
-
-                    //ZZZ: this doesn't check softly if we're at the end of the buffer
-                    _joforth_ir_t next_ir;
-                    irbuffer = _ir_consume(irbuffer, &next_ir);
-                    switch (next_ir) {
-                    case kIr_WordPtr:
-                    case kIr_ValuePtr:
-                    {
-                        //NOTE: we're not doing any type checking here, if it requires a WordPtr when a ValuePtr 
-                        //      is passed then things WILL go wrong...
-                        void* ptr;
-                        irbuffer = _ir_consume_ptr(irbuffer, (void**)&ptr);
-                        if (mode != kEvalMode_Skipping) {
-                            joforth_push_value(joforth, (joforth_value_t)ptr);
-                            entry->_rep._handler(joforth);
-                        }
-                    }
-                    break;
-                    default:
-                        joforth->_status = _JO_STATUS_INVALID_INPUT;
-                        return false;
-                    }
-                }
-                else {
-                    // switch to the entry's ir code and continue executing 
-                    _push_irstack(joforth, irbuffer);
-                    irbuffer = entry->_rep._ir;
-                }
+            else if (op == kIr_ValuePtr) {
+                relocation._kind = kModuleRelocation_String;
+                relocation._index = _module_string(joforth, &strings, _string_at(joforth, address));
             }
-            break;
-            case kIr_Do:
-            {
-                // push the next instruction for loop to pick up                
-                _push_irstack(joforth, irbuffer);
+            else if (_module_word_index(words, count, address) < count) {
+                relocation._kind = kModuleRelocation_Word;
+                relocation._index = (uint32_t)_module_word_index(words, count, address);
             }
-            break;
-            case kIr_Loop:
-            {
-                joforth_value_t end = joforth_pop_value(joforth);
-                joforth_value_t i = joforth_pop_value(joforth);
-                assert(i<end);
-                uint8_t* do_loc = _pop_irstack(joforth);
-                ++i;
-                if(i<end) {
-                    // keep going
-                    _push_irstack(joforth, irbuffer = do_loc);
-                    // push i and end back on the stack
-                    joforth_push_value(joforth, i);
-                    joforth_push_value(joforth, end);
+            else {
+                const size_t import_count = imported._size / sizeof(joforth_word_address_t);
+                size_t index = _module_word_index((const joforth_word_address_t*)imported._data, import_count, address);
+                if (index == import_count) {
+                    const _joforth_dict_entry_t* imported_entry = _entry_at(joforth, address);
+                    _joforth_module_import_t import = {
+                        ._name = _module_string(joforth, &strings, _string_at(joforth, imported_entry->_word)),
+                        ._type = (uint8_t)imported_entry->_type,
+                        ._signature = imported_entry->_signature,
+                    };
+                    _buffer_append(joforth, &imports, &import, sizeof(import));
+                    _buffer_append(joforth, &imported, &address, sizeof(address));
                 }
-                // else we're done
-            }
-            break;
-            default:;
+                relocation._kind = kModuleRelocation_Import;
+                relocation._index = (uint32_t)index;
             }
+            _buffer_append(joforth, &relocations, &relocation, sizeof(relocation));
+        }
+    }
 
-            if (skip_one) {
-                assert(mode == kEvalMode_Skipping);
-                skip_one = false;
-                mode = mode_stack[++msp];
-            }
+    _joforth_module_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header._magic, _module_magic, sizeof(header._magic));
+    header._version = JOFORTH_MODULE_VERSION;
+    header._value_size = sizeof(joforth_value_t);
+    header._ir_codes = kIr_NumCodes;
+    header._words = (uint32_t)count;
+    header._imports = (uint32_t)(imports._size / sizeof(_joforth_module_import_t));
+    header._relocations = (uint32_t)(relocations._size / sizeof(_joforth_module_relocation_t));
+    header._strings_size = (uint32_t)strings._size;
+    header._ir_size = (uint32_t)ir_section._size;
+
+    bool ok = false;
+    FILE* file = fopen(path, "wb");
+    if (file) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(word_section._data, 1, word_section._size, file) == word_section._size
+            && fwrite(imports._data, 1, imports._size, file) == imports._size
+            && fwrite(relocations._data, 1, relocations._size, file) == relocations._size
+            && fwrite(strings._data, 1, strings._size, file) == strings._size
+            && fwrite(ir_section._data, 1, ir_section._size, file) == ir_section._size;
+        ok = fclose(file) == 0 && ok;
+    }
+    if (!ok) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+    }
+
+    _buffer_free(joforth, &word_section);
+    _buffer_free(joforth, &imports);
+    _buffer_free(joforth, &relocations);
+    _buffer_free(joforth, &strings);
+    _buffer_free(joforth, &ir_section);
+    _buffer_free(joforth, &imported);
+    joforth->_allocator._free(words);
+    return ok;
+}
+
+// the sections of a module in memory
+typedef struct _joforth_module {
+    const _joforth_module_header_t*         _header;
+    const _joforth_module_word_t*           _words;
+    const _joforth_module_import_t*         _imports;
+    const _joforth_module_relocation_t*     _relocations;
+    const char*                             _strings;
+    const uint8_t*                          _ir;
+} _joforth_module_t;
+
+// checks that the module is compatible, and everything in it is where it should be
+static bool _is_valid_module(_joforth_module_t* module, const uint8_t* data, size_t size) {
+    const _joforth_module_header_t* header = (const _joforth_module_header_t*)data;
+    if (size < sizeof(_joforth_module_header_t)
+        || memcmp(header->_magic, _module_magic, sizeof(_module_magic)) != 0
+        || header->_version != JOFORTH_MODULE_VERSION
+        || header->_value_size != sizeof(joforth_value_t)
+        || header->_ir_codes != kIr_NumCodes
+        || !header->_strings_size) {
+        return false;
+    }
+    const uint64_t expected = sizeof(_joforth_module_header_t)
+        + (uint64_t)header->_words * sizeof(_joforth_module_word_t)
+        + (uint64_t)header->_imports * sizeof(_joforth_module_import_t)
+        + (uint64_t)header->_relocations * sizeof(_joforth_module_relocation_t)
+        + header->_strings_size + header->_ir_size;
+    if (expected != size) {
+        return false;
+    }
+    module->_header = header;
+    module->_words = (const _joforth_module_word_t*)(header + 1);
+    module->_imports = (const _joforth_module_import_t*)(module->_words + header->_words);
+    module->_relocations = (const _joforth_module_relocation_t*)(module->_imports + header->_imports);
+    module->_strings = (const char*)(module->_relocations + header->_relocations);
+    module->_ir = (const uint8_t*)module->_strings + header->_strings_size;
+
+    if (module->_strings[header->_strings_size - 1]) {
+        return false;
+    }
+    for (size_t n = 0; n < header->_words; ++n) {
+        const _joforth_module_word_t* word = module->_words + n;
+        if (word->_name >= header->_strings_size || word->_doc >= header->_strings_size
+            || !word->_ir_size || (uint64_t)word->_ir + word->_ir_size > header->_ir_size
+            || module->_ir[word->_ir + word->_ir_size - 1] != kIr_Null) {
+            return false;
+        }
+    }
+    for (size_t n = 0; n < header->_imports; ++n) {
+        if (module->_imports[n]._name >= header->_strings_size) {
+            return false;
+        }
+    }
+    for (size_t n = 0; n < header->_relocations; ++n) {
+        const _joforth_module_relocation_t* relocation = module->_relocations + n;
+        const uint32_t limit = relocation->_kind == kModuleRelocation_Import ? header->_imports
+            : (relocation->_kind == kModuleRelocation_String ? header->_strings_size : header->_words);
+        if ((uint64_t)relocation->_at + sizeof(_joforth_ir_address_t) > header->_ir_size 
+            || relocation->_kind > kModuleRelocation_String || relocation->_index >= limit) {
+            return false;
         }
+    }
+    return true;
+}
+
+// links a module into the VM, returns false if it can't be linked. Nothing is added in that case
+static bool _link_module(joforth_t* joforth, const _joforth_module_t* module) {
+    const _joforth_module_header_t* header = module->_header;
+
+    // every import must be there, and be the same kind of word it was when the module was compiled
+    joforth_word_address_t* imports = (joforth_word_address_t*)joforth->_allocator._alloc((header->_imports + header->_words + 1) * sizeof(joforth_word_address_t));
+    joforth_word_address_t* words = imports + header->_imports;
+    bool ok = true;
+    for (size_t n = 0; ok && n < header->_imports; ++n) {
+        const _joforth_module_import_t* import = module->_imports + n;
+        const char* name = module->_strings + import->_name;
+        const _joforth_dict_entry_t* entry = _find_word(joforth, name, strlen(name));
+        ok = entry && entry->_type == import->_type && entry->_signature == import->_signature;
+        imports[n] = ok ? _address_of(joforth, entry) : 0;
+    }
+    // and the words themselves must be new
+    for (size_t n = 0; ok && n < header->_words; ++n) {
+        const char* name = module->_strings + module->_words[n]._name;
+        const size_t length = strlen(name);
+        ok = length && length <= JOFORTH_MAX_WORD_LENGTH && !_find_word(joforth, name, length);
+    }
+    if (!ok) {
+        joforth->_allocator._free(imports);
+        return false;
+    }
 
-        if (_irstack_is_empty(joforth)) {
-            // exit outer while
+    // the IR of all the words is copied in one go and then relocated
+    uint8_t* ir = _alloc(joforth, header->_ir_size);
+    memcpy(ir, module->_ir, header->_ir_size);
+    for (size_t n = 0; n < header->_words; ++n) {
+        const _joforth_module_word_t* word = module->_words + n;
+        _joforth_dict_entry_t* entry = _add_entry(joforth, module->_strings + word->_name);
+        entry->_type = kEntryType_Word;
+        entry->_flags = word->_flags & (kEntryFlag_Inline | kEntryFlag_NoInline);
+        entry->_depth = word->_depth;
+        if (word->_doc) {
+            const char* doc = module->_strings + word->_doc;
+            const size_t doc_size = strlen(doc) + 1;
+            char* doc_copy = (char*)_alloc(joforth, doc_size);
+            memcpy(doc_copy, doc, doc_size);
+            entry->_doc = _address_of(joforth, doc_copy);
+        }
+        entry->_rep._ir = _address_of(joforth, ir + word->_ir);
+        words[n] = _address_of(joforth, entry);
+    }
+    for (size_t n = 0; n < header->_relocations; ++n) {
+        const _joforth_module_relocation_t* relocation = module->_relocations + n;
+        _joforth_ir_address_t address = 0;
+        switch (relocation->_kind) {
+        case kModuleRelocation_Word:
+            address = words[relocation->_index];
             break;
+        case kModuleRelocation_Name:
+            address = _entry_at(joforth, words[relocation->_index])->_word;
+            break;
+        case kModuleRelocation_Import:
+            address = imports[relocation->_index];
+            break;
+        case kModuleRelocation_String:
+        {
+            const char* string = module->_strings + relocation->_index;
+            const size_t string_size = strlen(string) + 1;
+            uint8_t* string_copy = _alloc(joforth, string_size);
+            memcpy(string_copy, string, string_size);
+            address = _address_of(joforth, string_copy);
+        }
+        break;
+        default:;
+        }
+        memcpy(ir + relocation->_at, &address, sizeof(address));
+    }
+    // the words a module uses can have different effects than when it was compiled, so its words 
+    // are verified again, in order, and only those which still can be skip the stack checks
+    _ir_set_checks(ir, header->_ir_size, true);
+    for (size_t n = 0; n < header->_words; ++n) {
+        _joforth_dict_entry_t* entry = _entry_at(joforth, words[n]);
+        uint8_t* word_ir = _ptr_at(joforth, entry->_rep._ir);
+        const char* doc = entry->_doc ? _string_at(joforth, entry->_doc) : 0;
+        _joforth_effect_t declared;
+        const bool is_declared = doc && _declared_effect(doc, strlen(doc), &declared);
+        _joforth_effect_t effect;
+        if (_infer_effect(joforth, word_ir, is_declared ? &declared : 0, &effect)
+            && (!is_declared || _is_declared_effect(&effect, &declared))) {
+            entry->_flags |= kEntryFlag_Verified;
+            entry->_depth = (uint32_t)effect._in;
+            entry->_results = (uint32_t)effect._out;
+            _ir_set_checks(word_ir, module->_words[n]._ir_size, false);
         }
+    }
+#if defined(JOFORTH_THREADED_CODE)
+    // now that everything they refer to is there
+    for (size_t n = 0; n < header->_words; ++n) {
+        _joforth_dict_entry_t* entry = _entry_at(joforth, words[n]);
+        uint8_t* word_ir = _ptr_at(joforth, entry->_rep._ir);
+        _joforth_cell_t* code = (_joforth_cell_t*)_alloc_aligned(joforth, _translate(joforth, 0, word_ir) * sizeof(_joforth_cell_t), _Alignof(_joforth_cell_t));
+        _translate(joforth, code, word_ir);
+        entry->_code = _address_of(joforth, code);
+    }
+#endif
+    joforth->_allocator._free(imports);
+    return true;
+}
 
-        irbuffer = _pop_irstack(joforth);
+bool    joforth_load_module(joforth_t* joforth, const char* path) {
 
-    }; // while(true)
+    if (_JO_FAILED(joforth->_status))
+        return false;
 
-    return true;
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+        return false;
+    }
+    size_t size = 0;
+    uint8_t* data = 0;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        const long end = ftell(file);
+        if (end > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            size = (size_t)end;
+            data = (uint8_t*)joforth->_allocator._alloc(size);
+            if (fread(data, 1, size, file) != size) {
+                size = 0;
+            }
+        }
+    }
+    fclose(file);
+
+    _joforth_module_t module;
+    const bool ok = data && _is_valid_module(&module, data, size) && _link_module(joforth, &module);
+    if (data) {
+        joforth->_allocator._free(data);
+    }
+    if (!ok) {
+        joforth->_status = _JO_STATUS_INVALID_INPUT;
+    }
+    return ok;
 }
 
 void    joforth_dump_dict(joforth_t* joforth) {
-    printf("joforth dictionary info:\n");
-    if (joforth->_dict) {
-        for (size_t i = 0u; i < JOFORTH_DICT_BUCKETS; ++i) {
-            _joforth_dict_entry_t* entry = joforth->_dict + i;
-            while (entry->_key) {
-                if ((entry->_type == kEntryType_Prefix) == 0) {
-                    printf("\tentry: key 0x%x, word \"%s\", takes %zu parameters\n", entry->_key, entry->_word, entry->_depth);
-                }
-                else {
-                    printf("\tPREFIX entry: word \"%s\", takes %zu parameters\n", entry->_word, entry->_depth);
-                }
-                entry = entry->_next;
+    _print(joforth, "joforth dictionary info:\n");
+    for (const joforth_t* layer = joforth; layer; layer = layer->_parent) {
+        if (layer != joforth) {
+            _print(joforth, "parent:\n");
+        }
+        if (!layer->_dict_count) {
+            _print(joforth, "\tempty\n");
+            continue;
+        }
+        for (size_t i = 0u; i < layer->_dict_size; ++i) {
+            const _joforth_dict_slot_t* slot = layer->_dict + i;
+            if (!slot->_length) {
+                continue;
+            }
+            const _joforth_dict_entry_t* entry = _entry_at(joforth, slot->_entry);
+            if ((entry->_type == kEntryType_Prefix) == 0) {
+                _print(joforth, "\tentry: key 0x%x, word \"%s\", takes %u parameters\n", slot->_key, _string_at(joforth, entry->_word), entry->_depth);
+            }
+            else {
+                _print(joforth, "\tPREFIX entry: word \"%s\", takes %u parameters\n", _string_at(joforth, entry->_word), entry->_depth);
             }
         }
     }
-    else {
-        printf("\tempty\n");
-    }
 }
 
 void    joforth_dump_stack(joforth_t* joforth) {
-    if (joforth->_sp == (joforth->_stack_size - 1)) {
-        printf("joforth: stack is empty\n");
+    if (joforth_stack_is_empty(joforth)) {
+        _print(joforth, "joforth: stack is empty\n");
     }
     else {
-        printf("joforth stack contents:\n");
-        for (size_t sp = joforth->_sp + 1; sp < joforth->_stack_size; ++sp) {
-            printf("\t%lld\n", joforth->_stack[sp]);
+        _print(joforth, "joforth stack contents:\n");
+        for (size_t sp = joforth->_sp + 1; sp < _JOFORTH_STACK_SIZE(joforth); ++sp) {
+            _print(joforth, "\t%lld\n", (long long)joforth->_stack[sp]);
         }
     }
 }
@@ -15,45 +15,187 @@
 
 #define JOFORTH_MAX_WORD_LENGTH 128
 
+// build configuration, normally set by the CMake options of the same names. Everything which 
+// includes joforth.h must be built with the same settings as the library.
+//
+//  JOFORTH_CELL_BITS       the width of a value, 64 (the default) or 32. 32 bit cells halve the size 
+//                          of the stack and of cell arrays in the arena, but words aren't compiled 
+//                          to native code
+//  JOFORTH_STACK_SIZE      if defined, the size of the value stack in cells. joforth_t::_stack_size 
+//                          is ignored, and the stack helpers below use the constant
+//  JOFORTH_IRSTACK_SIZE    the depth of the IR return stack, i.e. of nested calls, 256 by default
+//  JOFORTH_CHECKS          the stack checks in the helpers below and in the built in words:
+//                          JOFORTH_CHECKS_NONE, JOFORTH_CHECKS_DEBUG (asserts, the default) or 
+//                          JOFORTH_CHECKS_ALWAYS, which are made in release builds as well. The 
+//                          engine makes them for every stack operation, in verified words too
+#define JOFORTH_CHECKS_NONE     0
+#define JOFORTH_CHECKS_DEBUG    1
+#define JOFORTH_CHECKS_ALWAYS   2
+
+#ifndef JOFORTH_CELL_BITS
+#define JOFORTH_CELL_BITS       64
+#endif
+#ifndef JOFORTH_IRSTACK_SIZE
+#define JOFORTH_IRSTACK_SIZE    256
+#endif
+#ifndef JOFORTH_CHECKS
+#define JOFORTH_CHECKS          JOFORTH_CHECKS_DEBUG
+#endif
+
+#if JOFORTH_CELL_BITS == 64
 typedef int64_t     joforth_value_t;
+typedef uint64_t    joforth_uvalue_t;
+#define JOFORTH_VALUE_MIN       INT64_MIN
+#define JOFORTH_VALUE_MAX       INT64_MAX
+#define JOFORTH_UVALUE_MAX      UINT64_MAX
+#elif JOFORTH_CELL_BITS == 32
+typedef int32_t     joforth_value_t;
+typedef uint32_t    joforth_uvalue_t;
+#define JOFORTH_VALUE_MIN       INT32_MIN
+#define JOFORTH_VALUE_MAX       INT32_MAX
+#define JOFORTH_UVALUE_MAX      UINT32_MAX
+#else
+#error "JOFORTH_CELL_BITS must be 32 or 64"
+#endif
+
+#if JOFORTH_CHECKS == JOFORTH_CHECKS_NONE
+#define _JOFORTH_CHECK(condition)   ((void)0)
+#elif JOFORTH_CHECKS == JOFORTH_CHECKS_ALWAYS
+// reports the failed check and aborts
+_Noreturn void _joforth_check_failed(const char* condition, const char* file, int line);
+#define _JOFORTH_CHECK(condition)   ((condition) ? (void)0 : _joforth_check_failed(#condition, __FILE__, __LINE__))
+#else
+#define _JOFORTH_CHECK(condition)   assert(condition)
+#endif
+
+// an address in the VM, i.e. an offset into joforth_t::_memory. Everything in _memory refers to
+// everything else by address so that the arena doesn't depend on where it's loaded
 typedef uint32_t    joforth_word_address_t;
 typedef uint32_t    joforth_word_key_t;
 typedef struct _joforth joforth_t;
 typedef struct _joforth_dict_entry _joforth_dict_entry_t;
+typedef union _joforth_cell _joforth_cell_t;
+// a compiled sentence, see joforth_compile
+typedef struct _joforth_statement joforth_statement_t;
+// a word in the dictionary, see joforth_find
+typedef const struct _joforth_dict_entry* joforth_word_t;
 
 typedef void (*joforth_word_handler_t)(joforth_t* joforth);
+// typed native functions, called with values taken directly from the stack, see joforth_add_unary etc.
+typedef joforth_value_t (*joforth_unary_fn_t)(joforth_value_t a);
+typedef joforth_value_t (*joforth_binary_fn_t)(joforth_value_t a, joforth_value_t b);
+typedef void (*joforth_array_fn_t)(joforth_value_t* values, size_t count);
 
 // used internally
 typedef struct _joforth_dict_entry {
-    joforth_word_key_t              _key;
-    // id
-    const char*                     _word;
-    const char*                     _doc;
+    // hot; everything the compiler and the engine need
     enum {
         kEntryType_Null,
         kEntryType_Native,
         kEntryType_Value,
         kEntryType_Word,
         kEntryType_Prefix,
+        // a language keyword, _rep._value is its kIr_xxx code
+        kEntryType_Keyword,
     } _type;
-    // value stack depth required (i.e. number of arguments to word)
-    size_t                           _depth;
+    // kEntryFlag_xxx
+    uint32_t                        _flags;
+    // kIr_xxx code of a built in primitive, executed by the engine in place of _rep._handler (0 if none)
+    uint8_t                         _primitive;
+    // kEntryType_Native only; kNativeSignature_xxx, i.e. which _rep member is used
+    uint8_t                         _signature;
+    // value stack depth required (i.e. number of arguments to word), and the number of values it 
+    // leaves in their place; inferred for verified words, otherwise as the stack comment declares
+    uint32_t                        _depth;
+    uint32_t                        _results;
     union {
         // a native callable function 
         joforth_word_handler_t          _handler;
+        // typed native functions
+        joforth_unary_fn_t              _unary;
+        joforth_binary_fn_t             _binary;
+        joforth_array_fn_t              _array;
         // a value to push on the stack during execution
         joforth_value_t                 _value;
-        // IR sequence, terminated with kIr_Null
-        uint8_t*                        _ir;  
+        // address of the IR sequence, terminated with kIr_Null
+        joforth_word_address_t          _ir;  
     } _rep;
+    // address of the threaded code translation of _rep._ir (JOFORTH_THREADED_CODE builds only)
+    joforth_word_address_t          _code;
 
-    // for hash table linking only
-    struct _joforth_dict_entry*     _next;
+    // cold; only used to confirm a lookup and by "see". Addresses of 0 terminated strings, 0 if none
+    joforth_word_address_t          _word;
+    joforth_word_address_t          _doc;
+    // the entry added before this one, 0 for the first. Unlike the dictionary this includes 
+    // entries which have been replaced, see joforth_load_image
+    joforth_word_address_t          _link;
 } _joforth_dict_entry_t;
 
+// _joforth_dict_entry_t::_signature
+enum {
+    // _rep._handler, which takes care of the stack itself
+    kNativeSignature_Handler = 0,
+    // _rep._unary, TOS is replaced by the result
+    kNativeSignature_Unary,
+    // _rep._binary, NOS and TOS are replaced by the result
+    kNativeSignature_Binary,
+    // _rep._array, operates in place on the top _depth values
+    kNativeSignature_Array,
+};
+
+// a slot in the open addressing dictionary table, the key and length are checked before the name is compared
+typedef struct _joforth_dict_slot {
+    joforth_word_key_t              _key;
+    // length of the name, 0 if the slot is free
+    uint32_t                        _length;
+    // address of the entry
+    joforth_word_address_t          _entry;
+} _joforth_dict_slot_t;
+
+// the native code of a word, kept by each VM rather than in the entry, which may be shared with 
+// other VMs (JOFORTH_JIT builds only)
+typedef struct _joforth_jit_word {
+    // address of the entry, 0 if the slot is free
+    joforth_word_address_t          _entry;
+    // calls counted up to JOFORTH_JIT_THRESHOLD, and the offset of the native code the word is then 
+    // compiled to in joforth_t::_jit, 0 if it hasn't been
+    uint32_t                        _calls;
+    uint32_t                        _jit;
+} _joforth_jit_word_t;
+
+// _joforth_dict_entry_t::_flags
+enum {
+    // always inline this word, set by "inline" when it's compiled
+    kEntryFlag_Inline = 0x1,
+    // never inline this word, set by "noinline" when it's compiled
+    kEntryFlag_NoInline = 0x2,
+    // a native which hasn't been bound to a function since the VM was loaded, see joforth_load_image
+    kEntryFlag_Unbound = 0x4,
+    // a built in native, which is bound again automatically when the VM is loaded
+    kEntryFlag_Builtin = 0x8,
+    // the stack effect, _depth and _results, is known. A verified colon word's effect has been 
+    // inferred from its IR, which only needs the stack to be checked once when the word is called
+    kEntryFlag_Verified = 0x10,
+};
+
+// an entry in the joforth_eval statement cache
+typedef struct _joforth_cached_statement {
+    joforth_word_key_t              _key;
+    // last joforth_eval "time" this was used, 0 if the slot is free
+    size_t                          _used;
+    char*                           _source;
+    joforth_statement_t*            _statement;
+} _joforth_cached_statement_t;
+
 #define JOFORTH_DEFAULT_STACK_SIZE      0x400
 #define JOFORTH_DEFAULT_MEMORY_SIZE     0x20000
 #define JOFORTH_DEFAULT_RSTACK_SIZE     0x100
+// joforth_t::_options
+// don't run the peephole optimiser on compiled words
+#define JOFORTH_OPTION_NO_PEEPHOLE      0x1
+// don't inline small words automatically (words marked "inline" still are)
+#define JOFORTH_OPTION_NO_INLINE        0x2
+
 #define JOFORTH_TRUE                    (~(joforth_value_t)0)
 #define JOFORTH_FALSE                   ((joforth_value_t)0)
 
@@ -63,16 +205,51 @@ typedef struct _joforth_allocator {
     void (*_free)(void*);
 } joforth_allocator_t;
 
+// receives the output of words like ".", "cr" and "see", and of joforth_dump_dict/_stack.
+// text is not zero terminated. If _write is 0 output goes to stdout.
+typedef struct _joforth_output {
+    void (*_write)(void* context, const char* text, size_t length);
+    void* _context;
+} joforth_output_t;
+
+// thread safety: joForth has no global mutable state, every joforth_t is independent of the others 
+// and can be used on its own thread without any synchronisation, including initialise, clone, 
+// load_image and destroy. A single joforth_t must not be used by more than one thread at a time.
+// Give each VM its own _output if output from different threads shouldn't interleave.
+
 // the joForth VM state
 typedef struct _joforth {
-    _joforth_dict_entry_t       *   _dict;
+    // dictionary, a power of 2 sized open addressing table allocated outside of _memory
+    _joforth_dict_slot_t        *   _dict;
+    size_t                          _dict_size;
+    size_t                          _dict_count;
+    // changes whenever a word is added
+    size_t                          _dict_generation;
+    // the most recently added entry, all entries are linked through _joforth_dict_entry_t::_link
+    joforth_word_address_t          _latest;
+    // number of natives which must be bound before the VM can run, see joforth_load_image
+    size_t                          _unbound_natives;
+    // the frozen VM this is an overlay of, words which aren't in _dict are looked up there, see joforth_attach
+    const struct _joforth       *   _parent;
+    // if frozen, the size of the part of the arena which is shared with overlays, see joforth_freeze
+    size_t                          _frozen;
+    // the (FILE*) temporary file the frozen part of the arena is mapped from, if it is
+    void                        *   _frozen_file;
+
+    // LRU cache of statements compiled by joforth_eval
+    _joforth_cached_statement_t *   _statement_cache;
+    size_t                          _statement_cache_time;
     joforth_value_t             *   _stack;
     uint8_t                     *   _memory;
+    // size of the mapping if _memory is mapped from an image file, 0 if it was allocated
+    size_t                          _memory_mapped;
 
     // buffers IR codes for the parser pass
     uint8_t                     *   _ir_buffer;
     size_t                          _irw;
     size_t                          _ir_buffer_size;
+    // threaded code translation of the IR buffer (JOFORTH_THREADED_CODE builds only)
+    _joforth_cell_t             *   _code_buffer;
 
     // return locations for IR code when executing
     uint8_t**                       _irstack;
@@ -80,19 +257,49 @@ typedef struct _joforth {
     size_t                          _irp;
 
     joforth_allocator_t             _allocator;
+    // where output goes, can be changed at any time (joforth_clone copies it)
+    joforth_output_t                _output;
     
+    // JOFORTH_OPTION_xxx flags, can be changed at any time
+    uint32_t                        _options;
     // current input base
     int                             _base;
-    // if 0 then default, in units of joforth_value_t 
+    // if 0 then default, in units of joforth_value_t; ignored, and set to JOFORTH_STACK_SIZE, if that's defined
     size_t                          _stack_size;
     // if 0 then default, in units of bytes
     size_t                          _memory_size;
+    // if 0 then joforth_eval doesn't cache statements, otherwise the number of statements it keeps
+    size_t                          _statement_cache_size;
     // stack pointers
     size_t                          _sp;
     // memory allocation pointer (we don't do "free")
     size_t                          _mp;
     // status code of last operation
     jo_status_t                     _status;
+
+    // if not 0, the number of calls and backward branches the VM can make in each joforth_eval, 
+    // _exec, _call or _resume before it is suspended; can be changed at any time
+    size_t                          _fuel;
+    // what's left of it while the VM runs
+    size_t                          _fuel_left;
+    // nesting depth of the engine, only the outermost run (1) is metered and can be suspended; not 
+    // the code run by natives which call joforth_eval etc. themselves
+    size_t                          _running;
+    // set when the VM has been suspended, by running out of fuel or by "yield", see joforth_resume
+    bool                            _suspended;
+    // where it continues, and the level of the IR return stack it finishes at
+    void                        *   _resume_ip;
+    size_t                          _resume_irp;
+
+    // executable region with the native code of hot words, and how much of it is used (JOFORTH_JIT builds only)
+    uint8_t                     *   _jit;
+    size_t                          _jit_used;
+    // the number of native calls being run, limited to JOFORTH_IRSTACK_SIZE like interpreted ones
+    size_t                          _jit_depth;
+    // open addressing table of the words which have been called, by entry address
+    _joforth_jit_word_t         *   _jit_words;
+    size_t                          _jit_words_size;
+    size_t                          _jit_words_count;
     
 } joforth_t;
 
@@ -100,8 +307,50 @@ typedef struct _joforth {
 void    joforth_initialise(joforth_t* joforth);
 // shutdown
 void    joforth_destroy(joforth_t* joforth);
+// create an independent copy of an initialised VM, for example a fresh VM for each request from a 
+// template with all the words it needs. This is a copy of the used part of the arena and of the 
+// dictionary table, dst uses the allocator and settings of src. Statements compiled by src with
+// joforth_compile can be executed by dst as well, as long as neither has added words since.
+// destroy dst with joforth_destroy as usual.
+bool    joforth_clone(joforth_t* dst, const joforth_t* src);
+// freeze an initialised VM so that it can be shared, read only, by any number of overlays created 
+// with joforth_attach. A frozen VM can't run anything or have words added, destroy it with 
+// joforth_destroy after all of its overlays.
+bool    joforth_freeze(joforth_t* joforth);
+// create a VM as an overlay of a frozen one; it has all the words of parent, and the words it 
+// defines itself shadow them. The arena of parent is shared, copy-on-write, where it can be mapped 
+// (otherwise it is copied) so an overlay only costs what it defines and writes. It uses the 
+// allocator and settings of parent, and it can be frozen in turn. Destroy it with joforth_destroy.
+bool    joforth_attach(joforth_t* joforth, const joforth_t* parent);
+// save the state of the VM to an image file, which can be loaded with joforth_load_image
+bool    joforth_save_image(joforth_t* joforth, const char* path);
+// load a VM from an image file created by joforth_save_image, instead of calling joforth_initialise.
+// set _allocator (and _statement_cache_size, if used) first. Where possible the arena is mapped 
+// copy-on-write from the file, so loading is independent of the size of the dictionary.
+// built in words are bound again automatically; your own native words must be added again, with 
+// the same signature, before anything else can be evaluated or called:
+//  joforth_load_image(&joforth, "base.jfi");
+//  joforth_add_word(&joforth, "emit", _emit, 1);
+// returns false if the file can't be read or if it was saved by an incompatible build.
+bool    joforth_load_image(joforth_t* joforth, const char* path);
+// save the words defined after the entry at since (the value of _latest at the time) to a module file,
+// which can be linked into any VM with joforth_load_module. Only colon words can be saved.
+// the joforthc tool compiles Forth source files to modules this way.
+bool    joforth_save_module(joforth_t* joforth, const char* path, joforth_word_address_t since);
+// link the words in a module file into the VM, without compiling them again. The words a module 
+// uses must exist, and be of the same kind (i.e. native or colon word, with the same signature) as
+// when it was compiled. Returns false, and adds nothing, if the module can't be linked.
+bool    joforth_load_module(joforth_t* joforth, const char* path);
 // add a word to the interpreter with an immediate evaluator (handler) and the required stack depth
 void    joforth_add_word(joforth_t* joforth, const char* word, joforth_word_handler_t handler, size_t depth);
+// add native words which are pure functions of values on the stack. They're called with 
+// their arguments taken directly from the stack, without the handler having to pop and push them.
+//  joforth_add_unary:  ( a -- f(a) )
+//  joforth_add_binary: ( a b -- f(a,b) )
+//  joforth_add_array:  operates in place on the top count values, values[0] is the top of the stack
+void    joforth_add_unary(joforth_t* joforth, const char* word, joforth_unary_fn_t fn);
+void    joforth_add_binary(joforth_t* joforth, const char* word, joforth_binary_fn_t fn);
+void    joforth_add_array(joforth_t* joforth, const char* word, joforth_array_fn_t fn, size_t count);
 // evaluate a sequence of words (sentence)
 // for example:
 //  joforth_eval(&joforth, ": squared ( a -- a*a ) dup *  ;");
@@ -109,28 +358,81 @@ void    joforth_add_word(joforth_t* joforth, const char* word, joforth_word_hand
 //  joforth_eval(&joforth, "squared");
 //
 bool    joforth_eval(joforth_t* joforth, const char* word);
+// compile a sentence once, so that it can be executed repeatedly without parsing it again
+// for example:
+//  joforth_statement_t* increment = joforth_compile(&joforth, "x @ 1 + x !");
+//  joforth_exec(&joforth, increment);
+//  ...
+//  joforth_free_statement(&joforth, increment);
+// words are bound when the statement is compiled, redefining them later doesn't affect it.
+// returns 0 on failure, word definitions can't be compiled this way.
+joforth_statement_t* joforth_compile(joforth_t* joforth, const char* sentence);
+// execute a statement returned by joforth_compile
+bool    joforth_exec(joforth_t* joforth, const joforth_statement_t* statement);
+// free a statement returned by joforth_compile
+void    joforth_free_statement(joforth_t* joforth, joforth_statement_t* statement);
+// find a word which can be called with joforth_call, returns 0 if there is no such word.
+// the handle stays valid for the lifetime of the VM, even if the word is redefined later.
+joforth_word_t joforth_find(joforth_t* joforth, const char* name);
+// call a word directly; pushes nargs values from args (args[nargs-1] ends up on top), 
+// executes the word and pops nresults values into results (results[nresults-1] was on top)
+// for example:
+//  joforth_word_t gcd = joforth_find(&joforth, "gcd");
+//  joforth_value_t args[2] = { 784, 48 };
+//  joforth_value_t result;
+//  joforth_call(&joforth, gcd, args, 2, &result, 1);
+//
+bool    joforth_call(joforth_t* joforth, joforth_word_t word, 
+            const joforth_value_t* args, size_t nargs, 
+            joforth_value_t* results, size_t nresults);
+// continue running a suspended VM where it left off, with a new _fuel budget. Like joforth_eval 
+// it returns true if it finished, false if it failed or if it was suspended again (_suspended).
+// Nothing else can run on a suspended VM until it has finished or joforth_cancel is called, and 
+// a statement it was executing mustn't be freed. If it was suspended in joforth_call the results 
+// are left on the stack.
+//  joforth._fuel = 10000;
+//  bool done = joforth_eval(&joforth, "long-running-word");
+//  while (!done && joforth._suspended) {
+//      ...do something else...
+//      done = joforth_resume(&joforth);
+//  }
+bool    joforth_resume(joforth_t* joforth);
+// abandon what a suspended VM was doing, whatever it left on the stack stays there
+void    joforth_cancel(joforth_t* joforth);
+
+// the size of the value stack, a constant if JOFORTH_STACK_SIZE is defined
+#if defined(JOFORTH_STACK_SIZE)
+#define _JOFORTH_STACK_SIZE(joforth)    ((void)(joforth), (size_t)JOFORTH_STACK_SIZE)
+#else
+#define _JOFORTH_STACK_SIZE(joforth)    ((joforth)->_stack_size)
+#endif
+
+// number of values on the stack
+static _JO_ALWAYS_INLINE size_t  joforth_stack_depth(const joforth_t* joforth) {
+    return _JOFORTH_STACK_SIZE(joforth) - 1 - joforth->_sp;
+}
 
 // push a value on the stack (use this in your handlers)
 // sets the zero flag if the value is 0
 static _JO_ALWAYS_INLINE void    joforth_push_value(joforth_t* joforth, joforth_value_t value) {
-    assert(joforth->_sp);
+    _JOFORTH_CHECK(joforth->_sp);
     joforth->_stack[joforth->_sp--] = value; 
 }
 
 // pop a value off the stack (use this in your handlers)
 static _JO_ALWAYS_INLINE joforth_value_t joforth_pop_value(joforth_t* joforth) {
-    assert(joforth->_sp < joforth->_stack_size-1);
+    _JOFORTH_CHECK(joforth->_sp < _JOFORTH_STACK_SIZE(joforth)-1);
     return joforth->_stack[++joforth->_sp];
 }
 
 // read top value from the stack (use this in your handlers)
 static _JO_ALWAYS_INLINE joforth_value_t    joforth_top_value(joforth_t* joforth) {
-    assert(joforth->_sp < joforth->_stack_size-1);
+    _JOFORTH_CHECK(joforth->_sp < _JOFORTH_STACK_SIZE(joforth)-1);
     return joforth->_stack[joforth->_sp+1];
 }
 
 static _JO_ALWAYS_INLINE joforth_value_t    joforth_stack_is_empty(joforth_t* joforth) {
-    return joforth->_sp == joforth->_stack_size-1;
+    return joforth->_sp == _JOFORTH_STACK_SIZE(joforth)-1;
 }
 
 // printf dictionary contents
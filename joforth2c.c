@@ -0,0 +1,583 @@
+// =======================================================================
+// joforth2c
+// translates Forth source files with word definitions to a C translation unit, ahead of time.
+// Each colon word becomes a C function which works directly on the VM's stack, and the unit
+// exports one function which adds them all to a VM as native words:
+//
+//  joforth2c [-n word[:depth][=function]] [-u word[=function]] [-b word[=function]]
+//            [-a word:count[=function]] [-m module] [-p prefix] -o output.c source...
+//
+//  -n, -u, -b, -a  declare a native word provided by the host, as with joforthc. If the C function
+//                  which implements it is given the translated code calls it directly, otherwise
+//                  the word is looked up by name every time it is called
+//  -m              a module the sources use, which must be loaded in the VM too
+//  -p              prefix of the exported function, <prefix>_register(joforth_t*); the default
+//                  is the name of the output file
+//
+// the sources are compiled to IR, optimised and inlined as usual, and each IR instruction is then
+// written out as the equivalent C. Words which use strings as values (other than with ."..."),
+// prefix words like create, or yield can't be translated. Translated words don't use fuel.
+//
+// build the output with the rest of the host, linked against joforth (JOFORTH_BUILD_AS_LIB), and
+// call the register function after joforth_initialise (and after adding the natives it uses).
+//
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "joforth.h"
+#include "joforth_ir.h"
+#include "joforth_source.h"
+
+// a native declared with a C function, which translated code calls directly
+typedef struct _native_function {
+    const char*     _word;
+    const char*     _function;
+} _native_function_t;
+
+typedef struct _translator {
+    joforth_t*                      _joforth;
+    FILE*                           _out;
+    // the words being translated, in the order they were defined
+    joforth_word_address_t*         _words;
+    size_t                          _count;
+    _native_function_t*             _functions;
+    size_t                          _num_functions;
+} _translator_t;
+
+static void _usage(void) {
+    fprintf(stderr, "usage: joforth2c [-n word[:depth][=function]] [-u word[=function]] [-b word[=function]] [-a word:count[=function]] [-m module] [-p prefix] -o output.c source...\n");
+}
+
+static const _joforth_dict_entry_t* _entry(const _translator_t* translator, joforth_word_address_t address) {
+    return (const _joforth_dict_entry_t*)(translator->_joforth->_memory + address);
+}
+
+static const char* _string(const _translator_t* translator, joforth_word_address_t address) {
+    return (const char*)(translator->_joforth->_memory + address);
+}
+
+// index of the translated word at address, _count if it isn't one
+static size_t _word_index(const _translator_t* translator, joforth_word_address_t address) {
+    size_t n = 0;
+    while (n < translator->_count && translator->_words[n] != address) {
+        ++n;
+    }
+    return n;
+}
+
+static const char* _native_function(const _translator_t* translator, const char* word) {
+    for (size_t n = 0; n < translator->_num_functions; ++n) {
+        if (strcmp(translator->_functions[n]._word, word) == 0) {
+            return translator->_functions[n]._function;
+        }
+    }
+    return 0;
+}
+
+// the C function of a translated word, _jf<index>_<name> with everything but letters and digits
+// in the name replaced
+static void _write_function_name(_translator_t* translator, size_t index) {
+    fprintf(translator->_out, "_jf%zu_", index);
+    for (const char* c = _string(translator, _entry(translator, translator->_words[index])->_word); *c; ++c) {
+        fputc(isalnum((unsigned char)*c) ? *c : '_', translator->_out);
+    }
+}
+
+static void _write_string_literal(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* c = (const unsigned char*)text; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        }
+        else if (*c < ' ' || *c > '~') {
+            // octal, so that a following digit can't be taken as part of the escape
+            fprintf(out, "\\%03o", *c);
+        }
+        else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// true if the IR at offset is the target of a branch in ir
+static bool _is_target(const uint8_t* ir, size_t offset) {
+    for (size_t i = 0; ir[i] != kIr_Null; i += 1 + _ir_operand_size((_joforth_ir_t)ir[i])) {
+        const _joforth_ir_t op = (_joforth_ir_t)ir[i];
+        if (_ir_is_branch(op)) {
+            const size_t end = i + 1 + _ir_operand_size(op);
+            if ((size_t)((joforth_value_t)end + _ir_operand(op, ir + i + 1)) == offset) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// a call to the word at address, which is either translated or looked up by name in the VM
+static void _write_call(_translator_t* translator, joforth_word_address_t address) {
+    FILE* out = translator->_out;
+    const size_t index = _word_index(translator, address);
+    fprintf(out, "    _JF_SPILL();\n    ");
+    if (index < translator->_count) {
+        _write_function_name(translator, index);
+        fprintf(out, "(joforth);\n");
+    }
+    else {
+        fprintf(out, "_jf_call(joforth, ");
+        _write_string_literal(out, _string(translator, _entry(translator, address)->_word));
+        fprintf(out, ");\n");
+    }
+    fprintf(out, "    _JF_FILL();\n    if (_JO_FAILED(joforth->_status)) {\n        return;\n    }\n");
+}
+
+static bool _translate_word(_translator_t* translator, size_t index) {
+    FILE* out = translator->_out;
+    const joforth_word_address_t self = translator->_words[index];
+    const _joforth_dict_entry_t* entry = _entry(translator, self);
+    const char* name = _string(translator, entry->_word);
+    const uint8_t* ir = translator->_joforth->_memory + entry->_rep._ir;
+
+    // only a tail call to itself needs the label at the start
+    bool loops = false;
+    for (size_t i = 0; ir[i] != kIr_Null; i += 1 + _ir_operand_size((_joforth_ir_t)ir[i])) {
+        loops = loops || (ir[i] == kIr_TailCall && (joforth_word_address_t)_ir_operand(kIr_TailCall, ir + i + 1) == self);
+    }
+
+    fprintf(out, "\n// : %s", name);
+    if (entry->_doc) {
+        fprintf(out, " (");
+        for (const char* c = _string(translator, entry->_doc); *c; ++c) {
+            fputc(*c == '\n' || *c == '\r' ? ' ' : *c, out);
+        }
+        fprintf(out, ")");
+    }
+    fprintf(out, "\nstatic void ");
+    _write_function_name(translator, index);
+    fprintf(out, "(joforth_t* joforth) {\n    joforth_value_t* const stack = joforth->_stack;\n    size_t sp;\n    joforth_value_t tos;\n    _JF_FILL();\n");
+    if ((entry->_flags & kEntryFlag_Verified) && entry->_depth) {
+        // the word's stack effect has been verified, so this is the only check it needs
+        fprintf(out, "    if (_JF_DEPTH() < %zu) {\n        joforth->_status = _JO_STATUS_INVALID_INPUT;\n        _JF_SPILL();\n        return;\n    }\n", (size_t)entry->_depth);
+    }
+    if (loops) {
+        fprintf(out, "_start:\n");
+    }
+
+    for (size_t i = 0; ir[i] != kIr_Null; i += 1 + _ir_operand_size((_joforth_ir_t)ir[i])) {
+        const _joforth_ir_t op = (_joforth_ir_t)ir[i];
+        const uint8_t* operand = ir + i + 1;
+        const size_t next = i + 1 + _ir_operand_size(op);
+        if (_is_target(ir, i)) {
+            fprintf(out, "_L%zu:\n", i);
+        }
+        switch (op) {
+        case kIr_DefineWord:
+        case kIr_EndDefineWord:
+            break;
+        case kIr_True:
+            fprintf(out, "    _JF_PUSH(JOFORTH_TRUE);\n");
+            break;
+        case kIr_False:
+            fprintf(out, "    _JF_PUSH(JOFORTH_FALSE);\n");
+            break;
+        case kIr_Invert:
+            fprintf(out, "    tos = ~tos;\n");
+            break;
+        case kIr_Value:
+        case kIr_Value8:
+        case kIr_Value32:
+            if (_ir_operand(op, operand) == JOFORTH_VALUE_MIN) {
+                fprintf(out, "    _JF_PUSH(JOFORTH_VALUE_MIN);\n");
+            }
+            else {
+                fprintf(out, "    _JF_PUSH(INT64_C(%lld));\n", (long long)_ir_operand(op, operand));
+            }
+            break;
+        case kIr_ValuePtr:
+            // only a string which is printed straight away, as by ."...", has a meaning outside of the VM
+            if (ir[next] != kIr_DotDot) {
+                fprintf(stderr, "joforth2c: \"%s\" uses a string as a value, it can't be translated\n", name);
+                return false;
+            }
+            break;
+        case kIr_DotDot:
+        {
+            // the string of the kIr_ValuePtr before this, which is the previous instruction
+            const uint8_t* string = ir + i - sizeof(_joforth_ir_address_t);
+            const char* text = _string(translator, (joforth_word_address_t)_ir_operand(kIr_ValuePtr, string));
+            fprintf(out, "    _jf_write(joforth, ");
+            _write_string_literal(out, text);
+            fprintf(out, ", %zu);\n", strlen(text));
+        }
+        break;
+        case kIr_Dot:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        _jf_print_value(joforth, value);\n    }\n");
+            break;
+        case kIr_Branch:
+            fprintf(out, "    goto _L%zu;\n", (size_t)((joforth_value_t)next + _ir_operand(op, operand)));
+            break;
+        case kIr_BranchIfZero:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        if (value == JOFORTH_FALSE) {\n            goto _L%zu;\n        }\n    }\n",
+                (size_t)((joforth_value_t)next + _ir_operand(op, operand)));
+            break;
+        case kIr_IfZeroOperator:
+            fprintf(out, "    if (tos == 0) {\n        goto _L%zu;\n    }\n", (size_t)((joforth_value_t)next + _ir_operand(op, operand)));
+            break;
+        case kIr_Loop:
+            // NOS is the index and TOS the end
+            fprintf(out, "    if (_JF_NOS + 1 < tos) {\n        ++_JF_NOS;\n        goto _L%zu;\n    }\n    _JF_DROP();\n    _JF_DROP();\n",
+                (size_t)((joforth_value_t)next + _ir_operand(op, operand)));
+            break;
+        case kIr_Native:
+        case kIr_NativeUnary:
+        case kIr_NativeBinary:
+        case kIr_NativeArray:
+        {
+            const _joforth_dict_entry_t* native = _entry(translator, (joforth_word_address_t)_ir_operand(op, operand));
+            const char* function = _native_function(translator, _string(translator, native->_word));
+            if (!function) {
+                _write_call(translator, (joforth_word_address_t)_ir_operand(op, operand));
+            }
+            else if (op == kIr_NativeUnary) {
+                fprintf(out, "    tos = %s(tos);\n", function);
+            }
+            else if (op == kIr_NativeBinary) {
+                fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        tos = %s(tos, value);\n    }\n", function);
+            }
+            else if (op == kIr_NativeArray) {
+                fprintf(out, "    stack[sp + 1] = tos;\n    %s(stack + sp + 1, %zu);\n    tos = stack[sp + 1];\n", function, (size_t)native->_depth);
+            }
+            else {
+                fprintf(out, "    _JF_SPILL();\n    %s(joforth);\n    _JF_FILL();\n    if (_JO_FAILED(joforth->_status)) {\n        return;\n    }\n", function);
+            }
+        }
+        break;
+        case kIr_Recurse:
+        case kIr_WordPtr:
+        case kIr_TailCall:
+        {
+            const joforth_word_address_t address = (joforth_word_address_t)_ir_operand(op, operand);
+            if (_entry(translator, address)->_type != kEntryType_Word) {
+                fprintf(stderr, "joforth2c: \"%s\" uses \"%s\", which can't be translated\n", name, _string(translator, _entry(translator, address)->_word));
+                return false;
+            }
+            if (op == kIr_TailCall && address == self) {
+                fprintf(out, "    goto _start;\n");
+                break;
+            }
+            _write_call(translator, address);
+            if (op == kIr_TailCall) {
+                fprintf(out, "    _JF_SPILL();\n    return;\n");
+            }
+        }
+        break;
+        case kIr_Yield:
+            fprintf(stderr, "joforth2c: \"%s\" can yield, it can't be translated\n", name);
+            return false;
+        case kIr_Plus:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        tos += value;\n    }\n");
+            break;
+        case kIr_Minus:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        tos -= value;\n    }\n");
+            break;
+        case kIr_Mul:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        tos *= value;\n    }\n");
+            break;
+        case kIr_Mod:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        tos %%= value;\n    }\n");
+            break;
+        case kIr_Lt:
+        case kIr_Gt:
+        case kIr_Eq:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        tos = tos %s value ? JOFORTH_TRUE : JOFORTH_FALSE;\n    }\n",
+                op == kIr_Lt ? "<" : (op == kIr_Gt ? ">" : "=="));
+            break;
+        case kIr_Dup:
+            fprintf(out, "    _JF_PUSH(tos);\n");
+            break;
+        case kIr_Drop:
+            fprintf(out, "    _JF_DROP();\n");
+            break;
+        case kIr_Swap:
+        case kIr_Tuck:
+            fprintf(out, "    if (_JF_DEPTH() < 2) {\n        joforth->_status = _JO_STATUS_INVALID_INPUT;\n        _JF_SPILL();\n        return;\n    }\n");
+            // fall through
+        case kIr_SwapUnchecked:
+        case kIr_TuckUnchecked:
+            if (op == kIr_Swap || op == kIr_SwapUnchecked) {
+                fprintf(out, "    {\n        const joforth_value_t nos = _JF_NOS;\n        _JF_NOS = tos;\n        tos = nos;\n    }\n");
+            }
+            else {
+                // a b -- b a b
+                fprintf(out, "    stack[sp + 1] = _JF_NOS;\n    _JF_NOS = tos;\n    --sp;\n");
+            }
+            break;
+        case kIr_Over:
+            // _JF_PUSH moves sp before it evaluates its argument
+            fprintf(out, "    {\n        const joforth_value_t nos = _JF_NOS;\n        _JF_PUSH(nos);\n    }\n");
+            break;
+        case kIr_At:
+            fprintf(out, "    tos = *(joforth_value_t*)(joforth->_memory + tos);\n");
+            break;
+        case kIr_Bang:
+            fprintf(out, "    {\n        joforth_value_t address;\n        joforth_value_t value;\n        _JF_POP(address);\n        _JF_POP(value);\n"
+                "        *(joforth_value_t*)(joforth->_memory + address) = value;\n    }\n");
+            break;
+        case kIr_AddImm:
+            fprintf(out, "    tos += %lld;\n", (long long)_ir_operand(op, operand));
+            break;
+        case kIr_LtImm:
+        case kIr_GtImm:
+        case kIr_EqImm:
+            fprintf(out, "    tos = tos %s %lld ? JOFORTH_TRUE : JOFORTH_FALSE;\n",
+                op == kIr_LtImm ? "<" : (op == kIr_GtImm ? ">" : "=="), (long long)_ir_operand(op, operand));
+            break;
+        case kIr_ZeroEq:
+            fprintf(out, "    tos = tos == 0 ? JOFORTH_TRUE : JOFORTH_FALSE;\n");
+            break;
+        case kIr_DupMul:
+            fprintf(out, "    tos *= tos;\n");
+            break;
+        case kIr_Nip:
+            fprintf(out, "    {\n        joforth_value_t value;\n        _JF_POP(value);\n        tos = value;\n    }\n");
+            break;
+        case kIr_OverPlus:
+            fprintf(out, "    tos += _JF_NOS;\n");
+            break;
+        default:
+            fprintf(stderr, "joforth2c: \"%s\" has an instruction (%d) which can't be translated\n", name, (int)op);
+            return false;
+        }
+    }
+    // branches past the last instruction, i.e. to the kIr_Null which returns
+    size_t end = 0;
+    while (ir[end] != kIr_Null) {
+        end += 1 + _ir_operand_size((_joforth_ir_t)ir[end]);
+    }
+    if (_is_target(ir, end)) {
+        fprintf(out, "_L%zu:\n", end);
+    }
+    fprintf(out, "    _JF_SPILL();\n}\n");
+    return true;
+}
+
+// what every translation unit starts with; the stack is cached as in the engine, and output
+// goes to the VM's sink like the built in words
+static const char* _preamble =
+    "#include <stdio.h>\n"
+    "#include <assert.h>\n"
+    "#include \"joforth.h\"\n"
+    "\n"
+    "#define _JF_DEPTH()                 (_JOFORTH_STACK_SIZE(joforth) - 1 - sp)\n"
+    "#define _JF_NOS                     stack[sp + 2]\n"
+    "#define _JF_PUSH(value)             _JOFORTH_CHECK(sp); stack[sp-- + 1] = tos; tos = (value)\n"
+    "#define _JF_POP(value)              _JOFORTH_CHECK(_JF_DEPTH()); (value) = tos; tos = stack[++sp + 1]\n"
+    "#define _JF_DROP()                  _JOFORTH_CHECK(_JF_DEPTH()); tos = stack[++sp + 1]\n"
+    "#define _JF_SPILL()                 stack[sp + 1] = tos; joforth->_sp = sp\n"
+    "#define _JF_FILL()                  sp = joforth->_sp; tos = stack[sp + 1]\n"
+    "\n"
+    "static inline void _jf_write(joforth_t* joforth, const char* text, size_t length) {\n"
+    "    if (joforth->_output._write) {\n"
+    "        joforth->_output._write(joforth->_output._context, text, length);\n"
+    "    }\n"
+    "    else {\n"
+    "        fwrite(text, 1, length, stdout);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void _jf_print_value(joforth_t* joforth, joforth_value_t value) {\n"
+    "    char buffer[32];\n"
+    "    int length;\n"
+    "    switch (joforth->_base) {\n"
+    "    case 10:\n"
+    "        length = snprintf(buffer, sizeof(buffer), \"%lld\", (long long)value);\n"
+    "        break;\n"
+    "    case 16:\n"
+    "        length = snprintf(buffer, sizeof(buffer), \"%llx\", (unsigned long long)(joforth_uvalue_t)value);\n"
+    "        break;\n"
+    "    default:\n"
+    "        length = snprintf(buffer, sizeof(buffer), \"NaN\");\n"
+    "        break;\n"
+    "    }\n"
+    "    _jf_write(joforth, buffer, (size_t)length);\n"
+    "}\n"
+    "\n"
+    "// words which aren't translated, on the stack as it is\n"
+    "static inline void _jf_call(joforth_t* joforth, const char* name) {\n"
+    "    joforth_word_t word = joforth_find(joforth, name);\n"
+    "    if (!word) {\n"
+    "        joforth->_status = _JO_STATUS_INVALID_INPUT;\n"
+    "        return;\n"
+    "    }\n"
+    "    joforth_call(joforth, word, 0, 0, 0, 0);\n"
+    "}\n";
+
+static bool _translate(_translator_t* translator, const char* prefix) {
+    FILE* out = translator->_out;
+    fprintf(out, "// generated by joforth2c, don't edit\n%s", _preamble);
+
+    // the natives with C functions, as their signatures
+    if (translator->_num_functions) {
+        fprintf(out, "\n");
+    }
+    for (size_t n = 0; n < translator->_num_functions; ++n) {
+        const _joforth_dict_entry_t* native = joforth_find(translator->_joforth, translator->_functions[n]._word);
+        switch (native->_signature) {
+        case kNativeSignature_Unary:
+            fprintf(out, "joforth_value_t %s(joforth_value_t a);\n", translator->_functions[n]._function);
+            break;
+        case kNativeSignature_Binary:
+            fprintf(out, "joforth_value_t %s(joforth_value_t a, joforth_value_t b);\n", translator->_functions[n]._function);
+            break;
+        case kNativeSignature_Array:
+            fprintf(out, "void %s(joforth_value_t* values, size_t count);\n", translator->_functions[n]._function);
+            break;
+        default:
+            fprintf(out, "void %s(joforth_t* joforth);\n", translator->_functions[n]._function);
+        }
+    }
+    fprintf(out, "\n");
+    for (size_t n = 0; n < translator->_count; ++n) {
+        fprintf(out, "static void ");
+        _write_function_name(translator, n);
+        fprintf(out, "(joforth_t* joforth);\n");
+    }
+    for (size_t n = 0; n < translator->_count; ++n) {
+        if (!_translate_word(translator, n)) {
+            return false;
+        }
+    }
+
+    fprintf(out, "\nvoid %s_register(joforth_t* joforth) {\n", prefix);
+    for (size_t n = 0; n < translator->_count; ++n) {
+        const _joforth_dict_entry_t* entry = _entry(translator, translator->_words[n]);
+        fprintf(out, "    joforth_add_word(joforth, ");
+        _write_string_literal(out, _string(translator, entry->_word));
+        fprintf(out, ", ");
+        _write_function_name(translator, n);
+        fprintf(out, ", %zu);\n", (size_t)entry->_depth);
+    }
+    fprintf(out, "}\n");
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+
+    joforth_t joforth;
+    memset(&joforth, 0, sizeof(joforth));
+    joforth._allocator = *(&(joforth_allocator_t){
+        ._alloc = malloc,
+        ._free = free,
+    });
+    joforth_initialise(&joforth);
+
+    _translator_t translator = { ._joforth = &joforth };
+    translator._functions = (_native_function_t*)malloc((size_t)argc * sizeof(_native_function_t));
+
+    const char* output = 0;
+    const char* prefix = 0;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        const char option = argv[arg][1];
+        if (!option || argv[arg][2] || arg + 1 == argc) {
+            _usage();
+            return 1;
+        }
+        char* value = argv[++arg];
+        switch (option) {
+        case 'n':
+        case 'u':
+        case 'b':
+        case 'a':
+        {
+            char* function = strchr(value, '=');
+            if (function) {
+                *function++ = 0;
+            }
+            joforth_source_declare_native(&joforth, option, value);
+            if (function) {
+                translator._functions[translator._num_functions++] = (_native_function_t){ ._word = value, ._function = function };
+            }
+        }
+        break;
+        case 'm':
+            if (!joforth_load_module(&joforth, value)) {
+                fprintf(stderr, "joforth2c: can't load module \"%s\"\n", value);
+                return 1;
+            }
+            break;
+        case 'o':
+            output = value;
+            break;
+        case 'p':
+            prefix = value;
+            break;
+        default:
+            _usage();
+            return 1;
+        }
+        if (_JO_FAILED(joforth._status)) {
+            fprintf(stderr, "joforth2c: invalid argument \"%s\"\n", value);
+            return 1;
+        }
+    }
+    if (!output || arg == argc) {
+        _usage();
+        return 1;
+    }
+
+    // the default prefix is the name of the output file, as an identifier
+    char default_prefix[JOFORTH_MAX_WORD_LENGTH];
+    if (!prefix) {
+        const char* base = strrchr(output, '/');
+        base = base ? base + 1 : output;
+        size_t length = 0;
+        for (; base[length] && base[length] != '.' && length < sizeof(default_prefix) - 1; ++length) {
+            default_prefix[length] = isalnum((unsigned char)base[length]) ? base[length] : '_';
+        }
+        default_prefix[length] = 0;
+        prefix = default_prefix;
+    }
+
+    // everything defined from here on is translated
+    const joforth_word_address_t since = joforth._latest;
+    for (; arg < argc; ++arg) {
+        char* source = joforth_source_read(argv[arg]);
+        if (!source) {
+            fprintf(stderr, "joforth2c: can't read \"%s\"\n", argv[arg]);
+            return 1;
+        }
+        const bool compiled = joforth_source_compile(&joforth, argv[arg], source);
+        free(source);
+        if (!compiled) {
+            return 1;
+        }
+    }
+
+    // the words, oldest first
+    for (joforth_word_address_t address = joforth._latest; address != since; address = _entry(&translator, address)->_link) {
+        ++translator._count;
+    }
+    translator._words = (joforth_word_address_t*)malloc((translator._count + 1) * sizeof(joforth_word_address_t));
+    size_t n = translator._count;
+    for (joforth_word_address_t address = joforth._latest; address != since; address = _entry(&translator, address)->_link) {
+        translator._words[--n] = address;
+    }
+
+    translator._out = fopen(output, "w");
+    if (!translator._out) {
+        fprintf(stderr, "joforth2c: can't write \"%s\"\n", output);
+        return 1;
+    }
+    const bool translated = _translate(&translator, prefix);
+    fclose(translator._out);
+    if (!translated) {
+        remove(output);
+        return 1;
+    }
+    free(translator._words);
+    free(translator._functions);
+    joforth_destroy(&joforth);
+    return 0;
+}
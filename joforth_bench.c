@@ -0,0 +1,91 @@
+// =======================================================================
+// joforth_bench
+// measures the throughput of the worker pool with 1, 2, 4... threads up to the number of cores,
+// or the given maximum, with jobs whose run times vary by a factor of about 100.
+//
+//  joforth_bench [jobs] [max threads]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "joforth_pool.h"
+
+static double _now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// returns jobs per second
+static double _run(const joforth_t* prototype, size_t threads, size_t num_jobs, joforth_job_t** jobs) {
+    joforth_pool_t* pool = joforth_pool_create(prototype, threads);
+    if (!pool) {
+        fprintf(stderr, "joforth_bench: can't create a pool with %zu threads\n", threads);
+        exit(1);
+    }
+    char script[32];
+    const double start = _now();
+    for (size_t n = 0; n < num_jobs; ++n) {
+        // mostly short jobs, with a long one every so often
+        snprintf(script, sizeof(script), "%zu fib", (n % 16) == 0 ? (size_t)22 : 12 + (n % 5));
+        jobs[n] = joforth_pool_submit(pool, script);
+    }
+    for (size_t n = 0; n < num_jobs; ++n) {
+        if (!joforth_job_wait(jobs[n])) {
+            fprintf(stderr, "joforth_bench: job %zu failed\n", n);
+            exit(1);
+        }
+    }
+    const double elapsed = _now() - start;
+    for (size_t n = 0; n < num_jobs; ++n) {
+        joforth_job_free(pool, jobs[n]);
+    }
+    joforth_pool_destroy(pool);
+    return (double)num_jobs / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+
+    const size_t num_jobs = argc > 1 ? (size_t)strtoul(argv[1], 0, 10) : 20000;
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t max_threads = argc > 2 ? (size_t)strtoul(argv[2], 0, 10) : (cores > 0 ? (size_t)cores : 1);
+    if (!num_jobs || !max_threads) {
+        fprintf(stderr, "usage: joforth_bench [jobs] [max threads]\n");
+        return 1;
+    }
+
+    // the workers share the frozen prototype's dictionary
+    joforth_t prototype;
+    memset(&prototype, 0, sizeof(prototype));
+    prototype._allocator = *(&(joforth_allocator_t){
+        ._alloc = malloc,
+        ._free = free,
+    });
+    joforth_initialise(&prototype);
+    if (!joforth_eval(&prototype, ": FIB ( n -- f ) dup 2 < if else dup 1 - recurse swap 2 - recurse + endif ;")
+        || !joforth_freeze(&prototype)) {
+        fprintf(stderr, "joforth_bench: can't create the prototype\n");
+        return 1;
+    }
+
+    joforth_job_t** jobs = (joforth_job_t**)malloc(num_jobs * sizeof(joforth_job_t*));
+    printf("%zu jobs\nthreads       jobs/s    speedup\n", num_jobs);
+    double single = 0.0;
+    for (size_t threads = 1;; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+        const double rate = _run(&prototype, threads, num_jobs, jobs);
+        if (threads == 1) {
+            single = rate;
+        }
+        printf("%7zu %12.0f %10.2f\n", threads, rate, rate / single);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+    free(jobs);
+    joforth_destroy(&prototype);
+    return 0;
+}
@@ -7,12 +7,13 @@
 typedef enum _joforth_ir {
 
     kIr_Null = 0,
-    kIr_DefineWord,              // ":"
-    kIr_WordPtr,                 // followed by 64 bit pointer to a joforth_dict_t entry
-    kIr_ValuePtr,                // followed by 64 bit pointer to a 0 terminated string
+    kIr_DefineWord,              // ":", followed by the address of the name of the word
+    kIr_WordPtr,                 // followed by the address of a joforth_dict_t entry
+    kIr_ValuePtr,                // followed by the address of a 0 terminated string, which is pushed
     kIr_Value,                   // followed by a 64 bit immediate value
-    kIr_Native,                  // followed by 64 bit pointer to native handler routine
-    kIr_IfZeroOperator,          // ? prefix to words, like "?dup"
+    kIr_Native,                  // followed by the address of the joforth_dict_t entry of a native handler
+    kIr_IfZeroOperator,          // ? prefix to words, like "?dup", followed by an offset past the word
+    // control flow keywords are resolved to branches when the IR is generated and never executed
     kIr_If,
     kIr_Else,
     kIr_Endif,
@@ -21,17 +22,75 @@ typedef enum _joforth_ir {
     kIr_While,
     kIr_Repeat,
     kIr_Do,
-    kIr_Loop,
+    kIr_Loop,                    // followed by the offset back to the instruction following DO
     kIr_EndDefineWord,    
-    kIr_Recurse,
+    kIr_Recurse,                 // followed by the address of the joforth_dict_t entry of the word itself
     kIr_Dot,                    // . <tos value>
-    kIr_DotDot,                 // .<string pointer>
+    kIr_DotDot,                 // .<string address>
     kIr_True,
     kIr_False,
     kIr_Invert,
+    kIr_Inline,                  // compile time only, marks the word being compiled
+    kIr_NoInline,                // compile time only, marks the word being compiled
+    kIr_TailCall,                // kIr_WordPtr in tail position, doesn't return
+    kIr_Branch,                  // followed by a relative offset
+    kIr_BranchIfZero,            // followed by a relative offset, taken if TOS (popped) is 0
+    // superinstructions generated by the peephole optimiser
+    kIr_AddImm,                  // "<value> +", followed by a 32 bit immediate value
+    kIr_LtImm,                   // "<value> <", followed by a 32 bit immediate value
+    kIr_GtImm,                   // "<value> >", followed by a 32 bit immediate value
+    kIr_EqImm,                   // "<value> =", followed by a 32 bit immediate value
+    kIr_ZeroEq,                  // "0 ="
+    kIr_DupMul,                  // "dup *"
+    kIr_Nip,                     // "swap drop"
+    kIr_OverPlus,                // "over +"
 
+    // primitives, built in native words executed directly by the engine
+    kIr_Plus,
+    kIr_Minus,
+    kIr_Mul,
+    kIr_Mod,
+    kIr_Lt,
+    kIr_Gt,
+    kIr_Eq,
+    kIr_Dup,
+    kIr_Drop,
+    kIr_Swap,
+    kIr_Over,
+    kIr_Tuck,
+    kIr_At,
+    kIr_Bang,
+
+    // typed natives, see joforth_add_unary etc., followed by the address of the joforth_dict_t entry
+    kIr_NativeUnary,
+    kIr_NativeBinary,
+    kIr_NativeArray,
+
+    // compact forms of kIr_Value
+    kIr_Value8,                  // followed by an 8 bit immediate value
+    kIr_Value32,                 // followed by a 32 bit immediate value
+
+    kIr_Yield,                   // suspends the VM, see joforth_resume
+
+    // swap and tuck in verified code, where they can't underflow and don't check the stack
+    kIr_SwapUnchecked,
+    kIr_TuckUnchecked,
+
+    kIr_NumCodes
 } _joforth_ir_t;
 
+// branch offsets are relative to the end of the branch instruction
+typedef int16_t _joforth_ir_offset_t;
+// references to words and strings are addresses, i.e. offsets into joforth_t::_memory, which 
+// makes the IR (and the arena) position independent
+typedef joforth_word_address_t _joforth_ir_address_t;
+
+// a cell of threaded code; either the address of an instruction handler or an operand
+typedef union _joforth_cell {
+    const void*         _label;
+    joforth_value_t     _value;
+} _joforth_cell_t;
+
 typedef struct _joforth_keyword_lut_entry {
     const char*     _id;
     _joforth_ir_t   _ir;
@@ -52,6 +111,9 @@ static const _joforth_keyword_lut_entry_t _joforth_keyword_lut[] = {
     { ._id = "repeat", ._ir = kIr_Repeat },
     { ._id = "do", ._ir = kIr_Do },
     { ._id = "loop", ._ir = kIr_Loop },
+    { ._id = "inline", ._ir = kIr_Inline },
+    { ._id = "noinline", ._ir = kIr_NoInline },
+    { ._id = "yield", ._ir = kIr_Yield },
 };
 static const size_t _joforth_keyword_lut_size = sizeof(_joforth_keyword_lut)/sizeof(_joforth_keyword_lut_entry_t);
 
@@ -60,16 +122,162 @@ static _JO_ALWAYS_INLINE void _ir_emit(joforth_t* joforth, _joforth_ir_t ir) {
     joforth->_ir_buffer[joforth->_irw++] = (uint8_t)(ir & 0xff);
 }
 
-static _JO_ALWAYS_INLINE void _ir_emit_ptr(joforth_t* joforth, void* ptr) {
-    assert(joforth->_irw < joforth->_ir_buffer_size-sizeof(void*)-1);
-    memcpy(joforth->_ir_buffer + joforth->_irw, &ptr, sizeof(void*));
-    joforth->_irw += sizeof(void*);
+static _JO_ALWAYS_INLINE void _ir_emit_address(joforth_t* joforth, _joforth_ir_address_t address) {
+    assert(joforth->_irw < joforth->_ir_buffer_size-sizeof(address)-1);
+    memcpy(joforth->_ir_buffer + joforth->_irw, &address, sizeof(address));
+    joforth->_irw += sizeof(address);
+}
+
+// size, in bytes, of the operand following an IR code
+static _JO_ALWAYS_INLINE size_t _ir_operand_size(_joforth_ir_t ir) {
+    switch (ir) {
+    case kIr_DefineWord:
+    case kIr_WordPtr:
+    case kIr_ValuePtr:
+    case kIr_Native:
+    case kIr_NativeUnary:
+    case kIr_NativeBinary:
+    case kIr_NativeArray:
+    case kIr_Recurse:
+    case kIr_TailCall:
+        return sizeof(_joforth_ir_address_t);
+    case kIr_Value:
+        return sizeof(joforth_value_t);
+    case kIr_Value8:
+        return sizeof(int8_t);
+    case kIr_Value32:
+    case kIr_AddImm:
+    case kIr_LtImm:
+    case kIr_GtImm:
+    case kIr_EqImm:
+        return sizeof(int32_t);
+    case kIr_IfZeroOperator:
+    case kIr_Loop:
+    case kIr_Branch:
+    case kIr_BranchIfZero:
+        return sizeof(_joforth_ir_offset_t);
+    default:
+        return 0;
+    }
+}
+
+// true if the IR code is followed by a branch offset
+static _JO_ALWAYS_INLINE bool _ir_is_branch(_joforth_ir_t ir) {
+    return ir == kIr_IfZeroOperator || ir == kIr_Loop || ir == kIr_Branch || ir == kIr_BranchIfZero;
+}
+
+// true if the IR code is followed by an address
+static _JO_ALWAYS_INLINE bool _ir_is_address(_joforth_ir_t ir) {
+    switch (ir) {
+    case kIr_DefineWord:
+    case kIr_WordPtr:
+    case kIr_ValuePtr:
+    case kIr_Native:
+    case kIr_NativeUnary:
+    case kIr_NativeBinary:
+    case kIr_NativeArray:
+    case kIr_Recurse:
+    case kIr_TailCall:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the operand of an IR code at operand, immediates are sign extended
+static _JO_ALWAYS_INLINE joforth_value_t _ir_operand(_joforth_ir_t ir, const uint8_t* operand) {
+    if (_ir_is_address(ir)) {
+        _joforth_ir_address_t address;
+        memcpy(&address, operand, sizeof(address));
+        return (joforth_value_t)address;
+    }
+    switch (_ir_operand_size(ir)) {
+    case sizeof(int8_t):
+        return (int8_t)operand[0];
+    case sizeof(int16_t):
+    {
+        int16_t value;
+        memcpy(&value, operand, sizeof(value));
+        return value;
+    }
+    case sizeof(int32_t):
+    {
+        int32_t value;
+        memcpy(&value, operand, sizeof(value));
+        return value;
+    }
+    case sizeof(int64_t):
+    {
+        int64_t value;
+        memcpy(&value, operand, sizeof(value));
+        return value;
+    }
+    default:
+        return 0;
+    }
 }
 
-static _JO_ALWAYS_INLINE void _ir_emit_value(joforth_t *joforth, joforth_value_t value) {
-    assert(joforth->_irw < joforth->_ir_buffer_size-sizeof(value)-1);
-    memcpy(joforth->_ir_buffer + joforth->_irw, &value, sizeof(value));
-    joforth->_irw += sizeof(value);
+// emits the operand of an IR code, the value must fit in the operand
+static _JO_ALWAYS_INLINE void _ir_emit_operand(joforth_t* joforth, _joforth_ir_t ir, joforth_value_t value) {
+    const size_t size = _ir_operand_size(ir);
+    assert(joforth->_irw < joforth->_ir_buffer_size - size - 1);
+    uint8_t* operand = joforth->_ir_buffer + joforth->_irw;
+    if (_ir_is_address(ir)) {
+        const _joforth_ir_address_t address = (_joforth_ir_address_t)value;
+        memcpy(operand, &address, sizeof(address));
+    }
+    else {
+        switch (size) {
+        case sizeof(int8_t):
+            operand[0] = (uint8_t)(int8_t)value;
+            break;
+        case sizeof(int16_t):
+        {
+            const int16_t v = (int16_t)value;
+            memcpy(operand, &v, sizeof(v));
+        }
+        break;
+        case sizeof(int32_t):
+        {
+            const int32_t v = (int32_t)value;
+            memcpy(operand, &v, sizeof(v));
+        }
+        break;
+        case sizeof(int64_t):
+        {
+            const int64_t v = (int64_t)value;
+            memcpy(operand, &v, sizeof(v));
+        }
+        break;
+        default:;
+        }
+    }
+    joforth->_irw += size;
+}
+
+static _JO_ALWAYS_INLINE bool _ir_fits_int32(joforth_value_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// the most compact form of kIr_Value for value
+static _JO_ALWAYS_INLINE _joforth_ir_t _ir_literal(joforth_value_t value) {
+    if (value >= INT8_MIN && value <= INT8_MAX) {
+        return kIr_Value8;
+    }
+    return _ir_fits_int32(value) ? kIr_Value32 : kIr_Value;
+}
+
+// emits a literal value using the most compact form
+static _JO_ALWAYS_INLINE void _ir_emit_literal(joforth_t* joforth, joforth_value_t value) {
+    const _joforth_ir_t ir = _ir_literal(value);
+    _ir_emit(joforth, ir);
+    _ir_emit_operand(joforth, ir, value);
+}
+
+static _JO_ALWAYS_INLINE void _ir_emit_offset(joforth_t *joforth, _joforth_ir_offset_t offset) {
+    assert(joforth->_irw < joforth->_ir_buffer_size-sizeof(offset)-1);
+    memcpy(joforth->_ir_buffer + joforth->_irw, &offset, sizeof(offset));
+    joforth->_irw += sizeof(offset);
 }
 
 static _JO_ALWAYS_INLINE uint8_t* _ir_consume(uint8_t* buffer, _joforth_ir_t* ir) {
@@ -77,9 +285,9 @@ static _JO_ALWAYS_INLINE uint8_t* _ir_consume(uint8_t* buffer, _joforth_ir_t* ir
     return buffer;
 }
 
-static _JO_ALWAYS_INLINE uint8_t* _ir_consume_ptr(uint8_t* buffer, void**ptr) {
-    memcpy(ptr, buffer, sizeof(void*));
-    buffer+=sizeof(void*);
+static _JO_ALWAYS_INLINE uint8_t* _ir_consume_address(uint8_t* buffer, _joforth_ir_address_t* address) {
+    memcpy(address, buffer, sizeof(_joforth_ir_address_t));
+    buffer += sizeof(_joforth_ir_address_t);
     return buffer;
 }
 
@@ -88,3 +296,15 @@ static _JO_ALWAYS_INLINE uint8_t* _ir_consume_value(uint8_t* buffer, joforth_val
     buffer += sizeof(joforth_value_t);
     return buffer;
 }
+
+static _JO_ALWAYS_INLINE uint8_t* _ir_consume_offset(uint8_t* buffer, _joforth_ir_offset_t* offset) {
+    memcpy(offset, buffer, sizeof(_joforth_ir_offset_t));
+    buffer += sizeof(_joforth_ir_offset_t);
+    return buffer;
+}
+
+static _JO_ALWAYS_INLINE uint8_t* _ir_consume_operand(uint8_t* buffer, void* operand, size_t size) {
+    memcpy(operand, buffer, size);
+    buffer += size;
+    return buffer;
+}
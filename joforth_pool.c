@@ -0,0 +1,394 @@
+
+#include "joforth_pool.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// =====================================================================================
+// work-stealing deques
+//
+// Chase-Lev deques, with the memory orders of "Correct and Efficient Work-Stealing for
+// Weak Memory Models" (Lê et al.). Only the owning worker pushes and takes, at the bottom,
+// any other worker can steal from the top. The deques have a fixed size; a worker only
+// fills its own from the shared queue, so it never takes more than fits.
+// =====================================================================================
+
+#define JOFORTH_POOL_DEQUE_SIZE     256
+// keeps the ends of a deque, which are written by different threads, on separate cache lines
+#define JOFORTH_POOL_CACHE_LINE     64
+
+typedef struct _joforth_deque {
+    _Atomic int64_t                 _top;
+    char                            _pad0[JOFORTH_POOL_CACHE_LINE - sizeof(int64_t)];
+    _Atomic int64_t                 _bottom;
+    char                            _pad1[JOFORTH_POOL_CACHE_LINE - sizeof(int64_t)];
+    _Atomic(joforth_job_t*)         _jobs[JOFORTH_POOL_DEQUE_SIZE];
+} _joforth_deque_t;
+
+// owner only, false if the deque is full
+static bool _deque_push(_joforth_deque_t* deque, joforth_job_t* job) {
+    const int64_t bottom = atomic_load_explicit(&deque->_bottom, memory_order_relaxed);
+    const int64_t top = atomic_load_explicit(&deque->_top, memory_order_acquire);
+    if (bottom - top >= JOFORTH_POOL_DEQUE_SIZE) {
+        return false;
+    }
+    atomic_store_explicit(&deque->_jobs[bottom & (JOFORTH_POOL_DEQUE_SIZE - 1)], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->_bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
+
+// owner only, the most recently pushed job or 0 if it's empty
+static joforth_job_t* _deque_take(_joforth_deque_t* deque) {
+    const int64_t bottom = atomic_load_explicit(&deque->_bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->_bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->_top, memory_order_relaxed);
+    if (top > bottom) {
+        // empty
+        atomic_store_explicit(&deque->_bottom, bottom + 1, memory_order_relaxed);
+        return 0;
+    }
+    joforth_job_t* job = atomic_load_explicit(&deque->_jobs[bottom & (JOFORTH_POOL_DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (top == bottom) {
+        // the last one, which a thief may be taking at the same time
+        if (!atomic_compare_exchange_strong_explicit(&deque->_top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            job = 0;
+        }
+        atomic_store_explicit(&deque->_bottom, bottom + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+// any thread, the oldest job or 0 if it's empty or another thread got there first
+static joforth_job_t* _deque_steal(_joforth_deque_t* deque) {
+    int64_t top = atomic_load_explicit(&deque->_top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const int64_t bottom = atomic_load_explicit(&deque->_bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return 0;
+    }
+    joforth_job_t* job = atomic_load_explicit(&deque->_jobs[top & (JOFORTH_POOL_DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->_top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return 0;
+    }
+    return job;
+}
+
+static bool _deque_is_empty(_joforth_deque_t* deque) {
+    return atomic_load_explicit(&deque->_top, memory_order_acquire) >= atomic_load_explicit(&deque->_bottom, memory_order_acquire);
+}
+
+// =====================================================================================
+// the pool
+// =====================================================================================
+
+struct _joforth_job {
+    // next in the shared queue
+    joforth_job_t*                  _next;
+    pthread_mutex_t                 _lock;
+    pthread_cond_t                  _finished;
+    atomic_bool                     _done;
+    jo_status_t                     _status;
+    joforth_value_t*                _results;
+    size_t                          _result_count;
+    char                            _script[];
+};
+
+typedef struct _joforth_worker {
+    _joforth_deque_t                _deque;
+    joforth_pool_t*                 _pool;
+    pthread_t                       _thread;
+    joforth_t                       _vm;
+    // xorshift state, for picking the workers to steal from
+    uint64_t                        _random;
+    // the VM is written all the time, keep it off the next worker's deque
+    char                            _pad[JOFORTH_POOL_CACHE_LINE];
+} _joforth_worker_t;
+
+struct _joforth_pool {
+    const joforth_t*                _prototype;
+    joforth_allocator_t             _allocator;
+    _joforth_worker_t*              _workers;
+    size_t                          _num_workers;
+    // number of workers whose threads have been started, they all are unless creating the pool failed
+    size_t                          _num_threads;
+    // jobs which have been submitted and haven't finished
+    atomic_size_t                   _pending;
+
+    // _lock protects everything below
+    pthread_mutex_t                 _lock;
+    // idle workers wait for this
+    pthread_cond_t                  _wake;
+    // joforth_pool_destroy waits for this
+    pthread_cond_t                  _idle;
+    // the shared queue, first in first out
+    joforth_job_t*                  _head;
+    joforth_job_t*                  _tail;
+    size_t                          _queued;
+    size_t                          _sleeping;
+    bool                            _stopping;
+};
+
+static bool _create_vm(const joforth_pool_t* pool, joforth_t* vm) {
+    return pool->_prototype->_frozen ? joforth_attach(vm, pool->_prototype) : joforth_clone(vm, pool->_prototype);
+}
+
+static void _run_job(_joforth_worker_t* worker, joforth_job_t* job) {
+    joforth_pool_t* pool = worker->_pool;
+    joforth_t* vm = &worker->_vm;
+    const size_t mp = vm->_mp;
+    const joforth_word_address_t latest = vm->_latest;
+
+    const bool ok = joforth_eval(vm, job->_script);
+    job->_status = ok ? _JO_STATUS_SUCCESS : (_JO_FAILED(vm->_status) ? vm->_status : _JO_STATUS_INVALID_INPUT);
+    // the stack, bottom first
+    job->_result_count = joforth_stack_depth(vm);
+    job->_results = 0;
+    if (job->_result_count) {
+        job->_results = (joforth_value_t*)pool->_allocator._alloc(job->_result_count * sizeof(joforth_value_t));
+        for (size_t n = 0; n < job->_result_count; ++n) {
+            job->_results[n] = vm->_stack[_JOFORTH_STACK_SIZE(vm) - 1 - n];
+        }
+    }
+
+    // the next job starts with a clean VM
+    if (!ok || vm->_mp != mp || vm->_latest != latest) {
+        joforth_destroy(vm);
+        const bool created = _create_vm(pool, vm);
+        assert(created);
+        (void)created;
+    }
+    else {
+        vm->_sp = _JOFORTH_STACK_SIZE(vm) - 1;
+    }
+
+    pthread_mutex_lock(&job->_lock);
+    atomic_store_explicit(&job->_done, true, memory_order_release);
+    pthread_cond_broadcast(&job->_finished);
+    pthread_mutex_unlock(&job->_lock);
+
+    if (atomic_fetch_sub(&pool->_pending, 1) == 1) {
+        pthread_mutex_lock(&pool->_lock);
+        pthread_cond_broadcast(&pool->_idle);
+        pthread_mutex_unlock(&pool->_lock);
+    }
+}
+
+// takes a share of the shared queue, runs the first and pushes the rest on to our own deque for others to steal
+static joforth_job_t* _take_shared(_joforth_worker_t* worker) {
+    joforth_pool_t* pool = worker->_pool;
+    pthread_mutex_lock(&pool->_lock);
+    joforth_job_t* job = pool->_head;
+    if (job) {
+        size_t count = pool->_queued / pool->_num_workers;
+        count = count < JOFORTH_POOL_DEQUE_SIZE / 2 ? count : JOFORTH_POOL_DEQUE_SIZE / 2;
+        pool->_head = job->_next;
+        --pool->_queued;
+        while (count-- && pool->_head && _deque_push(&worker->_deque, pool->_head)) {
+            pool->_head = pool->_head->_next;
+            --pool->_queued;
+        }
+        if (!pool->_head) {
+            pool->_tail = 0;
+        }
+        if (pool->_sleeping && !_deque_is_empty(&worker->_deque)) {
+            pthread_cond_broadcast(&pool->_wake);
+        }
+    }
+    pthread_mutex_unlock(&pool->_lock);
+    return job;
+}
+
+static joforth_job_t* _steal(_joforth_worker_t* worker) {
+    joforth_pool_t* pool = worker->_pool;
+    // start with a random victim, so that thieves spread out
+    worker->_random ^= worker->_random << 13;
+    worker->_random ^= worker->_random >> 7;
+    worker->_random ^= worker->_random << 17;
+    const size_t first = (size_t)(worker->_random % pool->_num_workers);
+    for (size_t n = 0; n < pool->_num_workers; ++n) {
+        _joforth_worker_t* victim = pool->_workers + (first + n) % pool->_num_workers;
+        if (victim != worker) {
+            joforth_job_t* job = _deque_steal(&victim->_deque);
+            if (job) {
+                return job;
+            }
+        }
+    }
+    return 0;
+}
+
+// true if there is nothing to do anywhere, called with the pool locked
+static bool _is_idle(const joforth_pool_t* pool) {
+    if (pool->_head) {
+        return false;
+    }
+    for (size_t n = 0; n < pool->_num_workers; ++n) {
+        if (!_deque_is_empty(&pool->_workers[n]._deque)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void* _worker_main(void* arg) {
+    _joforth_worker_t* worker = (_joforth_worker_t*)arg;
+    joforth_pool_t* pool = worker->_pool;
+    for (;;) {
+        joforth_job_t* job = _deque_take(&worker->_deque);
+        if (!job) {
+            job = _take_shared(worker);
+        }
+        if (!job) {
+            job = _steal(worker);
+        }
+        if (job) {
+            _run_job(worker, job);
+            continue;
+        }
+        pthread_mutex_lock(&pool->_lock);
+        if (_is_idle(pool)) {
+            if (pool->_stopping) {
+                pthread_mutex_unlock(&pool->_lock);
+                return 0;
+            }
+            ++pool->_sleeping;
+            pthread_cond_wait(&pool->_wake, &pool->_lock);
+            --pool->_sleeping;
+        }
+        pthread_mutex_unlock(&pool->_lock);
+    }
+}
+
+joforth_pool_t* joforth_pool_create(const joforth_t* prototype, size_t threads) {
+    if (!threads) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (size_t)cores : 1;
+    }
+
+    joforth_pool_t* pool = (joforth_pool_t*)prototype->_allocator._alloc(sizeof(joforth_pool_t));
+    memset(pool, 0, sizeof(joforth_pool_t));
+    pool->_prototype = prototype;
+    pool->_allocator = prototype->_allocator;
+    atomic_init(&pool->_pending, 0);
+    pthread_mutex_init(&pool->_lock, 0);
+    pthread_cond_init(&pool->_wake, 0);
+    pthread_cond_init(&pool->_idle, 0);
+
+    pool->_workers = (_joforth_worker_t*)pool->_allocator._alloc(threads * sizeof(_joforth_worker_t));
+    memset(pool->_workers, 0, threads * sizeof(_joforth_worker_t));
+    for (; pool->_num_workers < threads; ++pool->_num_workers) {
+        _joforth_worker_t* worker = pool->_workers + pool->_num_workers;
+        atomic_init(&worker->_deque._top, 0);
+        atomic_init(&worker->_deque._bottom, 0);
+        worker->_pool = pool;
+        worker->_random = 0x9e3779b97f4a7c15ull * (pool->_num_workers + 1);
+        if (!_create_vm(pool, &worker->_vm)) {
+            break;
+        }
+    }
+    // the workers steal from each other, so they can only start once they all exist
+    if (pool->_num_workers == threads) {
+        for (; pool->_num_threads < threads; ++pool->_num_threads) {
+            _joforth_worker_t* worker = pool->_workers + pool->_num_threads;
+            if (pthread_create(&worker->_thread, 0, _worker_main, worker) != 0) {
+                break;
+            }
+        }
+    }
+    if (pool->_num_threads < threads) {
+        joforth_pool_destroy(pool);
+        return 0;
+    }
+    return pool;
+}
+
+void    joforth_pool_destroy(joforth_pool_t* pool) {
+    pthread_mutex_lock(&pool->_lock);
+    while (atomic_load(&pool->_pending)) {
+        pthread_cond_wait(&pool->_idle, &pool->_lock);
+    }
+    pool->_stopping = true;
+    pthread_cond_broadcast(&pool->_wake);
+    pthread_mutex_unlock(&pool->_lock);
+
+    for (size_t n = 0; n < pool->_num_threads; ++n) {
+        pthread_join(pool->_workers[n]._thread, 0);
+    }
+    for (size_t n = 0; n < pool->_num_workers; ++n) {
+        joforth_destroy(&pool->_workers[n]._vm);
+    }
+    pthread_cond_destroy(&pool->_idle);
+    pthread_cond_destroy(&pool->_wake);
+    pthread_mutex_destroy(&pool->_lock);
+    const joforth_allocator_t allocator = pool->_allocator;
+    allocator._free(pool->_workers);
+    allocator._free(pool);
+}
+
+size_t  joforth_pool_threads(const joforth_pool_t* pool) {
+    return pool->_num_workers;
+}
+
+joforth_job_t* joforth_pool_submit(joforth_pool_t* pool, const char* script) {
+    const size_t length = strlen(script);
+    joforth_job_t* job = (joforth_job_t*)pool->_allocator._alloc(sizeof(joforth_job_t) + length + 1);
+    memset(job, 0, sizeof(joforth_job_t));
+    memcpy(job->_script, script, length + 1);
+    pthread_mutex_init(&job->_lock, 0);
+    pthread_cond_init(&job->_finished, 0);
+    atomic_init(&job->_done, false);
+    atomic_fetch_add(&pool->_pending, 1);
+
+    pthread_mutex_lock(&pool->_lock);
+    if (pool->_tail) {
+        pool->_tail->_next = job;
+    }
+    else {
+        pool->_head = job;
+    }
+    pool->_tail = job;
+    ++pool->_queued;
+    if (pool->_sleeping) {
+        pthread_cond_signal(&pool->_wake);
+    }
+    pthread_mutex_unlock(&pool->_lock);
+    return job;
+}
+
+bool    joforth_job_is_done(const joforth_job_t* job) {
+    return atomic_load_explicit(&job->_done, memory_order_acquire);
+}
+
+bool    joforth_job_wait(joforth_job_t* job) {
+    // always through the lock, so that the worker is done with the job when we return
+    pthread_mutex_lock(&job->_lock);
+    while (!atomic_load_explicit(&job->_done, memory_order_acquire)) {
+        pthread_cond_wait(&job->_finished, &job->_lock);
+    }
+    pthread_mutex_unlock(&job->_lock);
+    return _JO_SUCCEEDED(job->_status);
+}
+
+jo_status_t joforth_job_status(const joforth_job_t* job) {
+    assert(joforth_job_is_done(job));
+    return job->_status;
+}
+
+size_t  joforth_job_results(const joforth_job_t* job, const joforth_value_t** values) {
+    assert(joforth_job_is_done(job));
+    *values = job->_results;
+    return job->_result_count;
+}
+
+void    joforth_job_free(joforth_pool_t* pool, joforth_job_t* job) {
+    joforth_job_wait(job);
+    pthread_cond_destroy(&job->_finished);
+    pthread_mutex_destroy(&job->_lock);
+    if (job->_results) {
+        pool->_allocator._free(job->_results);
+    }
+    pool->_allocator._free(job);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// =======================================================================
+// joForth worker pool
+// runs scripts on a fixed number of threads, each with a VM of its own. Submitted jobs go on
+// a shared queue from which workers take them in batches to their own work-stealing deque,
+// and idle workers steal from the others, so that the load stays balanced when scripts take
+// very different amounts of time.
+//
+// pthreads only (JOFORTH_POOL builds).
+//
+
+#include "joforth.h"
+
+typedef struct _joforth_pool joforth_pool_t;
+// a submitted script and, once it has run, its result; see joforth_job_wait
+typedef struct _joforth_job joforth_job_t;
+
+// create a pool of threads workers, 0 for one per core. Each worker's VM is created from prototype
+// with joforth_attach if it's frozen (see joforth_freeze), otherwise with joforth_clone, and the
+// pool uses its allocator. prototype must not change, and must outlive the pool.
+// Every job starts with an empty stack and the words of prototype; a worker's VM is created again
+// after a job which fails, defines words or allots memory, but variables aren't reset between jobs.
+joforth_pool_t* joforth_pool_create(const joforth_t* prototype, size_t threads);
+// waits for all submitted jobs to finish and stops the workers. Jobs must still be freed.
+void    joforth_pool_destroy(joforth_pool_t* pool);
+size_t  joforth_pool_threads(const joforth_pool_t* pool);
+
+// queue script, which is copied, to be evaluated by the next available worker
+joforth_job_t* joforth_pool_submit(joforth_pool_t* pool, const char* script);
+// true if the job has finished, doesn't block
+bool    joforth_job_is_done(const joforth_job_t* job);
+// blocks until the job has finished, true if it succeeded
+bool    joforth_job_wait(joforth_job_t* job);
+// status of a finished job, failed if the script didn't evaluate
+jo_status_t joforth_job_status(const joforth_job_t* job);
+// the stack a finished job left behind, bottom first. values is valid until the job is freed
+size_t  joforth_job_results(const joforth_job_t* job, const joforth_value_t** values);
+// free a job, waiting for it to finish first if it hasn't
+void    joforth_job_free(joforth_pool_t* pool, joforth_job_t* job);
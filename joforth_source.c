@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "joforth_source.h"
+
+// the natives are never called, only referred to
+static void _native(joforth_t* joforth) {
+    joforth->_status = _JO_STATUS_INVALID_INPUT;
+}
+
+static joforth_value_t _unary(joforth_value_t a) {
+    return a;
+}
+
+static joforth_value_t _binary(joforth_value_t a, joforth_value_t b) {
+    (void)b;
+    return a;
+}
+
+static void _array(joforth_value_t* values, size_t count) {
+    (void)values;
+    (void)count;
+}
+
+void    joforth_source_declare_native(joforth_t* joforth, char option, char* name) {
+    size_t depth = 0;
+    char* colon = strchr(name, ':');
+    if (colon) {
+        *colon = 0;
+        depth = (size_t)strtoul(colon + 1, 0, 10);
+    }
+    switch (option) {
+    case 'n':
+        joforth_add_word(joforth, name, _native, depth);
+        break;
+    case 'u':
+        joforth_add_unary(joforth, name, _unary);
+        break;
+    case 'b':
+        joforth_add_binary(joforth, name, _binary);
+        break;
+    case 'a':
+        joforth_add_array(joforth, name, _array, depth);
+        break;
+    default:;
+    }
+}
+
+char*   joforth_source_read(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    char* source = 0;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        const long size = ftell(file);
+        if (size >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            source = (char*)malloc((size_t)size + 1);
+            if (fread(source, 1, (size_t)size, file) != (size_t)size) {
+                free(source);
+                source = 0;
+            }
+            else {
+                source[size] = 0;
+            }
+        }
+    }
+    fclose(file);
+    return source;
+}
+
+static bool _is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool    joforth_source_compile(joforth_t* joforth, const char* path, char* source) {
+    size_t line = 1;
+    char* p = source;
+    for (;;) {
+        // skip whitespace and comments between definitions
+        while (_is_space(*p) || *p == '(') {
+            if (*p == '(') {
+                while (*p && *p != ')') {
+                    line += *p++ == '\n';
+                }
+                if (!*p) {
+                    break;
+                }
+            }
+            line += *p++ == '\n';
+        }
+        if (!*p) {
+            return true;
+        }
+        if (*p != ':') {
+            fprintf(stderr, "%s(%zu): only word definitions can be compiled to a module\n", path, line);
+            return false;
+        }
+        // find the ";" token which ends it, skipping comments
+        const size_t start_line = line;
+        char* definition = p;
+        char* end = 0;
+        while (*p && !end) {
+            if (*p == '(') {
+                while (*p && *p != ')') {
+                    line += *p++ == '\n';
+                }
+            }
+            else if (*p == ';' && _is_space(p[-1]) && (!p[1] || _is_space(p[1]))) {
+                end = p + 1;
+            }
+            if (*p) {
+                line += *p++ == '\n';
+            }
+        }
+        if (!end) {
+            fprintf(stderr, "%s(%zu): definition isn't terminated with ;\n", path, start_line);
+            return false;
+        }
+        const char saved = *end;
+        *end = 0;
+        if (!joforth_eval(joforth, definition)) {
+            fprintf(stderr, "%s(%zu): failed to compile \"%s\"\n", path, start_line, definition);
+            return false;
+        }
+        *end = saved;
+        p = end;
+    }
+}
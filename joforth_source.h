@@ -0,0 +1,18 @@
+#pragma once
+
+// =======================================================================
+// reading and compiling Forth source files of word definitions, shared by the joforthc and
+// joforth2c tools
+//
+
+#include "joforth.h"
+
+// declare a native word provided by the host, for the -n, -u, -b and -a options of the tools; as
+// joforth_add_word, joforth_add_unary, joforth_add_binary and joforth_add_array. name is "word"
+// or "word:depth", and it is modified. The natives are never called, only referred to.
+void    joforth_source_declare_native(joforth_t* joforth, char option, char* name);
+// the contents of a file, 0 terminated, or 0 if it can't be read. Free it with free
+char*   joforth_source_read(const char* path);
+// compiles every definition in source, a definition runs from ":" to ";" and can span lines.
+// errors are reported to stderr, with path and the line of the definition
+bool    joforth_source_compile(joforth_t* joforth, const char* path, char* source);
@@ -0,0 +1,11 @@
+( words translated to C by joforth2c for the tests, see test_translated in main.c )
+
+: TSQ     ( a -- a*a ) dup * ;
+: TFIB    ( n -- f ) dup 2 < if else dup 1 - recurse swap 2 - recurse + endif ;
+: TGCD    ( a b -- gcd ) ?dup if tuck mod recurse endif ;
+: TDOWN   ( n -- ) begin dup . 1 - dup 0 = until drop ;
+: TSTARS  ( n -- ) 0 swap do ." *" loop cr ;
+: THEX    ( a -- ) hex . dec ;
+: TMIXSQ  ( a b -- c ) tmix tsq ;
+: TMISC   ( a -- b ) ?dup if dup * dup 3 - over + swap drop dup 5 > swap 100 over - * + else false 1 - endif ;
+: TLAST   ( a b c -- d ) tmixsq tmixsq 1000000007 mod ;
@@ -0,0 +1,94 @@
+// =======================================================================
+// joforthc
+// compiles Forth source files with word definitions to a module, which can be
+// linked into a VM with joforth_load_module without compiling the source again.
+//
+//  joforthc [-n word[:depth]] [-u word] [-b word] [-a word:count] [-m module] -o output source...
+//
+//  -n, -u, -b, -a  declare a native word provided by the host which loads the module,
+//                  as joforth_add_word, joforth_add_unary, joforth_add_binary and joforth_add_array
+//  -m              a module the sources use, which must be loaded before this one
+//
+// as with joforth_eval, a word which isn't in the dictionary is compiled as a string,
+// so all the natives the sources use must be declared.
+//
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "joforth.h"
+#include "joforth_source.h"
+
+static void _usage(void) {
+    fprintf(stderr, "usage: joforthc [-n word[:depth]] [-u word] [-b word] [-a word:count] [-m module] -o output source...\n");
+}
+
+int main(int argc, char* argv[]) {
+
+    joforth_t joforth;
+    memset(&joforth, 0, sizeof(joforth));
+    joforth._allocator = *(&(joforth_allocator_t){
+        ._alloc = malloc,
+        ._free = free,
+    });
+    joforth_initialise(&joforth);
+
+    const char* output = 0;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        const char option = argv[arg][1];
+        if (!option || argv[arg][2] || arg + 1 == argc) {
+            _usage();
+            return 1;
+        }
+        char* value = argv[++arg];
+        switch (option) {
+        case 'n':
+        case 'u':
+        case 'b':
+        case 'a':
+            joforth_source_declare_native(&joforth, option, value);
+            break;
+        case 'm':
+            if (!joforth_load_module(&joforth, value)) {
+                fprintf(stderr, "joforthc: can't load module \"%s\"\n", value);
+                return 1;
+            }
+            break;
+        case 'o':
+            output = value;
+            break;
+        default:
+            _usage();
+            return 1;
+        }
+        if (_JO_FAILED(joforth._status)) {
+            fprintf(stderr, "joforthc: invalid argument \"%s\"\n", value);
+            return 1;
+        }
+    }
+    if (!output || arg == argc) {
+        _usage();
+        return 1;
+    }
+
+    // everything defined from here on goes into the module
+    const joforth_word_address_t since = joforth._latest;
+    for (; arg < argc; ++arg) {
+        char* source = joforth_source_read(argv[arg]);
+        if (!source) {
+            fprintf(stderr, "joforthc: can't read \"%s\"\n", argv[arg]);
+            return 1;
+        }
+        const bool compiled = joforth_source_compile(&joforth, argv[arg], source);
+        free(source);
+        if (!compiled) {
+            return 1;
+        }
+    }
+    if (!joforth_save_module(&joforth, output, since)) {
+        fprintf(stderr, "joforthc: can't write \"%s\"\n", output);
+        return 1;
+    }
+    joforth_destroy(&joforth);
+    return 0;
+}
@@ -4,6 +4,14 @@
 #include <assert.h>
 #include "joforth.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define JOFORTH_TEST_THREADS
+#include <pthread.h>
+#endif
+#if defined(JOFORTH_POOL)
+#include "joforth_pool.h"
+#endif
+
 joforth_t joforth;
 
 void test_incorrect_number(void) {
@@ -12,6 +20,43 @@ void test_incorrect_number(void) {
     joforth_pop_value(&joforth);    
 }
 
+// the limits of a value, which depend on the width of a cell
+#if JOFORTH_CELL_BITS == 64
+#define TEST_LIMITS         "9223372036854775807 -9223372036854775808 0xffffffffffffffff"
+#define TEST_TOO_BIG        "9223372036854775808"
+#define TEST_TOO_WIDE       "0x1ffffffffffffffff"
+#else
+#define TEST_LIMITS         "2147483647 -2147483648 0xffffffff"
+#define TEST_TOO_BIG        "2147483648"
+#define TEST_TOO_WIDE       "0x1ffffffff"
+#endif
+
+void test_number_literals(void) {
+    assert(joforth_eval(&joforth, "-17 +5 0x2F $ff %1011 -0x10 " TEST_LIMITS));
+    assert(joforth_pop_value(&joforth) == -1);
+    assert(joforth_pop_value(&joforth) == JOFORTH_VALUE_MIN);
+    assert(joforth_pop_value(&joforth) == JOFORTH_VALUE_MAX);
+    assert(joforth_pop_value(&joforth) == -16);
+    assert(joforth_pop_value(&joforth) == 11);
+    assert(joforth_pop_value(&joforth) == 255);
+    assert(joforth_pop_value(&joforth) == 0x2f);
+    assert(joforth_pop_value(&joforth) == 5);
+    assert(joforth_pop_value(&joforth) == -17);
+    // the current base applies to numbers without a prefix
+    assert(joforth_eval(&joforth, "hex"));
+    assert(joforth_eval(&joforth, "1F %11"));
+    assert(joforth_eval(&joforth, "dec"));
+    assert(joforth_pop_value(&joforth) == 3);
+    assert(joforth_pop_value(&joforth) == 0x1f);
+    // anything else is not a number, and ends up on the stack as a string
+    const char* not_numbers[] = { "12a", "0x", "$", "%102", "--", TEST_TOO_BIG, TEST_TOO_WIDE, "1[" };
+    for (size_t n = 0; n < sizeof(not_numbers) / sizeof(not_numbers[0]); ++n) {
+        assert(joforth_eval(&joforth, not_numbers[n]));
+        assert(strcmp((const char*)(joforth._memory + joforth_pop_value(&joforth)), not_numbers[n]) == 0);
+    }
+    assert(joforth_stack_is_empty(&joforth));
+}
+
 void test_dec_hex(void) {
     assert(joforth_eval(&joforth, "hex"));
     assert(joforth_eval(&joforth, "0x2f"));
@@ -37,13 +82,34 @@ void test_recurse_statement(void) {
     assert(joforth_eval(&joforth, "cr see gcd"));
 }
 
+void test_tail_calls(void) {
+    // deeper than the IR return stack, only works if the recursion doesn't use it
+    assert(joforth_eval(&joforth, ": DOWN    ( n -- 0 ) dup if 1 - recurse endif ;"));
+    assert(joforth_eval(&joforth, "10000 down"));
+    assert(joforth_pop_value(&joforth) == 0);
+    assert(joforth_eval(&joforth, ": EVEN?   ( n -- f ) noinline dup if 1 - recurse invert else drop true endif ;"));
+    assert(joforth_eval(&joforth, ": ODD?    ( n -- f ) even? invert ;"));
+    assert(joforth_eval(&joforth, ": SKIPTO  ( n -- 0 ) noinline dup if down endif ;"));
+    assert(joforth_eval(&joforth, "5000 skipto"));
+    assert(joforth_pop_value(&joforth) == 0);
+    // not in tail position
+    assert(joforth_eval(&joforth, ": FACT    ( n -- n! ) dup 1 > if dup 1 - recurse * endif ;"));
+    assert(joforth_eval(&joforth, "10 fact"));
+    assert(joforth_pop_value(&joforth) == 3628800);
+    assert(joforth_eval(&joforth, "7 odd?"));
+    assert(joforth_pop_value(&joforth) == JOFORTH_TRUE);
+    assert(joforth_eval(&joforth, "see down"));
+    assert(joforth_eval(&joforth, "recurse") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+}
+
 void test_create_allot(void) {
     assert(joforth_eval(&joforth, "create X 8 cells allot"));
     assert(joforth_eval(&joforth, "X"));
     assert(joforth_eval(&joforth, "here"));
     joforth_value_t top1 = joforth_pop_value(&joforth);
     joforth_value_t top2 = joforth_pop_value(&joforth);
-    assert(top1 == top2+64);
+    assert(top1 == top2 + 8 * (joforth_value_t)sizeof(joforth_value_t));
     // store 137 in the 5th cell, starting at X
     assert(joforth_eval(&joforth, "137  X 5 cells +  !"));
     // retrieve it
@@ -51,6 +117,38 @@ void test_create_allot(void) {
     assert(joforth_pop_value(&joforth) == 137);
 }
 
+void test_dictionary(void) {
+    // enough words to make the dictionary grow, each must resolve to itself
+    char sentence[64];
+    for (int n = 0; n < 600; ++n) {
+        snprintf(sentence, sizeof(sentence), "create dictvar%d", n);
+        assert(joforth_eval(&joforth, sentence));
+    }
+    joforth_value_t prev = -1;
+    for (int n = 0; n < 600; ++n) {
+        snprintf(sentence, sizeof(sentence), "dictvar%d", n);
+        assert(joforth_eval(&joforth, sentence));
+        joforth_value_t address = joforth_pop_value(&joforth);
+        assert(address > prev);
+        prev = address;
+    }
+    // names which share a prefix are different words
+    assert(joforth_eval(&joforth, ": dictw 1 ;"));
+    assert(joforth_eval(&joforth, ": dictw2 2 ;"));
+    assert(joforth_eval(&joforth, "dictw dictw2"));
+    assert(joforth_pop_value(&joforth) == 2);
+    assert(joforth_pop_value(&joforth) == 1);
+    // keywords are in the dictionary too, but can't be redefined
+    assert(joforth_eval(&joforth, "create while") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_eval(&joforth, ": loop 1 ;") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_eval(&joforth, ": KEYWORDS 0 begin 1 + dup 3 = until true invert ;"));
+    assert(joforth_eval(&joforth, "keywords"));
+    assert(joforth_pop_value(&joforth) == JOFORTH_FALSE);
+    assert(joforth_pop_value(&joforth) == 3);
+}
+
 void test_comparison(void) {
     assert(joforth_eval(&joforth, "2 3 >"));
     assert(joforth_pop_value(&joforth)==JOFORTH_FALSE);
@@ -84,6 +182,875 @@ void test_loops(void) {
     assert(joforth_eval(&joforth, ".\"do-loop: \" 0 10 do .step... loop cr"));
 }
 
+void test_while_repeat(void) {
+    assert(joforth_eval(&joforth, ": SUMTO    ( n -- sum) 0 SWAP  BEGIN  DUP  WHILE  TUCK  +  SWAP  1 -  REPEAT  DROP ;"));
+    assert(joforth_eval(&joforth, "10 sumto"));
+    assert(joforth_pop_value(&joforth) == 55);
+    assert(joforth_eval(&joforth, "0 sumto"));
+    assert(joforth_pop_value(&joforth) == 0);
+}
+
+void test_unbalanced_control_flow(void) {
+    assert(joforth_eval(&joforth, ": BROKEN1   IF  1  ;") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_eval(&joforth, ": BROKEN2   BEGIN  1  ENDIF ;") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_eval(&joforth, "1 IF 2") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_eval(&joforth, "REPEAT") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_stack_is_empty(&joforth));
+}
+
+void test_peephole(void) {
+    assert(joforth_eval(&joforth, ": POLY    ( a -- b ) dup * 2 3 * + 1 - 10 < ;"));
+    assert(joforth_eval(&joforth, ": ADDNIP  ( a b -- c ) over + swap drop 0 = ;"));
+    assert(joforth_eval(&joforth, "see poly"));
+    joforth._options |= JOFORTH_OPTION_NO_PEEPHOLE;
+    assert(joforth_eval(&joforth, ": POLY2   ( a -- b ) dup * 2 3 * + 1 - 10 < ;"));
+    assert(joforth_eval(&joforth, ": ADDNIP2 ( a b -- c ) over + swap drop 0 = ;"));
+    assert(joforth_eval(&joforth, "see poly2"));
+    joforth._options &= ~JOFORTH_OPTION_NO_PEEPHOLE;
+    for (joforth_value_t a = -4; a < 4; ++a) {
+        joforth_push_value(&joforth, a);
+        assert(joforth_eval(&joforth, "poly"));
+        joforth_push_value(&joforth, a);
+        assert(joforth_eval(&joforth, "poly2"));
+        assert(joforth_pop_value(&joforth) == joforth_pop_value(&joforth));
+        joforth_push_value(&joforth, a);
+        joforth_push_value(&joforth, 3);
+        assert(joforth_eval(&joforth, "addnip"));
+        joforth_push_value(&joforth, a);
+        joforth_push_value(&joforth, 3);
+        assert(joforth_eval(&joforth, "addnip2"));
+        assert(joforth_pop_value(&joforth) == joforth_pop_value(&joforth));
+    }
+    // constants which overflow wrap around, and MIN -1 mod isn't folded (it traps, it's never run here)
+    char sentence[96];
+    snprintf(sentence, sizeof(sentence), ": FOLDWRAP ( -- a ) %lld 1 + ;", (long long)JOFORTH_VALUE_MAX);
+    assert(joforth_eval(&joforth, sentence));
+    snprintf(sentence, sizeof(sentence), ": FOLDMOD ( -- a ) %lld -1 mod ;", (long long)JOFORTH_VALUE_MIN);
+    assert(joforth_eval(&joforth, sentence));
+    assert(joforth_eval(&joforth, "foldwrap"));
+    assert(joforth_pop_value(&joforth) == JOFORTH_VALUE_MIN);
+    // and so do fused immediates, with 32 bit cells
+    assert(joforth_eval(&joforth, ": ADDWRAP ( a -- b ) 2000000000 + 2000000000 + ;"));
+    assert(joforth_eval(&joforth, "1 addwrap"));
+    assert(joforth_pop_value(&joforth) == (joforth_value_t)((joforth_uvalue_t)1 + 2000000000u + 2000000000u));
+    assert(joforth_stack_is_empty(&joforth));
+}
+
+void test_inline(void) {
+    // squared is small enough to be inlined automatically
+    assert(joforth_eval(&joforth, ": QUAD    ( a -- a^4 ) squared squared ;"));
+    assert(joforth_eval(&joforth, "3 quad"));
+    assert(joforth_pop_value(&joforth) == 81);
+    assert(joforth_eval(&joforth, "see quad"));
+    assert(joforth_eval(&joforth, ": CUBE    ( a -- a^3 ) noinline dup dup * * ;"));
+    assert(joforth_eval(&joforth, ": CUBE2   ( a -- b ) cube 2 * ;"));
+    assert(joforth_eval(&joforth, "see cube2"));
+    assert(joforth_eval(&joforth, ": ABS     ( a -- |a| ) inline dup 0 < if -1 * endif ;"));
+    assert(joforth_eval(&joforth, ": ABSSUM  ( a b -- c ) abs swap abs + ;"));
+    assert(joforth_eval(&joforth, "see abssum"));
+    assert(joforth_eval(&joforth, "-3 cube2 -7 5 abssum"));
+    assert(joforth_pop_value(&joforth) == 12);
+    assert(joforth_pop_value(&joforth) == -54);
+    // only valid when compiling
+    assert(joforth_eval(&joforth, "inline") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+}
+
+void test_primitives(void) {
+    // primitives run in the engine with the top of the stack cached, natives like "cells" and "cr" spill it
+    assert(joforth_eval(&joforth, "create PRIMVAR 2 cells allot"));
+    assert(joforth_eval(&joforth, ": STORE2  ( a b -- ) primvar 1 cells + ! primvar ! ;"));
+    assert(joforth_eval(&joforth, ": SUM2    ( -- a+b ) primvar @ primvar 1 cells + @ + ;"));
+    assert(joforth_eval(&joforth, ": MIX     ( a b -- c ) over over < if swap endif tuck * swap - cr 3 mod ;"));
+    assert(joforth_eval(&joforth, "100 7 35 store2 sum2"));
+    assert(joforth_pop_value(&joforth) == 42);
+    assert(joforth_eval(&joforth, "5 4 mix 4 5 mix"));
+    // (5*4 - 4) mod 3, either way round
+    assert(joforth_pop_value(&joforth) == 1);
+    assert(joforth_pop_value(&joforth) == 1);
+    // values below the ones we used are untouched
+    assert(joforth_pop_value(&joforth) == 100);
+    assert(joforth_stack_is_empty(&joforth));
+    // too few values for swap, the sentence is rejected before any of it runs
+    assert(joforth_eval(&joforth, "1 swap") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_stack_is_empty(&joforth));
+}
+
+void test_tokenizer(void) {
+    // any whitespace separates tokens, and words are case insensitive
+    assert(joforth_eval(&joforth, ":\tTRIPLE ( a -- 3a )\n\tDUP dup\r\n + +\n;\n"));
+    assert(joforth_eval(&joforth, "\t7\vtriple\fTriple  \n"));
+    assert(joforth_pop_value(&joforth) == 63);
+    // whitespace inside quotes is part of the token
+    assert(joforth_eval(&joforth, ".\"  the tokenizer\tworks \" cr"));
+    // long inputs are scanned in blocks
+    assert(joforth_eval(&joforth, "1 2 +                                                   3 +\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t4 +"));
+    assert(joforth_pop_value(&joforth) == 10);
+    assert(joforth_stack_is_empty(&joforth));
+}
+
+void test_statements(void) {
+    assert(joforth_eval(&joforth, "create STMTVAR 1 cells allot"));
+    assert(joforth_eval(&joforth, "0 stmtvar !"));
+    joforth_statement_t* increment = joforth_compile(&joforth, "stmtvar @ 1 + stmtvar !");
+    assert(increment);
+    for (int n = 0; n < 1000; ++n) {
+        assert(joforth_exec(&joforth, increment));
+    }
+    joforth_free_statement(&joforth, increment);
+    assert(joforth_eval(&joforth, "stmtvar @"));
+    assert(joforth_pop_value(&joforth) == 1000);
+    // definitions can't be prepared
+    assert(joforth_compile(&joforth, ": NOPE 1 ;") == 0);
+    joforth._status = _JO_STATUS_SUCCESS;
+
+    // a VM with an eval cache
+    joforth_t cached;
+    memset(&cached, 0, sizeof(cached));
+    cached._allocator = joforth._allocator;
+    cached._statement_cache_size = 2;
+    joforth_initialise(&cached);
+    assert(joforth_eval(&cached, ": NEXT 1 + ;"));
+    assert(joforth_eval(&cached, "0"));
+    for (int n = 0; n < 100; ++n) {
+        assert(joforth_eval(&cached, "next"));
+        assert(joforth_eval(&cached, "10"));
+        assert(joforth_eval(&cached, "-"));
+    }
+    // 100 * (1 - 10)
+    assert(joforth_pop_value(&cached) == -900);
+    // more sentences than fit, the least recently used ones are dropped
+    assert(joforth_eval(&cached, "1 2 3 + +"));
+    assert(joforth_eval(&cached, "10 *"));
+    assert(joforth_eval(&cached, "1 2 3 + +"));
+    assert(joforth_eval(&cached, "+"));
+    assert(joforth_pop_value(&cached) == 66);
+    // cached sentences see new words...
+    assert(joforth_eval(&cached, "5 double"));
+    assert(strcmp((const char*)(cached._memory + joforth_pop_value(&cached)), "double") == 0);
+    joforth_pop_value(&cached);
+    assert(joforth_eval(&cached, ": DOUBLE 2 * ;"));
+    assert(joforth_eval(&cached, "5 double"));
+    assert(joforth_pop_value(&cached) == 10);
+    // ...and a new base
+    assert(joforth_eval(&cached, "10"));
+    assert(joforth_eval(&cached, "hex"));
+    assert(joforth_eval(&cached, "10"));
+    assert(joforth_eval(&cached, "dec"));
+    assert(joforth_pop_value(&cached) == 16);
+    assert(joforth_pop_value(&cached) == 10);
+    assert(joforth_stack_is_empty(&cached));
+    joforth_destroy(&cached);
+}
+
+void test_call(void) {
+    joforth_word_t gcd = joforth_find(&joforth, "GCD");
+    assert(gcd);
+    joforth_value_t args[2] = { 784, 48 };
+    joforth_value_t result = 0;
+    for (int n = 0; n < 100; ++n) {
+        assert(joforth_call(&joforth, gcd, args, 2, &result, 1));
+        assert(result == 16);
+    }
+    // natives and values
+    joforth_value_t results[2];
+    assert(joforth_call(&joforth, joforth_find(&joforth, "swap"), args, 2, results, 2));
+    assert(results[0] == 48 && results[1] == 784);
+    assert(joforth_call(&joforth, joforth_find(&joforth, "stmtvar"), 0, 0, &result, 1));
+    assert(joforth_call(&joforth, joforth_find(&joforth, "@"), &result, 1, &result, 1));
+    assert(result == 1000);
+    assert(joforth_stack_is_empty(&joforth));
+    // too many results
+    assert(joforth_call(&joforth, gcd, args, 2, results, 2) == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    joforth_pop_value(&joforth);
+    // not callable
+    assert(joforth_find(&joforth, "if") == 0 && joforth_find(&joforth, "see") == 0 && joforth_find(&joforth, "nosuchword") == 0);
+}
+
+static joforth_value_t _negate(joforth_value_t a) {
+    return -a;
+}
+
+static joforth_value_t _max(joforth_value_t a, joforth_value_t b) {
+    return a > b ? a : b;
+}
+
+static void _reverse(joforth_value_t* values, size_t count) {
+    for (size_t n = 0; n < count / 2; ++n) {
+        joforth_value_t value = values[n];
+        values[n] = values[count - 1 - n];
+        values[count - 1 - n] = value;
+    }
+}
+
+void test_typed_natives(void) {
+    joforth_add_unary(&joforth, "negate", _negate);
+    joforth_add_binary(&joforth, "max", _max);
+    joforth_add_array(&joforth, "reverse3", _reverse, 3);
+    assert(joforth_eval(&joforth, "5 negate 3 max -7 max"));
+    assert(joforth_pop_value(&joforth) == 3);
+    assert(joforth_eval(&joforth, ": MAXNEG  ( a b -- c ) max negate ;"));
+    assert(joforth_eval(&joforth, "100 1 2 3 reverse3 maxneg"));
+    // 3 2 1 -> max(2,1)
+    assert(joforth_pop_value(&joforth) == -2);
+    assert(joforth_pop_value(&joforth) == 3);
+    assert(joforth_pop_value(&joforth) == 100);
+    joforth_value_t args[3] = { 1, 2, 3 };
+    joforth_value_t results[3];
+    assert(joforth_call(&joforth, joforth_find(&joforth, "reverse3"), args, 3, results, 3));
+    assert(results[0] == 3 && results[1] == 2 && results[2] == 1);
+    assert(joforth_call(&joforth, joforth_find(&joforth, "max"), args, 2, results, 1));
+    assert(results[0] == 2);
+    assert(joforth_stack_is_empty(&joforth));
+    // the arity is checked when the word is added
+    joforth_add_array(&joforth, "reverse0", _reverse, 0);
+    assert(joforth._status == _JO_STATUS_INVALID_INPUT);
+    joforth._status = _JO_STATUS_SUCCESS;
+}
+
+void test_compact_literals(void) {
+    // literals are stored in 8, 32 or 64 bits depending on their value, and immediates in 32 bits
+    const joforth_value_t values[] = { 0, -1, 127, -128, 128, -129, INT32_MAX, INT32_MIN, 
+#if JOFORTH_CELL_BITS == 64
+        (joforth_value_t)INT32_MAX + 1, (joforth_value_t)INT32_MIN - 1, 
+#endif
+        JOFORTH_VALUE_MAX, JOFORTH_VALUE_MIN };
+    char sentence[128];
+    for (size_t n = 0; n < sizeof(values) / sizeof(values[0]); ++n) {
+        snprintf(sentence, sizeof(sentence), "%lld", (long long)values[n]);
+        assert(joforth_eval(&joforth, sentence));
+        assert(joforth_pop_value(&joforth) == values[n]);
+        snprintf(sentence, sizeof(sentence), ": LITERAL%zu ( a -- b c ) %lld + %lld ;", n, (long long)values[n], (long long)values[n]);
+        assert(joforth_eval(&joforth, sentence));
+        snprintf(sentence, sizeof(sentence), "0 literal%zu", n);
+        assert(joforth_eval(&joforth, sentence));
+        assert(joforth_pop_value(&joforth) == values[n]);
+        assert(joforth_pop_value(&joforth) == values[n]);
+    }
+    char last[32];
+    snprintf(last, sizeof(last), "see literal%zu", sizeof(values) / sizeof(values[0]) - 1);
+    assert(joforth_eval(&joforth, last));
+    assert(joforth_stack_is_empty(&joforth));
+}
+
+void test_image(void) {
+    const char* path = "joforth_test.jfi";
+    assert(joforth_eval(&joforth, "create counter 1 cells allot"));
+    assert(joforth_eval(&joforth, "41 counter !"));
+    assert(joforth_save_image(&joforth, path));
+
+    joforth_t loaded;
+    // everything but the configuration comes from the image
+    memset(&loaded, 0x5a, sizeof(loaded));
+    loaded._allocator = joforth._allocator;
+    loaded._output = joforth._output;
+    loaded._statement_cache_size = joforth._statement_cache_size;
+    loaded._fuel = 0;
+    assert(joforth_load_image(&loaded, path));
+    // our own natives have to be bound again first
+    assert(loaded._unbound_natives);
+    assert(joforth_eval(&loaded, "3 quad") == false);
+    joforth_add_unary(&loaded, "negate", _negate);
+    joforth_add_binary(&loaded, "max", _max);
+    joforth_add_array(&loaded, "reverse3", _reverse, 3);
+    assert(loaded._unbound_natives == 0);
+    // built in words, compiled words, variables and strings all survive
+    assert(joforth_eval(&loaded, "3 quad 1 2 maxneg counter @ 1 +"));
+    assert(joforth_pop_value(&loaded) == 42);
+    assert(joforth_pop_value(&loaded) == -2);
+    assert(joforth_pop_value(&loaded) == 81);
+    assert(joforth_eval(&loaded, "784 48 gcd"));
+    assert(joforth_pop_value(&loaded) == 16);
+    assert(joforth_eval(&loaded, ": HOT ( a -- b ) noinline 1 + ;"));
+    for (int run = 0; run < 150; ++run) {
+        // hot enough to be compiled in JOFORTH_JIT builds
+        assert(joforth_eval(&loaded, "41 hot"));
+        assert(joforth_pop_value(&loaded) == 42);
+    }
+    assert(joforth_eval(&loaded, "see abssum"));
+    assert(joforth_eval(&loaded, ": TWICE ( a -- 2a ) 2 * ;"));
+    assert(joforth_eval(&loaded, "21 twice"));
+    assert(joforth_pop_value(&loaded) == 42);
+    assert(joforth_stack_is_empty(&loaded));
+    joforth_destroy(&loaded);
+
+    // the original is unaffected
+    assert(joforth_find(&joforth, "twice") == 0);
+    assert(joforth_eval(&joforth, "counter @"));
+    assert(joforth_pop_value(&joforth) == 41);
+    remove(path);
+
+    assert(joforth_load_image(&loaded, "no such image") == false);
+}
+
+void test_module(void) {
+    const char* path = "joforth_test.jfm";
+    const joforth_word_address_t since = joforth._latest;
+    assert(joforth_eval(&joforth, ": SQR     ( a -- a*a ) inline dup * ;"));
+    assert(joforth_eval(&joforth, ": FACTM   ( n -- n! ) dup 1 > if dup 1 - recurse * endif ;"));
+    assert(joforth_eval(&joforth, ": NEGSQR  ( a -- b ) noinline sqr negate ;"));
+    assert(joforth_eval(&joforth, ": SHOUT   ( -- ) .\"module \" 5000000000 . cr ;"));
+    assert(joforth_eval(&joforth, ": LAST    ( a -- b ) factm negsqr ;"));
+    assert(joforth_save_module(&joforth, path, since));
+
+    joforth_t linked;
+    memset(&linked, 0, sizeof(linked));
+    linked._allocator = joforth._allocator;
+    joforth_initialise(&linked);
+    // negate is used by the module, so it can't be linked yet
+    assert(joforth_load_module(&linked, path) == false);
+    assert(joforth_find(&linked, "factm") == 0);
+    linked._status = _JO_STATUS_SUCCESS;
+    joforth_add_unary(&linked, "negate", _negate);
+    assert(joforth_load_module(&linked, path));
+    assert(joforth_eval(&linked, "5 factm 3 negsqr 3 last shout"));
+    assert(joforth_pop_value(&linked) == -36);
+    assert(joforth_pop_value(&linked) == -9);
+    assert(joforth_pop_value(&linked) == 120);
+    assert(joforth_eval(&linked, "see last"));
+    // the words are already there now
+    assert(joforth_load_module(&linked, path) == false);
+    assert(joforth_stack_is_empty(&linked));
+    joforth_destroy(&linked);
+    remove(path);
+}
+
+void test_clone(void) {
+    assert(joforth_eval(&joforth, "create shared 1 cells allot"));
+    assert(joforth_eval(&joforth, "7 shared !"));
+    joforth_statement_t* increment = joforth_compile(&joforth, "shared @ 1 + shared !");
+    assert(increment);
+
+    joforth_t clone;
+    assert(joforth_clone(&clone, &joforth));
+    assert(joforth_exec(&clone, increment));
+    assert(joforth_eval(&clone, ": CLONED ( a -- b ) sqr 3 gcd ;"));
+    assert(joforth_eval(&clone, "6 cloned shared @"));
+    assert(joforth_pop_value(&clone) == 8);
+    assert(joforth_pop_value(&clone) == 3);
+    assert(joforth_stack_is_empty(&clone));
+    joforth_destroy(&clone);
+
+    // the original doesn't see any of it
+    assert(joforth_find(&joforth, "cloned") == 0);
+    assert(joforth_eval(&joforth, "shared @"));
+    assert(joforth_pop_value(&joforth) == 7);
+    joforth_free_statement(&joforth, increment);
+}
+
+void test_fuel(void) {
+    assert(joforth_eval(&joforth, ": SPIN ( n -- ) begin 1 - dup 0 = until drop ;"));
+    joforth._fuel = 100;
+    size_t slices = 1;
+    bool done = joforth_eval(&joforth, "100000 spin 42");
+    while (!done) {
+        assert(joforth._suspended && _JO_SUCCEEDED(joforth._status));
+        // nothing else runs until it's done
+        assert(joforth_eval(&joforth, "1") == false);
+        done = joforth_resume(&joforth);
+        ++slices;
+    }
+    assert(slices >= 1000);
+    assert(joforth_pop_value(&joforth) == 42);
+    assert(joforth_stack_is_empty(&joforth));
+
+    // calls use fuel too
+    joforth._fuel = 10;
+    slices = 1;
+    for (done = joforth_eval(&joforth, "100 down"); !done; ++slices) {
+        done = joforth_resume(&joforth);
+    }
+    assert(slices >= 10);
+    assert(joforth_pop_value(&joforth) == 0);
+
+    // a runaway can be abandoned
+    assert(joforth_eval(&joforth, "100000 spin") == false);
+    assert(joforth._suspended);
+    joforth_cancel(&joforth);
+    joforth_pop_value(&joforth);
+    assert(joforth_stack_is_empty(&joforth));
+    joforth._fuel = 0;
+
+    // and a word can suspend itself
+    assert(joforth_eval(&joforth, ": STEPS ( -- a b c ) 1 yield 2 yield 3 ;"));
+    assert(joforth_eval(&joforth, "steps") == false);
+    assert(joforth._suspended && joforth_top_value(&joforth) == 1);
+    assert(joforth_resume(&joforth) == false);
+    assert(joforth._suspended && joforth_top_value(&joforth) == 2);
+    assert(joforth_resume(&joforth));
+    assert(!joforth._suspended);
+    assert(joforth_pop_value(&joforth) == 3);
+    assert(joforth_pop_value(&joforth) == 2);
+    assert(joforth_pop_value(&joforth) == 1);
+    assert(joforth_resume(&joforth) == false);
+}
+
+#if defined(JOFORTH_JIT) && defined(__linux__) && defined(__x86_64__) && JOFORTH_CELL_BITS == 64
+// true if word has been compiled to native code by vm, see test_jit
+static bool _test_is_compiled(const joforth_t* vm, const char* word) {
+    const joforth_word_address_t address = (joforth_word_address_t)((const uint8_t*)joforth_find((joforth_t*)vm, word) - vm->_memory);
+    for (size_t n = 0; n < vm->_jit_words_size; ++n) {
+        if (vm->_jit_words[n]._entry == address) {
+            return vm->_jit_words[n]._jit != 0;
+        }
+    }
+    return false;
+}
+#endif
+
+void test_overlays(void) {
+    joforth_t parent;
+    memset(&parent, 0, sizeof(parent));
+    parent._allocator = joforth._allocator;
+    joforth_initialise(&parent);
+    assert(joforth_eval(&parent, ": SQUARE ( a -- b ) dup * ;"));
+    assert(joforth_eval(&parent, ": CUBE ( a -- b ) dup square * ;"));
+    assert(joforth_eval(&parent, "create level 1 cells allot"));
+    assert(joforth_eval(&parent, "7 level !"));
+    assert(joforth_eval(&parent, ": PHOT ( a -- b ) noinline 1 + ;"));
+    assert(joforth_freeze(&parent));
+    // a frozen VM can't change
+    assert(joforth_eval(&parent, "1") == false);
+    joforth_add_word(&parent, "later", 0, 0);
+    parent._status = _JO_STATUS_SUCCESS;
+
+    joforth_t a, b;
+    assert(joforth_attach(&a, &parent));
+    assert(joforth_attach(&b, &parent));
+    // an overlay's own words shadow its parent's, for itself only
+    joforth_add_unary(&a, "square", _negate);
+    assert(joforth_eval(&a, ": TWICE ( a -- b ) 2 * ;"));
+    assert(joforth_eval(&a, "3 square 2 cube twice 5 level !"));
+    assert(joforth_pop_value(&a) == 16);
+    assert(joforth_pop_value(&a) == -3);
+    assert(joforth_eval(&b, "3 square 2 cube level @"));
+    assert(joforth_pop_value(&b) == 7);
+    assert(joforth_pop_value(&b) == 8);
+    assert(joforth_pop_value(&b) == 9);
+    // the parent's words are at the same place in every overlay
+    assert((const uint8_t*)joforth_find(&a, "square") - a._memory >= (ptrdiff_t)parent._frozen);
+    assert((const uint8_t*)joforth_find(&a, "cube") - a._memory == (const uint8_t*)joforth_find(&b, "cube") - b._memory);
+    // and all they cost is what they add
+    assert(a._mp - parent._frozen < 256 && b._mp == parent._frozen);
+    assert(a._dict_count == 2 && b._dict_count == 0);
+    assert(joforth_find(&b, "twice") == 0);
+    // calling the parent's words doesn't write to them, even when they're hot
+    for (int run = 0; run < 150; ++run) {
+        assert(joforth_eval(&b, "41 phot"));
+        assert(joforth_pop_value(&b) == 42);
+    }
+    const joforth_word_t phot = joforth_find(&b, "phot");
+    assert(memcmp(phot, parent._memory + ((const uint8_t*)phot - b._memory), sizeof(*phot)) == 0);
+#if defined(JOFORTH_JIT) && defined(__linux__) && defined(__x86_64__) && JOFORTH_CELL_BITS == 64
+    assert(_test_is_compiled(&b, "phot") && !_test_is_compiled(&a, "phot"));
+#endif
+
+    // an overlay saves as a VM of its own
+    const char* path = "joforth_overlay.jfi";
+    assert(joforth_save_image(&a, path));
+    joforth_t loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    loaded._allocator = joforth._allocator;
+    assert(joforth_load_image(&loaded, path));
+    joforth_add_unary(&loaded, "square", _negate);
+    assert(joforth_eval(&loaded, "3 square 2 cube twice level @"));
+    assert(joforth_pop_value(&loaded) == 5);
+    assert(joforth_pop_value(&loaded) == 16);
+    assert(joforth_pop_value(&loaded) == -3);
+    joforth_destroy(&loaded);
+    remove(path);
+
+    joforth_destroy(&a);
+    joforth_destroy(&b);
+    joforth_destroy(&parent);
+}
+
+typedef struct _test_output {
+    char _text[256];
+    size_t _length;
+} test_output_t;
+
+static void _test_write(void* context, const char* text, size_t length) {
+    test_output_t* output = (test_output_t*)context;
+    assert(output->_length + length < sizeof(output->_text));
+    memcpy(output->_text + output->_length, text, length);
+    output->_length += length;
+    output->_text[output->_length] = 0;
+}
+
+// runs script in vm and returns what it leaves on the stack, and its output
+static size_t _test_run(joforth_t* vm, const char* script, joforth_value_t* values, test_output_t* capture) {
+    capture->_length = 0;
+    capture->_text[0] = 0;
+    if (!joforth_eval(vm, script)) {
+        vm->_status = _JO_STATUS_SUCCESS;
+        while (!joforth_stack_is_empty(vm)) {
+            joforth_pop_value(vm);
+        }
+        return (size_t)-1;
+    }
+    size_t count = 0;
+    while (!joforth_stack_is_empty(vm)) {
+        values[count++] = joforth_pop_value(vm);
+    }
+    return count;
+}
+
+void test_stack_effects(void) {
+    // the effect of a colon word is inferred from its IR and must match its stack comment
+    assert(joforth_eval(&joforth, ": SEMIX ( a b -- c ) over over < if swap endif tuck - + ;"));
+    joforth_word_t semix = joforth_find(&joforth, "semix");
+    assert((semix->_flags & kEntryFlag_Verified) && semix->_depth == 2 && semix->_results == 1);
+    assert(joforth_eval(&joforth, "3 9 semix 9 3 semix"));
+    assert(joforth_pop_value(&joforth) == 9);
+    assert(joforth_pop_value(&joforth) == 9);
+    // words which call it are verified too, unbalanced branches just leave a word unverified
+    assert(joforth_eval(&joforth, ": SEMIX3 ( a b c -- d ) semix semix ;"));
+    assert(joforth_find(&joforth, "semix3")->_flags & kEntryFlag_Verified);
+    assert(joforth_eval(&joforth, ": SEODD ( a -- ? ) dup if dup endif ;"));
+    assert(!(joforth_find(&joforth, "seodd")->_flags & kEntryFlag_Verified));
+    assert(joforth_stack_is_empty(&joforth));
+
+    // a comment which doesn't match is an error, and the word isn't defined
+    assert(joforth_eval(&joforth, ": SEBAD ( a -- b ) + ;") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_find(&joforth, "sebad") == 0);
+    // but it may name inputs the word leaves in place
+    assert(joforth_eval(&joforth, ": SETHREE ( a -- a b ) 3 ;"));
+    assert(joforth_eval(&joforth, ": SENOOP ( a -- a ) ;"));
+    joforth_word_t sethree = joforth_find(&joforth, "sethree");
+    assert((sethree->_flags & kEntryFlag_Verified) && sethree->_depth == 0 && sethree->_results == 1);
+    assert(joforth_find(&joforth, "senoop")->_flags & kEntryFlag_Verified);
+    assert(joforth_eval(&joforth, "5 sethree senoop +"));
+    assert(joforth_pop_value(&joforth) == 8);
+    assert(joforth_stack_is_empty(&joforth));
+
+    // a word ends at its ";", what comes after it isn't part of it
+    assert(joforth_eval(&joforth, ": SEONE noinline 1 ; 2 3"));
+    joforth_word_t seone = joforth_find(&joforth, "seone");
+    assert((seone->_flags & kEntryFlag_Verified) && seone->_depth == 0 && seone->_results == 1);
+    assert(joforth_eval(&joforth, ": SEONE3 ( a b -- c ) seone + + ;"));
+    assert(joforth_eval(&joforth, "seone3") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_stack_is_empty(&joforth));
+    assert(joforth_eval(&joforth, ": SENONE ( -- ) 1 drop ; senone"));
+    assert(joforth_eval(&joforth, "senone"));
+    assert(joforth_stack_is_empty(&joforth));
+    // a definition must end with ";"
+    assert(joforth_eval(&joforth, ": SEOPEN ( a -- a a ) dup") == false);
+    assert(joforth._status == _JO_STATUS_INVALID_INPUT && !joforth_find(&joforth, "seopen"));
+    joforth._status = _JO_STATUS_SUCCESS;
+
+    // too few values is caught before anything runs
+    test_output_t capture = { ._length = 0 };
+    const joforth_output_t output = joforth._output;
+    joforth._output = *(&(joforth_output_t){
+        ._write = _test_write,
+        ._context = &capture,
+    });
+    assert(joforth_eval(&joforth, "1 . semix3") == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(capture._length == 0 && joforth_stack_is_empty(&joforth));
+    joforth_statement_t* statement = joforth_compile(&joforth, "5 semix3 .");
+    assert(statement);
+    assert(joforth_exec(&joforth, statement) == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    joforth_push_value(&joforth, 1);
+    joforth_push_value(&joforth, 2);
+    assert(joforth_exec(&joforth, statement));
+    joforth_free_statement(&joforth, statement);
+    joforth._output = output;
+    assert(capture._length && joforth_stack_is_empty(&joforth));
+    const joforth_value_t args[2] = { 4, 8 };
+    joforth_value_t result;
+    assert(joforth_call(&joforth, semix, args, 1, &result, 1) == false);
+    joforth._status = _JO_STATUS_SUCCESS;
+    assert(joforth_call(&joforth, semix, args, 2, &result, 1) && result == 8);
+    assert(joforth_stack_is_empty(&joforth));
+}
+
+void test_jit(void) {
+    // hot words are compiled to native code in JOFORTH_JIT builds, which must do exactly what the 
+    // interpreter does; metered VMs are always interpreted so we use that for the expected results
+    test_output_t capture;
+    const joforth_output_t output = joforth._output;
+    joforth._output = *(&(joforth_output_t){
+        ._write = _test_write,
+        ._context = &capture,
+    });
+    assert(joforth_eval(&joforth, ": JFIB ( n -- f ) dup 2 < if else dup 1 - recurse swap 2 - recurse + endif ;"));
+    assert(joforth_eval(&joforth, "create jcell 1 cells allot"));
+    assert(joforth_eval(&joforth, "create jacc 1 cells allot"));
+    assert(joforth_eval(&joforth, ": JSTEP ( a b -- c ) noinline over 7 mod tuck < invert swap 3 > + swap 1000000000000 + negate 5 max + dup jcell @ + jcell ! ;"));
+    assert(joforth_eval(&joforth, ": JSUM ( n -- s ) noinline 0 jacc ! 0 swap do over jacc @ swap jstep jacc ! loop jacc @ ;"));
+    assert(joforth_eval(&joforth, ": JMISC ( a -- b ) noinline ?dup if dup * dup 3 - over + swap drop dup 5 > swap 100 over - * + else false 1 - endif ;"));
+    assert(joforth_eval(&joforth, ": JREV ( a b c -- c b a ) noinline reverse3 ;"));
+    assert(joforth_eval(&joforth, ": JSWAP ( a b -- b a ) noinline swap ;"));
+    assert(joforth_eval(&joforth, ": JOUT ( n -- n ) noinline dup . .\" !\" cr ;"));
+    assert(joforth_eval(&joforth, ": JDOWN ( n -- 0 ) noinline dup if 1 - jdown endif ;"));
+    assert(joforth_eval(&joforth, ": JSUMTO ( n -- s ) noinline dup if dup 1 - recurse + endif ;"));
+    assert(joforth_eval(&joforth, ": JFILL ( n -- n ... 0 ) noinline begin dup 1 - dup 0 = until ;"));
+    static const char* const scripts[] = {
+        "20 jfib",
+        "0 jcell ! 40 jsum jcell @",
+        "0 jmisc 7 jmisc -3 jmisc",
+        "1 2 3 jrev",
+        "1 2 jswap",
+        "1 jswap",
+        "12 jout",
+        "1000 jdown",
+        "10 jsumto",
+        "5 jfill",
+    };
+    static const char* const words[] = { "jfib", "jsum", "jstep", "jmisc", "jrev", "jswap", "jout", "jdown", "jsumto", "jfill" };
+    for (size_t n = 0; n < sizeof(scripts) / sizeof(scripts[0]); ++n) {
+        joforth_value_t expected[8];
+        test_output_t expected_output;
+        joforth._fuel = (size_t)1 << 40;
+        const size_t expected_count = _test_run(&joforth, scripts[n], expected, &capture);
+        expected_output = capture;
+        joforth._fuel = 0;
+        for (int run = 0; run < 150; ++run) {
+            joforth_value_t values[8];
+            const size_t count = _test_run(&joforth, scripts[n], values, &capture);
+            assert(count == expected_count && strcmp(capture._text, expected_output._text) == 0);
+            assert(count == (size_t)-1 || memcmp(values, expected, count * sizeof(joforth_value_t)) == 0);
+        }
+    }
+    assert(joforth_eval(&joforth, "20 jfib"));
+    assert(joforth_pop_value(&joforth) == 6765);
+
+    // a word which calls one that yields can't be compiled, it must be able to suspend
+    assert(joforth_eval(&joforth, ": JYIELD ( -- ) noinline yield ;"));
+    assert(joforth_eval(&joforth, ": JWAIT ( n -- n ) noinline jyield 1 + ;"));
+    for (int run = 0; run < 150; ++run) {
+        assert(joforth_eval(&joforth, "1 jwait") == false && joforth._suspended);
+        assert(joforth_resume(&joforth));
+        assert(joforth_pop_value(&joforth) == 2);
+    }
+    assert(joforth_stack_is_empty(&joforth));
+
+    // clones get the native code as well
+    joforth_t clone;
+    assert(joforth_clone(&clone, &joforth));
+    assert(joforth_eval(&clone, "22 jfib"));
+    assert(joforth_pop_value(&clone) == 17711);
+    // and a metered VM doesn't use it
+    clone._fuel = 1000;
+    bool done = joforth_eval(&clone, "22 jfib");
+    size_t slices = 1;
+    for (; !done; ++slices) {
+        done = joforth_resume(&clone);
+    }
+    assert(slices > 10 && joforth_pop_value(&clone) == 17711);
+    joforth_destroy(&clone);
+
+#if defined(JOFORTH_JIT) && defined(__linux__) && defined(__x86_64__) && JOFORTH_CELL_BITS == 64
+    for (size_t n = 0; n < sizeof(words) / sizeof(words[0]); ++n) {
+        assert(_test_is_compiled(&joforth, words[n]));
+    }
+    assert(!_test_is_compiled(&joforth, "jwait"));
+
+#if JOFORTH_CHECKS != JOFORTH_CHECKS_NONE
+    // native calls are limited to JOFORTH_IRSTACK_SIZE deep, and the stack is checked, as they are
+    // when interpreted, failing cleanly
+    assert(joforth_eval(&joforth, "200 jsumto"));
+    assert(joforth_pop_value(&joforth) == 20100);
+    static const char* const deep[] = { "1100 jsumto", "3000 jsumto", "2000 jfill", "900 jfill 200 jsumto" };
+    for (size_t n = 0; n < sizeof(deep) / sizeof(deep[0]); ++n) {
+        assert(!joforth_eval(&joforth, deep[n]) && joforth._status == _JO_STATUS_RESOURCE_EXHAUSTED);
+        joforth._status = _JO_STATUS_SUCCESS;
+        while (!joforth_stack_is_empty(&joforth)) {
+            joforth_pop_value(&joforth);
+        }
+        assert(joforth._jit_depth == 0);
+    }
+    assert(joforth_eval(&joforth, "100 jsumto"));
+    assert(joforth_pop_value(&joforth) == 5050);
+#endif
+#else
+    (void)words;
+#endif
+    joforth._output = output;
+}
+
+#if defined(JOFORTH_TEST_TRANSLATED)
+#include "joforth_source.h"
+
+// generated from joforth_test.fs by joforth2c, see CMakeLists.txt
+void joforth_test_words_register(joforth_t* joforth);
+
+// the native "tmix", which the translated code calls directly
+joforth_value_t test_mix(joforth_value_t a, joforth_value_t b) {
+    return a * 31 + b;
+}
+
+static void _test_translated_vm(joforth_t* vm, test_output_t* capture) {
+    memset(vm, 0, sizeof(*vm));
+    vm->_allocator = joforth._allocator;
+    joforth_initialise(vm);
+    vm->_output = *(&(joforth_output_t){
+        ._write = _test_write,
+        ._context = capture,
+    });
+    joforth_add_binary(vm, "tmix", test_mix);
+}
+
+void test_translated(void) {
+    // the words in joforth_test.fs must do the same interpreted and translated to C
+    test_output_t interpreted_output;
+    test_output_t translated_output;
+    joforth_t interpreted;
+    joforth_t translated;
+    _test_translated_vm(&interpreted, &interpreted_output);
+    _test_translated_vm(&translated, &translated_output);
+    char* source = joforth_source_read(JOFORTH_TEST_FIXTURE);
+    assert(source);
+    assert(joforth_source_compile(&interpreted, JOFORTH_TEST_FIXTURE, source));
+    free(source);
+    joforth_test_words_register(&translated);
+    assert(joforth_find(&translated, "tfib")->_type == kEntryType_Native);
+
+    static const char* const scripts[] = {
+        "7 tsq",
+        "20 tfib",
+        "784 48 tgcd 17 0 tgcd",
+        "5 tdown",
+        "3 tstars 1 tstars",
+        "255 thex -1 thex 255 .",
+        "2 3 tmixsq",
+        "0 tmisc 7 tmisc -3 tmisc",
+        "1 2 3 tlast",
+        // too few values
+        "tsq",
+        "1 tmixsq",
+    };
+    for (size_t n = 0; n < sizeof(scripts) / sizeof(scripts[0]); ++n) {
+        joforth_value_t expected[8];
+        joforth_value_t values[8];
+        const size_t expected_count = _test_run(&interpreted, scripts[n], expected, &interpreted_output);
+        const size_t count = _test_run(&translated, scripts[n], values, &translated_output);
+        assert(count == expected_count && strcmp(translated_output._text, interpreted_output._text) == 0);
+        assert(count == (size_t)-1 || memcmp(values, expected, count * sizeof(joforth_value_t)) == 0);
+    }
+    joforth_destroy(&interpreted);
+    joforth_destroy(&translated);
+}
+#endif
+
+#ifdef JOFORTH_TEST_THREADS
+typedef struct _test_thread {
+    pthread_t _thread;
+    int _index;
+    bool _passed;
+} test_thread_t;
+
+// every thread creates its own VMs, alternately initialised from scratch and cloned from the 
+// shared one (which nobody changes while the threads run), and checks they don't interfere
+static void* _test_thread(void* arg) {
+    test_thread_t* thread = (test_thread_t*)arg;
+    thread->_passed = true;
+    for (int round = 0; round < 50 && thread->_passed; ++round) {
+        joforth_t vm;
+        if ((round + thread->_index) & 1) {
+            assert(joforth_clone(&vm, &joforth));
+        }
+        else {
+            memset(&vm, 0, sizeof(vm));
+            vm._allocator = joforth._allocator;
+            joforth_initialise(&vm);
+        }
+        test_output_t output = { ._length = 0 };
+        vm._output = *(&(joforth_output_t){
+            ._write = _test_write,
+            ._context = &output,
+        });
+        char source[32];
+        snprintf(source, sizeof(source), "%d worker dup . cr", 1000 + thread->_index);
+        const joforth_value_t n = 1000 + thread->_index;
+        char expected[32];
+        snprintf(expected, sizeof(expected), "%lld\n", (long long)(n * (n + 1) / 2));
+        thread->_passed = joforth_eval(&vm, ": WORKER ( n -- sum ) 0 swap begin dup while tuck + swap 1 - repeat drop ;")
+            && joforth_eval(&vm, source)
+            && joforth_pop_value(&vm) == n * (n + 1) / 2
+            && joforth_stack_is_empty(&vm)
+            && strcmp(output._text, expected) == 0;
+        joforth_destroy(&vm);
+    }
+    return 0;
+}
+
+void test_threads(void) {
+    test_thread_t threads[8];
+    for (int i = 0; i < 8; ++i) {
+        threads[i]._index = i;
+        assert(pthread_create(&threads[i]._thread, 0, _test_thread, threads + i) == 0);
+    }
+    for (int i = 0; i < 8; ++i) {
+        pthread_join(threads[i]._thread, 0);
+        assert(threads[i]._passed);
+    }
+}
+#endif
+
+#if defined(JOFORTH_POOL)
+void test_pool(void) {
+    joforth_t prototype;
+    memset(&prototype, 0, sizeof(prototype));
+    prototype._allocator = joforth._allocator;
+    joforth_initialise(&prototype);
+    assert(joforth_eval(&prototype, ": SUMTO ( n -- sum ) 0 swap begin dup while tuck + swap 1 - repeat drop ;"));
+    assert(joforth_freeze(&prototype));
+
+    joforth_pool_t* pool = joforth_pool_create(&prototype, 4);
+    assert(pool && joforth_pool_threads(pool) == 4);
+    // jobs of very different lengths, some of which fail, or define a word which every 
+    // one of them can only do if it doesn't see the others' words
+    joforth_job_t* jobs[200];
+    char script[64];
+    for (int n = 0; n < 200; ++n) {
+        switch (n % 4) {
+        case 0:
+            snprintf(script, sizeof(script), ": LOCAL ( -- n ) %d ;", n);
+            break;
+        case 3:
+            snprintf(script, sizeof(script), "%d if 1", n);
+            break;
+        default:
+            snprintf(script, sizeof(script), "%d %d sumto", n, (n % 8) * 2000);
+        }
+        jobs[n] = joforth_pool_submit(pool, script);
+    }
+    for (int n = 0; n < 200; ++n) {
+        const joforth_value_t* values;
+        switch (n % 4) {
+        case 0:
+            assert(joforth_job_wait(jobs[n]));
+            assert(joforth_job_results(jobs[n], &values) == 0);
+            break;
+        case 3:
+            assert(!joforth_job_wait(jobs[n]));
+            assert(_JO_FAILED(joforth_job_status(jobs[n])));
+            break;
+        default:
+            assert(joforth_job_wait(jobs[n]));
+            assert(joforth_job_results(jobs[n], &values) == 2);
+            const joforth_value_t m = (n % 8) * 2000;
+            assert(values[0] == n && values[1] == m * (m + 1) / 2);
+        }
+        joforth_job_free(pool, jobs[n]);
+    }
+    joforth_pool_destroy(pool);
+    joforth_destroy(&prototype);
+}
+#endif
+
 void test_stack_ops(void) {
     assert(joforth_eval(&joforth, "2 drop"));
     assert(joforth_stack_is_empty(&joforth));
@@ -123,11 +1090,40 @@ int main(int argc, char* argv[]) {
     test_ifthenelse();
     test_dec_hex();
     test_loops();
+    test_while_repeat();
+    test_unbalanced_control_flow();
     test_create_allot();
+    test_dictionary();
     test_incorrect_number();
+    test_number_literals();
     test_comparison();
     test_arithmetic();
+    test_peephole();
+    test_inline();
     test_recurse_statement();
+    test_tail_calls();
+    test_primitives();
+    test_tokenizer();
+    test_statements();
+    test_call();
+    test_typed_natives();
+    test_compact_literals();
+    test_stack_effects();
+    test_image();
+    test_module();
+    test_clone();
+    test_overlays();
+    test_fuel();
+    test_jit();
+#if defined(JOFORTH_TEST_TRANSLATED)
+    test_translated();
+#endif
+#ifdef JOFORTH_TEST_THREADS
+    test_threads();
+#endif
+#if defined(JOFORTH_POOL)
+    test_pool();
+#endif
     
     printf(" bye\n");
     assert(joforth_stack_is_empty(&joforth));